@@ -0,0 +1,145 @@
+#pragma once
+
+// One anonymous mapping that every I/O and formatting buffer gets carved out of: the stream buffers, the vmsplice double buffers,
+// the spill buffers and the split mode part buffers.
+// Why one region:
+//	- huge pages are asked for once for all of it, instead of every buffer ending up as some random mix of huge and small pages.
+//	- alignment is under our control: everything is cache-line aligned at least (no false sharing between buffers that belong
+//		to different threads), the vmsplice buffers are page-aligned.
+//	- the memory budget (--memory-budget) is simply the size of the region, going over it is an allocation failure like any other.
+//	- teardown is one munmap.
+// NOTE: The region is mapped with MAP_NORESERVE, so the part nobody allocates costs address space and nothing else.
+// NOTE: Huge pages come from THP (madvise(MADV_HUGEPAGE) on a huge-page-aligned region), not from hugetlbfs (MAP_HUGETLB).
+// A hugetlbfs mapping takes its pages out of the pool up front (or SIGBUSes on fault with MAP_NORESERVE), which doesn't go together with
+// a region that's mostly unused reservation. The pool is empty on most systems anyway.
+// NOTE: Pages land on the NUMA node of the thread that touches them first, which is the thread that owns the buffer.
+// NOTE: The region is only mapped (and the page size, huge page size and THP mode only probed) on the first allocate(),
+// so a run that never allocates (the small_input engine) doesn't pay for any of it.
+// NOTE: It's a stack, not a heap: deallocate() gives back the memory and everything that was allocated after it, the rest lives until dispose().
+// embed() gives its buffers back in the reverse order of allocation, so an engine that has to fall back leaves the region the way it found it.
+
+#include "crossplatform_io.h"
+
+#ifdef PLATFORM_WINDOWS
+#error "arena.h" header file cannot be included when compiling for Windows
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+
+#include <sys/mman.h>
+
+#include "usdt.h"
+#include "capabilities.h"
+
+namespace arena {
+
+	inline constexpr size_t cache_line_size = 64;
+	// NOTE: Way more than any engine needs with the default parameters, it's only address space.
+	inline constexpr size_t default_size = 256 * 1024 * 1024;
+
+	inline char* base = nullptr;
+	inline size_t size = 0;
+	inline std::atomic<size_t> used = 0;
+	// NOTE: The most that was ever used at once, for --stats (used itself is back to where it started once embed() returns).
+	inline std::atomic<size_t> peak_used = 0;
+	// NOTE: The huge page size if madvise(MADV_HUGEPAGE) went through for the region, 0 otherwise.
+	// That only means huge pages were asked for, the kernel hands them out when the memory is faulted in (if it has any to spare),
+	// see huge_page_backed_bytes() for what we actually got.
+	inline size_t huge_page_advised_size = 0;
+
+	inline size_t configured_size = default_size;
+	inline bool configured_huge_pages = true;
+	// NOTE: Set if mapping the region failed, every allocate() fails from then on. Lets the caller tell that apart from running out of budget.
+	inline bool map_failed = false;
+
+	// Sets the size and page type for the region, which gets mapped on the first allocate().
+	// NOTE: Only call this before the first allocate().
+	inline void configure(size_t requested_size, bool use_huge_pages) noexcept {
+		configured_size = requested_size;
+		configured_huge_pages = use_huge_pages;
+	}
+
+	// Maps the region. The first allocate() calls this with whatever configure() was given.
+	inline bool initialize(size_t requested_size, bool use_huge_pages) noexcept {
+		const size_t page_size = capabilities::page_size();
+		size = (requested_size + page_size - 1) / page_size * page_size;
+		// NOTE: A region smaller than a huge page can't hold one anyway, and rounding it up would blow through the budget.
+		size_t alignment = page_size;
+		if (use_huge_pages && capabilities::thp_mode() != capabilities::thp_mode_t::NEVER &&
+		    capabilities::huge_page_size() != 0 && size >= capabilities::huge_page_size()) {
+			alignment = capabilities::huge_page_size();
+		}
+
+		// mmap only guarantees page alignment, so we map a bit more and cut the region out of the middle.
+		const size_t mapping_size = size + alignment - page_size;
+		char* mapping = (char*)mmap_probed(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (mapping == MAP_FAILED) {
+			size = 0;
+			map_failed = true;
+			return false;
+		}
+		base = (char*)(((uintptr_t)mapping + alignment - 1) / alignment * alignment);
+		// NOTE: Failing to trim only wastes address space, so we don't care if these fail.
+		if (base != mapping) { munmap_probed(mapping, base - mapping); }
+		if (mapping + mapping_size != base + size) { munmap_probed(base + size, mapping + mapping_size - (base + size)); }
+
+		if (alignment != page_size && madvise(base, size, MADV_HUGEPAGE) == 0) { huge_page_advised_size = alignment; }
+
+		return true;
+	}
+
+	// Returns nullptr once the region (the budget) is used up.
+	// NOTE: Safe to call from multiple threads at once, but the first call (the one that maps the region) has to be on its own.
+	inline void* allocate(size_t amount, size_t alignment = cache_line_size) noexcept {
+		if (base == nullptr && (map_failed || !initialize(configured_size, configured_huge_pages))) { return nullptr; }
+		size_t offset = used.load(std::memory_order_relaxed);
+		size_t aligned_offset;
+		do {
+			aligned_offset = (offset + alignment - 1) / alignment * alignment;
+			if (aligned_offset > size || amount > size - aligned_offset) { return nullptr; }
+		} while (!used.compare_exchange_weak(offset, aligned_offset + amount, std::memory_order_relaxed));
+		size_t peak = peak_used.load(std::memory_order_relaxed);
+		while (peak < aligned_offset + amount && !peak_used.compare_exchange_weak(peak, aligned_offset + amount, std::memory_order_relaxed)) { }
+		return base + aligned_offset;
+	}
+
+	// Gives back memory and everything that was allocated after it.
+	// NOTE: Only while no other thread allocates. The size is only there to match srcembed::allocator_t.
+	inline void deallocate(void* memory, size_t) noexcept {
+		const size_t offset = (char*)memory - base;
+		if (offset < used.load(std::memory_order_relaxed)) { used.store(offset, std::memory_order_relaxed); }
+	}
+
+	// How much of the region is backed by huge pages right now, from AnonHugePages in /proc/self/smaps.
+	// NOTE: The region can be more than one mapping in there (mbind() splits it up on NUMA machines), so every mapping inside of it counts.
+	// NOTE: Only meant for --stats at exit, it reads the whole smaps file.
+	inline size_t huge_page_backed_bytes() noexcept {
+		if (base == nullptr) { return 0; }
+		FILE* smaps = std::fopen("/proc/self/smaps", "r");
+		if (smaps == nullptr) { return 0; }
+		size_t result = 0;
+		bool inside = false;
+		char line[512];
+		while (std::fgets(line, sizeof(line), smaps) != nullptr) {
+			unsigned long begin;
+			unsigned long end;
+			if (std::sscanf(line, "%lx-%lx ", &begin, &end) == 2) {
+				inside = begin >= (uintptr_t)base && end <= (uintptr_t)base + size;
+				continue;
+			}
+			size_t kilobytes;
+			if (inside && std::sscanf(line, "AnonHugePages: %zu kB", &kilobytes) == 1) { result += kilobytes * 1024; }
+		}
+		std::fclose(smaps);
+		return result;
+	}
+
+	inline bool dispose() noexcept {
+		if (base == nullptr) { return true; }
+		return munmap_probed(base, size) == 0;
+	}
+
+}
@@ -1,14 +1,22 @@
 #pragma once
 
+#include <cstdlib>
 #include <algorithm>
 
 #include <thread>
+#include <chrono>
+#include <atomic>
 
 #include "crossplatform_io.h"
+#include "trace.h"
+#include "usdt.h"
+#include "progress.h"
 
 #ifndef PLATFORM_WINDOWS
 
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #endif
 
@@ -19,7 +27,74 @@ namespace asyncio {
 		right = false
 	};
 
-	buffer_position_t operator!(buffer_position_t buffer_position) noexcept { return (buffer_position_t)!(bool)buffer_position; }
+	inline buffer_position_t operator!(buffer_position_t buffer_position) noexcept { return (buffer_position_t)!(bool)buffer_position; }
+
+	// NOTE: Timing the waits costs two clock reads per wait, so it only happens when somebody asks for it (--stats, or when tracing).
+	// The syscall and byte counters in the streams are always on, those are a single add per syscall, which is nothing.
+	inline bool measure_wait_times = false;
+
+	enum class stream_thread_t {
+		READER,
+		FLUSHER,
+		IO
+	};
+
+	// NOTE: Optional hooks that run on the stream threads themselves, right after they start and right before they exit.
+	// Some things (like per-thread perf counters) can only be set up from the thread they're about, that's what these are for.
+	inline void (*stream_thread_start_hook)(stream_thread_t thread) noexcept = nullptr;
+	inline void (*stream_thread_exit_hook)(stream_thread_t thread) noexcept = nullptr;
+
+	// What a stream's io_step() did, see io_thread.
+	enum class io_step_result_t {
+		IDLE,		// waiting for the formatter to hand over a buffer
+		PROGRESS,
+		WOULD_BLOCK,	// waiting for the fd
+		DONE
+	};
+
+	class io_thread;
+
+	// Handoff latency: the time between one thread handing a buffer over and the thread that was waiting for it noticing.
+	// That's the part of every handover that depends on where the two threads run (same core, same L2/L3, other socket), see --pin.
+	// NOTE: Only handovers somebody was actually waiting for count, otherwise there's no latency to speak of.
+	// The stamp is written by the handing-over thread, the rest only by the waiting one.
+	struct handoff_t {
+		volatile uint64_t stamp_ns = 0;
+		double total_seconds = 0;
+		size_t count = 0;
+
+		double average_seconds() const noexcept { return count == 0 ? 0 : total_seconds / count; }
+	};
+
+	// NOTE: Has to happen before the flag that hands the buffer over is written.
+	inline void stamp_handoff(handoff_t& handoff) noexcept {
+		if (measure_wait_times || trace::enabled) { handoff.stamp_ns = trace::get_time_ns(); }
+	}
+
+	// NOTE: The waiting thread publishes what it's waiting on for --progress, but only if it actually ends up waiting.
+	template <typename condition_t>
+	inline void spin_while(condition_t condition, double& wait_seconds, const char* trace_name, progress::thread_t thread, progress::state_t waiting_state,
+			       handoff_t* handoff = nullptr) noexcept {
+		if (!condition()) { return; }
+		progress::state_scope wait_state(thread, waiting_state);
+		if (!measure_wait_times && !trace::enabled) {
+			while (condition()) { }
+			return;
+		}
+		const uint64_t wait_start_ns = trace::get_time_ns();
+		while (condition()) { }
+		const uint64_t wait_end_ns = trace::get_time_ns();
+		const uint64_t wait_duration_ns = wait_end_ns - wait_start_ns;
+		wait_seconds += wait_duration_ns / 1000000000.0;
+		if (trace::enabled) { trace::record(trace_name, wait_start_ns, wait_duration_ns); }
+		if (handoff != nullptr) {
+			const uint64_t stamp_ns = handoff->stamp_ns;
+			if (stamp_ns >= wait_start_ns && stamp_ns <= wait_end_ns) {
+				handoff->total_seconds += (wait_end_ns - stamp_ns) / 1000000000.0;
+				handoff->count++;
+			}
+		}
+	}
 
 	/*
 	   Everyone is saying I shouldn't use volatile for multi-threaded logistics and such, but I think my implementation
@@ -47,8 +122,11 @@ namespace asyncio {
 					practical for us because that's the exact behaviour we need.
 	*/
 
-	template <size_t buffer_size>
-	class stdin_stream {
+	// Streams are plain objects over any fd, each with its own double buffer and its own reader/flusher thread,
+	// so a process can have as many of them going at once as it likes (srcembed's read and write engines start one of each per embed() call).
+	// NOTE: The buffer size given to the constructor can still be changed with set_buffer_size() before initialize().
+	// NOTE: The thread hooks and the --progress state above are shared by all streams.
+	class input_stream {
 		// NOTE: Multi-byte volatile variables could technically tear when reading from them.
 		// Because the write to the variable happens in multiple stages, so the read could see multiple versions where
 		// individual bytes were changed. This shouldn't happen as much on modern machines because they operate on units
@@ -57,25 +135,112 @@ namespace asyncio {
 		// at a time, idk what the bus looks like on x64. It definitely happens (AFAIK) when you write to a 64-bit variable on x86,
 		// since that requires two separate RAM writes.
 
-		static inline volatile char buffer[buffer_size * 2];
-
-		static inline const volatile char* buffer_stream_write_head = nullptr;
-		static inline const volatile char* buffer_stream_write_head_copy = nullptr;
-		static inline const volatile char* buffer_user_read_head = buffer;
+		const int fd;
+		size_t buffer_size;
+		volatile char* buffer = nullptr;
+
+		// NOTE: The fd belongs to the caller, who doesn't expect to get it back non-blocking. -1 until initialize() changed them.
+		int original_fd_flags = -1;
+
+		// NOTE: The pointer itself has to be volatile as well, not just the data it points to, since it is shared with the reader thread.
+		// Without that, the compiler is free to move the reads of it to before the spin on buffer_read_pending (and the writes to after),
+		// which makes the consumer miss the EOF marker and happily read stale data out of the old buffer.
+		const volatile char* volatile buffer_stream_write_head = nullptr;
+		const volatile char* buffer_stream_write_head_copy = nullptr;
+		const volatile char* buffer_user_read_head = nullptr;
+
+		std::thread reader_thread;
+
+		volatile buffer_position_t empty_buffer = buffer_position_t::right;
+		volatile bool buffer_read_pending = false;
+
+		volatile bool finalize_reader_thread = false;
+
+		// NOTE: Only touched by the consuming thread.
+		uint64_t buffer_drain_start_ns = 0;
+
+		// NOTE: Only touched by the consuming thread. See acquire().
+		char carry_buffer[64];
+		bool span_is_carry = false;
+		const volatile char* current_buffer_start = nullptr;
+		// NOTE: The saved end of the last buffer has room for a whole look-behind in front of a carried element.
+		char look_behind_buffer[64 + sizeof(carry_buffer)];
+		size_t look_behind_saved_size = 0;
+		char look_behind_assembly_buffer[64];
+
+		// Single I/O thread mode (see io_thread):
+		// NOTE: wakeup_fd stays -1 when the stream has a thread of its own. Only the I/O thread touches the io_ variables.
+		friend class io_thread;
+		int wakeup_fd = -1;
+		bool io_thread_attached = false;
+		bool io_finished = false;
+		bool io_filling = false;
+		buffer_position_t io_fill_target = buffer_position_t::right;
+		volatile char* io_fill_ptr = nullptr;
+		size_t io_fill_remaining = 0;
+
+		// NOTE: Called by the consuming thread right after every handover (and the fake one in dispose()).
+		void on_handover() noexcept {
+			stamp_handoff(reader_handoff);
+#ifndef PLATFORM_WINDOWS
+			if (wakeup_fd != -1) { eventfd_write(wakeup_fd, 1); }
+#endif
+		}
 
-		static inline std::thread reader_thread;
+#ifndef PLATFORM_WINDOWS
+		// Does the same thing as the reader thread, one read() at a time and without ever blocking.
+		io_step_result_t io_step() noexcept {
+			if (!io_thread_attached || io_finished || finalize_reader_thread) { return io_step_result_t::DONE; }
+			if (!io_filling) {
+				if (empty_buffer != io_fill_target) { return io_step_result_t::IDLE; }
+				io_fill_ptr = buffer + (io_fill_target == buffer_position_t::right) * buffer_size;
+				io_fill_remaining = buffer_size;
+				io_filling = true;
+			}
 
-		static inline volatile buffer_position_t empty_buffer = buffer_position_t::right;
-		static inline volatile bool buffer_read_pending = false;
+			trace::scope read_scope("read");
+			progress::state_scope read_state(progress::thread_t::READER, progress::state_t::READING);
+			const sioret_t bytes_read = crossplatform_read(fd, (char*)io_fill_ptr, io_fill_remaining);
+			read_syscall_count++;
+			if (bytes_read == -1) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK) { return io_step_result_t::WOULD_BLOCK; }
+				if (errno == EINTR) { return io_step_result_t::PROGRESS; }
+				finalize_reader_thread = true;
+				stamp_handoff(consumer_handoff);
+				buffer_read_pending = false;
+				return io_step_result_t::DONE;
+			}
+			if (bytes_read == 0) {
+				buffer_stream_write_head = io_fill_ptr;
+				stamp_handoff(consumer_handoff);
+				buffer_read_pending = false;
+				io_finished = true;
+				return io_step_result_t::DONE;
+			}
 
-		static inline volatile bool finalize_reader_thread = false;
+			total_bytes_read += bytes_read;
+			progress::add_input_bytes(bytes_read);
+			io_fill_ptr += bytes_read;
+			io_fill_remaining -= bytes_read;
+			if (io_fill_remaining == 0) {
+				io_filling = false;
+				io_fill_target = !io_fill_target;
+				stamp_handoff(consumer_handoff);
+				buffer_read_pending = false;
+			}
+			return io_step_result_t::PROGRESS;
+		}
+#endif
 
-		static sioret_t read_full_buffer(volatile char* buf, size_t count) noexcept {
+		sioret_t read_full_buffer(volatile char* buf, size_t count) noexcept {
+			trace::scope fill_scope("fill input buffer");
+			progress::state_scope read_state(progress::thread_t::READER, progress::state_t::READING);
 			volatile char* original_buf_ptr = buf;
 			while (true) {
 				if (finalize_reader_thread) { return -2; }
 
-				sioret_t bytes_read = crossplatform_read(STDIN_FILENO, (char*)buf, count);
+				sioret_t bytes_read = crossplatform_read(fd, (char*)buf, count);
+				read_syscall_count++;
 				if (bytes_read == -1) {
 #ifndef PLATFORM_WINDOWS
 					if (errno == EAGAIN || errno == EWOULDBLOCK) {		// NOTE: Branch predictor should essentially never fail here, making this super duper fast!
@@ -86,62 +251,151 @@ namespace asyncio {
 				}
 				if (bytes_read == 0) { return buf - original_buf_ptr; }
 
+				total_bytes_read += bytes_read;
+				progress::add_input_bytes(bytes_read);
 				count -= bytes_read;
 				if (count == 0) { return -1; }
 				buf += bytes_read;
 			}
 		}
 
-		static void reader_thread_code() noexcept {
+		void reader_thread_loop() noexcept {
 			while (true) {
-				while (empty_buffer == buffer_position_t::left) { }
+				spin_while([this]() { return empty_buffer == buffer_position_t::left; }, reader_wait_seconds, "wait for empty input buffer", progress::thread_t::READER, progress::state_t::WAITING_FOR_OUTPUT, &reader_handoff);
 
 				sioret_t read_result = read_full_buffer(buffer + buffer_size, buffer_size);
 				switch (read_result) {
 				case -3:
 					finalize_reader_thread = true;
+					stamp_handoff(consumer_handoff);
 					buffer_read_pending = false;
 				case -2: return;
 				case -1: break;
 				default:
 					 buffer_stream_write_head = buffer + buffer_size + read_result;
+					 stamp_handoff(consumer_handoff);
 					 buffer_read_pending = false;
 					 return;
 				}
 
+				stamp_handoff(consumer_handoff);
+
 				buffer_read_pending = false;
 
-				while (empty_buffer == buffer_position_t::right) { }
+				spin_while([this]() { return empty_buffer == buffer_position_t::right; }, reader_wait_seconds, "wait for empty input buffer", progress::thread_t::READER, progress::state_t::WAITING_FOR_OUTPUT, &reader_handoff);
 
 				read_result = read_full_buffer(buffer, buffer_size);
 				switch (read_result) {
 				case -3:
 					finalize_reader_thread = true;
+					stamp_handoff(consumer_handoff);
 					buffer_read_pending = false;
 				case -2: return;
 				case -1: break;
 				default:
 					 buffer_stream_write_head = buffer + read_result;
+					 stamp_handoff(consumer_handoff);
 					 buffer_read_pending = false;
 					 return;
 				}
 
+				stamp_handoff(consumer_handoff);
+
 				buffer_read_pending = false;
 			}
 		}
 
+		void reader_thread_code() noexcept {
+			if (stream_thread_start_hook != nullptr) { stream_thread_start_hook(stream_thread_t::READER); }
+			progress::set_state(progress::thread_t::READER, progress::state_t::WORKING);
+			reader_thread_loop();
+			progress::set_state(progress::thread_t::READER, progress::state_t::NOT_RUNNING);
+			if (stream_thread_exit_hook != nullptr) { stream_thread_exit_hook(stream_thread_t::READER); }
+		}
+
+		// Hands the drained buffer back to the reader thread and moves the read head to the start of the other one.
+		// Returns false if the reader thread ran into an error.
+		// NOTE: This is the only place where the consuming side touches the handover flags, read() and acquire() both go through here.
+		bool swap_buffers() noexcept {
+			trace::end("drain input buffer", buffer_drain_start_ns);
+			spin_while([this]() { return buffer_read_pending; }, consumer_wait_seconds, "wait on buffer_read_pending", progress::thread_t::FORMATTER, progress::state_t::WAITING_FOR_INPUT, &consumer_handoff);
+
+			// NOTE: The read head is only moved after this, so that an error doesn't eat the bytes that are still in the buffer.
+			if (finalize_reader_thread) { return false; }
+
+			// NOTE: The drained buffer belongs to the reader thread again after this, so the end of it is saved for the look-behind of the next spans.
+			// (read() doesn't move the read head to the end before it gets here, but a buffer is only ever swapped out once it's drained.)
+			look_behind_saved_size = minimum_value(sizeof(look_behind_buffer), buffer_size);
+			std::copy(current_buffer_start + buffer_size - look_behind_saved_size, current_buffer_start + buffer_size, look_behind_buffer);
+
+			buffer_stream_write_head_copy = buffer_stream_write_head;
+
+			buffer_read_pending = true;
+			empty_buffer = !empty_buffer;
+			on_handover();
+			USDT_PROBE1(asyncio, input_buffer_swap, (bool)empty_buffer);
+			buffer_drain_start_ns = trace::begin();
+
+			buffer_user_read_head = buffer + (bool)empty_buffer * buffer_size;
+			current_buffer_start = buffer_user_read_head;
+			return true;
+		}
+
+		// NOTE: Only once nothing reads from the fd anymore. That's dispose() for a stream with its own reader thread,
+		// an io_thread could still be in the middle of a read then, so it's io_thread::dispose() for the streams handed to one.
+		void restore_fd_flags() noexcept {
+#ifndef PLATFORM_WINDOWS
+			if (original_fd_flags == -1) { return; }
+			fcntl(fd, F_SETFL, original_fd_flags);
+			original_fd_flags = -1;
+#endif
+		}
+
 	public:
+		input_stream(int fd, size_t buffer_size) noexcept : fd(fd), buffer_size(buffer_size) { }
+
+		input_stream(const input_stream&) = delete;
+		input_stream& operator=(const input_stream&) = delete;
+
+		// Instrumentation:
+		// NOTE: Apart from during initialize(), only the reader thread touches the first three and only the consuming thread touches the last one,
+		// so they don't need to be volatile. Only read them after dispose() though, the join is what makes them safe to look at.
+		size_t read_syscall_count = 0;
+		size_t total_bytes_read = 0;
+		double reader_wait_seconds = 0;
+		double consumer_wait_seconds = 0;
+		// NOTE: The first one is the formatter handing an empty buffer to the reader, the second one the reader handing a full one back.
+		handoff_t reader_handoff;
+		handoff_t consumer_handoff;
+
+		// NOTE: Only allowed before initialize().
+		void set_buffer_size(size_t size) noexcept { buffer_size = size; }
+
+		// Hands the stream its buffers (2 * the buffer size), instead of initialize() mallocing them (srcembed gets them from its allocator).
+		// NOTE: Only allowed before initialize(). The stream never frees them, they have to outlive dispose().
+		void set_buffer(void* memory) noexcept { buffer = (volatile char*)memory; }
+
 		// NOTE: Calling this function more than once is super duper UNDEFINED!
-		static bool initialize() noexcept {
+		// NOTE: With own_thread == false, the stream doesn't start a reader thread, hand it to an io_thread instead.
+		bool initialize(bool own_thread = true) noexcept {
+			if (buffer == nullptr) { buffer = (volatile char*)std::malloc(buffer_size * 2); }
+			if (buffer == nullptr) { return false; }
+			buffer_user_read_head = buffer;
+			current_buffer_start = buffer;
+
 #ifndef PLATFORM_WINDOWS
-			int stdin_fd_flags = fcntl(STDIN_FILENO, F_GETFL);
-			if (stdin_fd_flags == -1) { return false; }
-			if (fcntl(STDIN_FILENO, F_SETFL, stdin_fd_flags | O_NONBLOCK) == -1) { return false; }
+			const int fd_flags = fcntl(fd, F_GETFL);
+			if (fd_flags == -1) { return false; }
+			if (fcntl(fd, F_SETFL, fd_flags | O_NONBLOCK) == -1) { return false; }
+			original_fd_flags = fd_flags;
 #endif
 
 			const sioret_t read_result = read_full_buffer(buffer, buffer_size);
 			switch (read_result) {
-			case -3: return false;
+			case -3:
+				// NOTE: Nobody calls dispose() on a stream that failed to initialize.
+				restore_fd_flags();
+				return false;
 			// case -2: while (true) { }	<-- shouldn't ever happen
 			case -1: break;
 			default:
@@ -149,6 +403,9 @@ namespace asyncio {
 				 return true;
 			}
 
+			// NOTE: The reader thread starts filling the right buffer straight away, so the first swap has to wait for it just like all the other ones.
+			buffer_read_pending = true;
+
 			// INTERESTING NOTE: std::thread cannot be made volatile, but it doesn't have to be.
 			// In C++, memory is "committed" before calling functions, because those functions could theoretically
 			// read from the memory, and the correct value needs to be there.
@@ -158,19 +415,21 @@ namespace asyncio {
 			// so I presume all "hot" variables are written to memory before calling the syscall.
 			// This might seem a slight bit inefficient and dirty, but it's the only clean way of handling this.
 			// Any other system would induce a lot of complexity and confusion I presume.
-			reader_thread = std::thread((void(*)())reader_thread_code);
+			if (own_thread) { reader_thread = std::thread(&input_stream::reader_thread_code, this); }
+			else { io_thread_attached = true; }
 
+			buffer_drain_start_ns = trace::begin();
 			return true;
 		}
 
 		template <typename T>
-		static const T& minimum_value(const T& a, const T& b) noexcept {
+		const T& minimum_value(const T& a, const T& b) noexcept {
 			return a < b ? a : b;	// NOTE: This is ok, since: 1. it's so simple that compiler will optimize if there is something to optimize
 						// 			    2. there is nothing to optimize since "a" will be smaller every time until the one time where it isn't, where EOF is encountered. --> epic branch prediction, very efficient!
 		}
 
 		// NOTE: You can call this function as many times as you like, even input EOF. It'll always just return 0 in that case, but you can totally do it.
-		static ssize_t read(char* output_ptr, size_t output_size) noexcept {
+		ssize_t read(char* output_ptr, size_t output_size) noexcept {
 			if (buffer_stream_write_head_copy != nullptr) {
 				const volatile char* read_end_ptr = minimum_value(buffer_user_read_head + output_size, buffer_stream_write_head_copy);
 				std::copy(buffer_user_read_head, read_end_ptr, output_ptr);
@@ -201,20 +460,8 @@ namespace asyncio {
 				const size_t full_space = current_buffer_end_ptr - buffer_user_read_head;
 				output_ptr += full_space;
 				output_size -= full_space;
-	
-				while (buffer_read_pending) { }
-
-				if (finalize_reader_thread) { return -1; }
 
-				buffer_stream_write_head_copy = buffer_stream_write_head;
-
-				buffer_read_pending = true;
-				empty_buffer = !empty_buffer;
-
-				// NOTE: We do this here because:
-				// 1. We don't want error (finalize_reader_thread) to cause buffer bytes to be eaten, which would happen if this were above the if-stm.
-				// 2. We use the inverted value of empty_buffer, which is only accessible here.
-				buffer_user_read_head = buffer + (bool)empty_buffer * buffer_size;
+				if (!swap_buffers()) { return -1; }
 
 				if (buffer_stream_write_head_copy != nullptr) {
 					const volatile char* read_end_ptr = minimum_value(buffer_user_read_head + output_size, buffer_stream_write_head_copy);
@@ -226,134 +473,260 @@ namespace asyncio {
 			}
 		}
 
-		struct data_ptr_return_t {
-			const volatile char* data_ptr;
+		// Span API:
+		// acquire() hands out the largest contiguous readable region straight out of the stream buffer, release() consumes (part of) it.
+		// That lets a consumer chew through a whole buffer per call (SIMD, multi-chunk formatting) instead of going through read() for every chunk.
+		// The size of a span is always a multiple of granularity, except for the very last one before EOF.
+		// When less than granularity bytes are left before the buffer seam, those bytes are copied into a small carry buffer
+		// together with the start of the next buffer and the carry buffer is handed out instead (a single element's worth of data).
+		// Look-behind: every span also comes with the bytes that come right before it in the input (up to max_look_behind of them,
+		// fewer at the start of the input), for formats where an element depends on the ones before it.
+		// Those can be in the buffer that was just handed back to the reader thread, so the end of every drained buffer is saved in a small buffer.
+		// NOTE: Returns a span with size 0 at EOF and a span with data == nullptr if reading failed.
+		// NOTE: Only one span can be acquired at a time, and a carry span has to be released in full.
+		// NOTE: The look-behind assumes the buffer size is at least max_look_behind + max_span_granularity.
+		struct span_t {
+			const volatile char* data;
 			size_t size;
+			// NOTE: look_behind_size bytes, the last one of them is the byte right in front of data[0]. Valid until release(), like data.
+			const volatile char* look_behind;
+			size_t look_behind_size;
 		};
 
-		static data_ptr_return_t get_data_ptr(char* output_ptr, size_t output_size) noexcept {
-			if (buffer_stream_write_head_copy != nullptr) {
-				const volatile char* read_end_ptr = buffer_user_read_head + output_size;
-				if (read_end_ptr <= buffer_stream_write_head_copy) {
-					const volatile char* result = buffer_user_read_head;
-					buffer_user_read_head = read_end_ptr;
-					return { result, output_size };
-				}
+		static constexpr size_t max_span_granularity = sizeof(carry_buffer);
+		static constexpr size_t max_look_behind = sizeof(look_behind_assembly_buffer);
 
-				const size_t amount_read = buffer_stream_write_head_copy - buffer_user_read_head;
-				const volatile char* result = buffer_user_read_head;
-				buffer_user_read_head = buffer_stream_write_head_copy;
-				return { result, amount_read };
-			}
-
-			const volatile char* current_buffer_end_ptr = buffer + buffer_size + (bool)empty_buffer * buffer_size;
-
-			const volatile char* read_end_ptr = buffer_user_read_head + output_size;
-			if (read_end_ptr < current_buffer_end_ptr) {
-				const volatile char* result = buffer_user_read_head;
-				buffer_user_read_head = read_end_ptr;
-				return { result, output_size };
+	private:
+		span_t span_at_read_head(size_t size) noexcept {
+			const size_t in_buffer = buffer_user_read_head - current_buffer_start;
+			if (in_buffer >= max_look_behind || look_behind_saved_size == 0) {
+				const size_t look_behind_size = minimum_value(in_buffer, max_look_behind);
+				return { buffer_user_read_head, size, buffer_user_read_head - look_behind_size, look_behind_size };
 			}
+			// NOTE: Right after a seam, the look-behind is the saved end of the last buffer followed by the start of this one.
+			const size_t saved_part = minimum_value(look_behind_saved_size, max_look_behind - in_buffer);
+			std::copy(look_behind_buffer + look_behind_saved_size - saved_part, look_behind_buffer + look_behind_saved_size, look_behind_assembly_buffer);
+			std::copy(current_buffer_start, buffer_user_read_head, look_behind_assembly_buffer + saved_part);
+			return { buffer_user_read_head, size, look_behind_assembly_buffer, saved_part + in_buffer };
+		}
 
-			const size_t orig_output_size = output_size;
+	public:
+		template <size_t granularity = 1>
+		span_t acquire() noexcept {
+			static_assert(granularity != 0 && granularity <= max_span_granularity, "span granularity doesn't fit into the carry buffer");
 
 			while (true) {
-				std::copy(buffer_user_read_head, current_buffer_end_ptr, output_ptr);
-				const size_t full_space = current_buffer_end_ptr - buffer_user_read_head;
-				output_ptr += full_space;
-				output_size -= full_space;
-	
-				while (buffer_read_pending) { }
-
-				if (finalize_reader_thread) { return { nullptr, 0 }; }
-
-				buffer_stream_write_head_copy = buffer_stream_write_head;
-
-				buffer_read_pending = true;
-				empty_buffer = !empty_buffer;
+				const volatile char* readable_end_ptr = buffer_stream_write_head_copy;
+				if (readable_end_ptr == nullptr) { readable_end_ptr = buffer + buffer_size + (bool)empty_buffer * buffer_size; }
+				const size_t available = readable_end_ptr - buffer_user_read_head;
 
-				buffer_user_read_head = buffer + (bool)empty_buffer * buffer_size;
-				current_buffer_end_ptr = buffer_user_read_head + buffer_size;
+				if (available >= granularity) { return span_at_read_head(available / granularity * granularity); }
+				// NOTE: At EOF, the short tail is all there is.
+				if (buffer_stream_write_head_copy != nullptr) { return span_at_read_head(available); }
 
-				if (buffer_stream_write_head_copy != nullptr) {
-					const volatile char* read_end_ptr = minimum_value(buffer_user_read_head + output_size, buffer_stream_write_head_copy);
-					std::copy(buffer_user_read_head, read_end_ptr, output_ptr);
-					const size_t amount_read = read_end_ptr - buffer_user_read_head;
-					buffer_user_read_head = read_end_ptr;
-					return { output_ptr, orig_output_size - output_size + amount_read };
+				if (available == 0) {
+					if (!swap_buffers()) { return { nullptr, 0, nullptr, 0 }; }
+					continue;
 				}
 
-				read_end_ptr = buffer_user_read_head + output_size;
-				if (read_end_ptr < current_buffer_end_ptr) {
-					std::copy(buffer_user_read_head, read_end_ptr, output_ptr);
-					buffer_user_read_head = read_end_ptr;
-					return { output_ptr, orig_output_size };
-				}
+				const ssize_t amount_read = read(carry_buffer, granularity);
+				if (amount_read == -1) { return { nullptr, 0, nullptr, 0 }; }
+				span_is_carry = true;
+				// NOTE: read() went through the seam, so the saved end of the last buffer ends with the carried bytes, the look-behind is what's in front of them.
+				const size_t look_behind_size = minimum_value(look_behind_saved_size - available, max_look_behind);
+				return { carry_buffer, (size_t)amount_read, look_behind_buffer + look_behind_saved_size - available - look_behind_size, look_behind_size };
 			}
 		}
 
+		void release(size_t amount) noexcept {
+			if (span_is_carry) {
+				span_is_carry = false;
+				return;
+			}
+			buffer_user_read_head += amount;
+		}
+
 		// NOTE: As of this moment, I'm standardizing the fact that calling this function more than once and/or calling the initialize() function after calling this function is UNDEFINED.
 		// REASON: for the former: implementation may change ; for the latter: that just straight up doesn't work, probably causes some undefined behavior somewhere or something.
-		static void dispose() noexcept {
-			if (reader_thread.joinable()) {
+		void dispose() noexcept {
+			if (reader_thread.joinable() || io_thread_attached) {
 				finalize_reader_thread = true;
 				// NOTE: This may look wrong, but I assure you it isn't.
 				empty_buffer = !empty_buffer;
-				reader_thread.join();
+				on_handover();
+				if (reader_thread.joinable()) { reader_thread.join(); }
 			}
+			if (wakeup_fd == -1) { restore_fd_flags(); }
 		}
 	};
 
-	template <size_t buffer_size>
-	class stdout_stream {
-		static inline volatile char buffer[buffer_size * 2];
+	class output_stream {
+		const int fd;
+		size_t buffer_size;
+		volatile char* buffer = nullptr;
+
+		volatile char* buffer_user_write_head = nullptr;
+
+		std::thread flusher_thread;
+
+		volatile buffer_position_t full_buffer = buffer_position_t::right;
+		volatile bool buffer_flush_pending = false;
 
-		static inline volatile char* buffer_user_write_head = buffer;
+		volatile size_t flush_size;
 
-		static inline std::thread flusher_thread;
+		volatile bool finalize_flusher_thread = false;
 
-		static inline volatile buffer_position_t full_buffer = buffer_position_t::right;
-		static inline volatile bool buffer_flush_pending = false;
+		// NOTE: Only touched by the producing thread.
+		uint64_t buffer_fill_start_ns = 0;
 
-		static inline volatile size_t flush_size = buffer_size;
+		// NOTE: Only touched by the producing thread. See reserve().
+		char reserve_spill_buffer[4096];
+		bool reservation_is_spill = false;
 
-		static inline volatile bool finalize_flusher_thread = false;
+		// Single I/O thread mode, same as in input_stream.
+		friend class io_thread;
+		int wakeup_fd = -1;
+		bool io_thread_attached = false;
+		bool io_flushing = false;
+		buffer_position_t io_flush_target = buffer_position_t::left;
+		const volatile char* io_flush_ptr = nullptr;
+		size_t io_flush_remaining = 0;
+
+		void on_handover() noexcept {
+			stamp_handoff(flusher_handoff);
+#ifndef PLATFORM_WINDOWS
+			if (wakeup_fd != -1) { eventfd_write(wakeup_fd, 1); }
+#endif
+		}
 
-		static void flusher_thread_code() noexcept {
+#ifndef PLATFORM_WINDOWS
+		// Does the same thing as the flusher thread, one write() at a time. Only writes when the I/O thread says the fd is writable.
+		// NOTE: The write itself is still a normal blocking write (stdout isn't ours to make non-blocking, the vmsplice engines write to it directly),
+		// so if the pipe fills up halfway through, reading stalls until it drains again. The formatter is waiting on that buffer at that point anyway.
+		io_step_result_t io_step(bool writable) noexcept {
+			if (!io_thread_attached || finalize_flusher_thread) { return io_step_result_t::DONE; }
+			if (!io_flushing) {
+				if (full_buffer != io_flush_target) { return io_step_result_t::IDLE; }
+				io_flush_ptr = buffer + (io_flush_target == buffer_position_t::right) * buffer_size;
+				io_flush_remaining = flush_size;
+				io_flushing = true;
+			}
+			if (!writable) { return io_step_result_t::WOULD_BLOCK; }
+
+			trace::scope write_scope("write");
+			progress::state_scope write_state(progress::thread_t::FLUSHER, progress::state_t::WRITING);
+			const sioret_t bytes_written = crossplatform_write(fd, (const char*)io_flush_ptr, io_flush_remaining);
+			write_syscall_count++;
+			if (bytes_written == -1) {
+				if (errno == EINTR) { return io_step_result_t::PROGRESS; }
+				finalize_flusher_thread = true;
+				stamp_handoff(producer_handoff);
+				buffer_flush_pending = false;
+				return io_step_result_t::DONE;
+			}
+
+			io_flush_ptr += bytes_written;
+			io_flush_remaining -= bytes_written;
+			if (io_flush_remaining == 0) {
+				total_bytes_written += flush_size;
+				progress::add_output_bytes(flush_size);
+				io_flushing = false;
+				io_flush_target = !io_flush_target;
+				stamp_handoff(producer_handoff);
+				buffer_flush_pending = false;
+			}
+			return io_step_result_t::PROGRESS;
+		}
+#endif
+
+		bool write_buffer(const volatile char* buf) noexcept {
+			trace::scope write_scope("write");
+			progress::state_scope write_state(progress::thread_t::FLUSHER, progress::state_t::WRITING);
+			write_syscall_count++;
+			return crossplatform_write(fd, (const char*)buf, flush_size) != -1;
+		}
+
+		void flusher_thread_loop() noexcept {
 			while (true) {
-				while (full_buffer == buffer_position_t::right) { }
+				spin_while([this]() { return full_buffer == buffer_position_t::right; }, flusher_wait_seconds, "wait for full output buffer", progress::thread_t::FLUSHER, progress::state_t::WAITING_FOR_INPUT, &flusher_handoff);
 
 				if (finalize_flusher_thread) { return; }
 
-				if (crossplatform_write(STDOUT_FILENO, (char*)buffer, flush_size) == -1) {
+				if (!write_buffer(buffer)) {
 					finalize_flusher_thread = true;
+					stamp_handoff(producer_handoff);
 					buffer_flush_pending = false;
 					return;
 				}
 
+				total_bytes_written += flush_size;
+				progress::add_output_bytes(flush_size);
+				stamp_handoff(producer_handoff);
 				buffer_flush_pending = false;
 
-				while (full_buffer == buffer_position_t::left) { }
+				spin_while([this]() { return full_buffer == buffer_position_t::left; }, flusher_wait_seconds, "wait for full output buffer", progress::thread_t::FLUSHER, progress::state_t::WAITING_FOR_INPUT, &flusher_handoff);
 
 				if (finalize_flusher_thread) { return; }
 
-				if (crossplatform_write(STDOUT_FILENO, (char*)(buffer + buffer_size), flush_size) == -1) {
+				if (!write_buffer(buffer + buffer_size)) {
 					finalize_flusher_thread = true;
+					stamp_handoff(producer_handoff);
 					buffer_flush_pending = false;
 					return;
 				}
 
+				total_bytes_written += flush_size;
+				progress::add_output_bytes(flush_size);
+				stamp_handoff(producer_handoff);
 				buffer_flush_pending = false;
 			}
 		}
 
+		void flusher_thread_code() noexcept {
+			if (stream_thread_start_hook != nullptr) { stream_thread_start_hook(stream_thread_t::FLUSHER); }
+			progress::set_state(progress::thread_t::FLUSHER, progress::state_t::WORKING);
+			flusher_thread_loop();
+			progress::set_state(progress::thread_t::FLUSHER, progress::state_t::NOT_RUNNING);
+			if (stream_thread_exit_hook != nullptr) { stream_thread_exit_hook(stream_thread_t::FLUSHER); }
+		}
+
 	public:
-		// NOTE: As above, UNDEFINED to call this more than once.
-		static void initialize() noexcept {
-			flusher_thread = std::thread((void(*)())flusher_thread_code);
+		output_stream(int fd, size_t buffer_size) noexcept : fd(fd), buffer_size(buffer_size), flush_size(buffer_size) { }
+
+		output_stream(const output_stream&) = delete;
+		output_stream& operator=(const output_stream&) = delete;
+
+		// Instrumentation:
+		// NOTE: Same deal as in input_stream, the flusher thread owns the first three and the producing thread owns the last one.
+		size_t write_syscall_count = 0;
+		size_t total_bytes_written = 0;
+		double flusher_wait_seconds = 0;
+		double producer_wait_seconds = 0;
+		handoff_t flusher_handoff;
+		handoff_t producer_handoff;
+
+		// NOTE: As above, only allowed before initialize().
+		void set_buffer_size(size_t size) noexcept {
+			buffer_size = size;
+			flush_size = size;
+		}
+
+		// NOTE: Same as in input_stream.
+		void set_buffer(void* memory) noexcept { buffer = (volatile char*)memory; }
+
+		// NOTE: As above, UNDEFINED to call this more than once. Same goes for own_thread.
+		bool initialize(bool own_thread = true) noexcept {
+			if (buffer == nullptr) { buffer = (volatile char*)std::malloc(buffer_size * 2); }
+			if (buffer == nullptr) { return false; }
+			buffer_user_write_head = buffer;
+
+			if (own_thread) { flusher_thread = std::thread(&output_stream::flusher_thread_code, this); }
+			else { io_thread_attached = true; }
+			buffer_fill_start_ns = trace::begin();
+			return true;
 		}
 
-		static bool write(const char* input_ptr, size_t input_size) noexcept {
+		bool write(const char* input_ptr, size_t input_size) noexcept {
 			while (true) {
 				// NOTE: We could have done this branchless, but we're optimizing for small writes, which makes this more optimal than branchless in this case.
 				if (full_buffer == buffer_position_t::left) {
@@ -373,12 +746,16 @@ namespace asyncio {
 						input_ptr = new_input_ptr;
 						input_size -= free_space;
 
-						while (buffer_flush_pending) { }
+						trace::end("fill output buffer", buffer_fill_start_ns);
+						spin_while([this]() { return buffer_flush_pending; }, producer_wait_seconds, "wait on buffer_flush_pending", progress::thread_t::FORMATTER, progress::state_t::WAITING_FOR_OUTPUT, &producer_handoff);
 
 						if (finalize_flusher_thread) { return false; }
 
 						buffer_flush_pending = true;
 						full_buffer = buffer_position_t::right;
+						on_handover();
+						USDT_PROBE2(asyncio, output_buffer_swap, (bool)full_buffer, buffer_size);
+						buffer_fill_start_ns = trace::begin();
 
 						buffer_user_write_head = buffer;
 				} else {
@@ -393,21 +770,56 @@ namespace asyncio {
 						input_ptr = new_input_ptr;
 						input_size -= free_space;
 
-						while (buffer_flush_pending) { }
+						trace::end("fill output buffer", buffer_fill_start_ns);
+						spin_while([this]() { return buffer_flush_pending; }, producer_wait_seconds, "wait on buffer_flush_pending", progress::thread_t::FORMATTER, progress::state_t::WAITING_FOR_OUTPUT, &producer_handoff);
 
 						if (finalize_flusher_thread) { return false; }
 
 						buffer_flush_pending = true;
 						full_buffer = buffer_position_t::left;
+						on_handover();
+						USDT_PROBE2(asyncio, output_buffer_swap, (bool)full_buffer, buffer_size);
+						buffer_fill_start_ns = trace::begin();
 
 						buffer_user_write_head = buffer + buffer_size;
 				}
 			}
 		}
 
-		static bool flush() noexcept {
+		// Reserve/commit API:
+		// reserve() returns a pointer that at least max_bytes can be written to, commit() then appends the first amount of those bytes to the stream.
+		// Usually the pointer points straight into the current stream buffer, so formatting into it is the only copy the data ever goes through
+		// (like in the vmsplice engines), instead of a write() call and a copy for every token.
+		// When the current buffer doesn't have max_bytes left, the pointer points into a spill buffer instead, and commit() write()s
+		// it into the stream, which takes care of the swap.
+		// NOTE: max_bytes can't be more than max_reserve_size. Only one reservation can be open at a time.
+		static constexpr size_t max_reserve_size = sizeof(reserve_spill_buffer);
+
+		char* reserve(size_t max_bytes) noexcept {
+			const size_t free_space = buffer + buffer_size + (bool)full_buffer * buffer_size - buffer_user_write_head;
+			// NOTE: Has to be strictly less, because write() swaps as soon as a buffer is completely full, and a full buffer left behind by commit() would never get flushed.
+			if (max_bytes < free_space) { return (char*)buffer_user_write_head; }
+			reservation_is_spill = true;
+			return reserve_spill_buffer;
+		}
+
+		bool commit(size_t amount) noexcept {
+			if (reservation_is_spill) {
+				reservation_is_spill = false;
+				return write(reserve_spill_buffer, amount);
+			}
+			// NOTE: The bytes were written through a non-volatile pointer. This keeps the compiler from moving those writes past
+			// the volatile accesses of the next swap, which hands the buffer to the flusher thread.
+			std::atomic_signal_fence(std::memory_order_seq_cst);
+			buffer_user_write_head += amount;
+			return true;
+		}
+
+		bool flush() noexcept {
+			trace::end("fill output buffer", buffer_fill_start_ns);
+
 			// Wait for other buffer to finish flushing.
-			while (buffer_flush_pending) { }
+			spin_while([this]() { return buffer_flush_pending; }, producer_wait_seconds, "wait on buffer_flush_pending", progress::thread_t::FORMATTER, progress::state_t::WAITING_FOR_OUTPUT, &producer_handoff);
 
 			// If error occurred, report it.
 			if (finalize_flusher_thread) { return false; }
@@ -418,9 +830,11 @@ namespace asyncio {
 			// Start flush.
 			buffer_flush_pending = true;
 			full_buffer = !full_buffer;
+			on_handover();
+			USDT_PROBE2(asyncio, output_buffer_swap, (bool)full_buffer, flush_size);
 
 			// Wait for it to finish.
-			while (buffer_flush_pending) { }
+			spin_while([this]() { return buffer_flush_pending; }, producer_wait_seconds, "wait on buffer_flush_pending", progress::thread_t::FORMATTER, progress::state_t::WAITING_FOR_OUTPUT, &producer_handoff);
 
 			// Reset flush_size to default.
 			flush_size = buffer_size;
@@ -431,18 +845,138 @@ namespace asyncio {
 			// NOTE: We could replace the above branchless version with a branch over the whole function body, but we're optimizing for sparse flushing,
 			// which makes this our best option.
 
+			buffer_fill_start_ns = trace::begin();
+
 			return true;
 		}
 
 		// NOTE: Calling this function more than once is UNDEFINED as per my standard for this header.
-		static bool dispose() noexcept {
-			if (!flush()) { return false; }
+		// NOTE: The flusher thread is joined even if the last flush fails, a stream that's been disposed never has a thread left behind.
+		bool dispose() noexcept {
+			if (!flusher_thread.joinable() && !io_thread_attached) { return true; }
+			const bool flushed = flush();
 			// NOTE: This may look wrong, but I assure you it is not.
 			finalize_flusher_thread = true;
 			full_buffer = !full_buffer;
-			flusher_thread.join();
+			on_handover();
+			if (flusher_thread.joinable()) { flusher_thread.join(); }
+			return flushed;
+		}
+	};
+
+#ifndef PLATFORM_WINDOWS
+
+	// One thread that does the reading for an input_stream and the flushing for an output_stream, instead of a reader and a flusher thread that both spin.
+	// When neither stream has anything to do, it sleeps in epoll_wait until an fd becomes ready or the formatter hands over a buffer
+	// (the streams ping an eventfd on every handover), so on a busy machine it costs next to nothing while it waits.
+	// The buffer handover itself is the same single-producer/single-consumer flag protocol the stream threads use.
+	// NOTE: Regular files can't be put into an epoll set (EPERM), they just count as always ready, which they are.
+	// NOTE: Both streams have to be initialize()d with own_thread == false before start(), and disposed before dispose().
+	// Either one can be nullptr, for programs that only read or only write through a stream.
+	class io_thread {
+		std::thread thread;
+		int epoll_fd = -1;
+		int wakeup_fd = -1;
+
+		input_stream* input = nullptr;
+		output_stream* output = nullptr;
+		bool input_pollable = false;
+		bool output_pollable = false;
+
+		// NOTE: EPOLLONESHOT, so that an fd we aren't waiting on (like a readable stdin while both buffers are full) doesn't keep waking us up.
+		void arm(int fd, uint32_t events) noexcept {
+			epoll_event event { };
+			event.events = events | EPOLLONESHOT;
+			event.data.fd = fd;
+			epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+		}
+
+		// NOTE: Returns false if fd can't be polled, which means it's always ready.
+		bool add_disarmed(int fd) noexcept {
+			epoll_event event { };
+			event.events = EPOLLONESHOT;
+			event.data.fd = fd;
+			return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+		}
+
+		void loop() noexcept {
+			bool output_writable = !output_pollable;
+			while (true) {
+				const io_step_result_t input_result = input != nullptr ? input->io_step() : io_step_result_t::DONE;
+				const io_step_result_t output_result = output != nullptr ? output->io_step(output_writable) : io_step_result_t::DONE;
+				if (output_result == io_step_result_t::PROGRESS) { output_writable = !output_pollable; }
+
+				if (input_result == io_step_result_t::DONE && output_result == io_step_result_t::DONE) { return; }
+				if (input_result == io_step_result_t::PROGRESS || output_result == io_step_result_t::PROGRESS) { continue; }
+
+				if (input_result == io_step_result_t::WOULD_BLOCK) {
+					// NOTE: Can't happen with a regular file, but if some fd we couldn't add ever does this, we just keep trying.
+					if (!input_pollable) { continue; }
+					arm(input->fd, EPOLLIN);
+				}
+				if (output_result == io_step_result_t::WOULD_BLOCK) { arm(output->fd, EPOLLOUT); }
+
+				epoll_event events[3];
+				const int event_count = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(epoll_event), -1);
+				// NOTE: On error (which really only means EINTR), we just go around again, the streams will tell us what they're waiting for.
+				for (int i = 0; i < event_count; i++) {
+					if (events[i].data.fd == wakeup_fd) {
+						eventfd_t value;
+						eventfd_read(wakeup_fd, &value);
+						continue;
+					}
+					if (output_pollable && events[i].data.fd == output->fd && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) != 0) { output_writable = true; }
+				}
+			}
+		}
+
+		void thread_code() noexcept {
+			if (stream_thread_start_hook != nullptr) { stream_thread_start_hook(stream_thread_t::IO); }
+			progress::set_state(progress::thread_t::READER, progress::state_t::WORKING);
+			progress::set_state(progress::thread_t::FLUSHER, progress::state_t::WORKING);
+			loop();
+			progress::set_state(progress::thread_t::READER, progress::state_t::NOT_RUNNING);
+			progress::set_state(progress::thread_t::FLUSHER, progress::state_t::NOT_RUNNING);
+			if (stream_thread_exit_hook != nullptr) { stream_thread_exit_hook(stream_thread_t::IO); }
+		}
+
+	public:
+		bool start(input_stream* input_stream_param, output_stream* output_stream_param) noexcept {
+			input = input_stream_param;
+			output = output_stream_param;
+
+			epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+			if (epoll_fd == -1) { return false; }
+			wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if (wakeup_fd == -1) { return false; }
+			epoll_event event { };
+			event.events = EPOLLIN;
+			event.data.fd = wakeup_fd;
+			if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &event) == -1) { return false; }
+
+			if (input != nullptr) {
+				input_pollable = add_disarmed(input->fd);
+				input->wakeup_fd = wakeup_fd;
+			}
+			if (output != nullptr) {
+				output_pollable = add_disarmed(output->fd);
+				output->wakeup_fd = wakeup_fd;
+			}
+			thread = std::thread(&io_thread::thread_code, this);
 			return true;
 		}
+
+		// NOTE: Like with the streams, the instrumentation in the streams is only safe to look at after this.
+		bool dispose() noexcept {
+			if (thread.joinable()) { thread.join(); }
+			if (input != nullptr && input->wakeup_fd != -1) { input->restore_fd_flags(); }
+			bool result = true;
+			if (wakeup_fd != -1) { result &= close(wakeup_fd) == 0; }
+			if (epoll_fd != -1) { result &= close(epoll_fd) == 0; }
+			return result;
+		}
 	};
 
+#endif
+
 }
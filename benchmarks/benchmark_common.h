@@ -0,0 +1,116 @@
+#pragma once
+
+// Bits and pieces that all the benchmark programs share.
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#include <algorithm>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define REPORT_ERROR_AND_EXIT(message) do { std::fputs("ERROR: " message "\n", stderr); std::exit(EXIT_FAILURE); } while (false)
+
+inline double get_monotonic_seconds() noexcept {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1000000000.0;
+}
+
+inline bool find_in_path(const char* name) noexcept {
+	const char* path = std::getenv("PATH");
+	if (path == nullptr) { return false; }
+	char candidate[4096];
+	while (*path != '\0') {
+		const char* end = std::strchr(path, ':');
+		if (end == nullptr) { end = path + std::strlen(path); }
+		if (std::snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)(end - path), path, name) < (int)sizeof(candidate)) {
+			if (access(candidate, X_OK) == 0) { return true; }
+		}
+		if (*end == '\0') { break; }
+		path = end + 1;
+	}
+	return false;
+}
+
+inline long long get_file_size(const char* path) noexcept {
+	struct stat status;
+	if (stat(path, &status) == -1) { return -1; }
+	return status.st_size;
+}
+
+// NOTE: -1 for either fd means the child inherits ours.
+// The child closes every fd above stderr, so that it doesn't keep any of our pipe ends alive (which would stop EOF from arriving).
+inline pid_t spawn_process(const char* const* argv, int stdinFd, int stdoutFd) noexcept {
+	const pid_t pid = fork();
+	if (pid != 0) { return pid; }
+
+	if (stdinFd != -1 && dup2(stdinFd, STDIN_FILENO) == -1) { _exit(127); }
+	if (stdoutFd != -1 && dup2(stdoutFd, STDOUT_FILENO) == -1) { _exit(127); }
+	for (int fd = STDERR_FILENO + 1; fd < 1024; fd++) { close(fd); }
+
+	execvp(argv[0], (char* const*)argv);
+	_exit(127);
+}
+
+inline void print_json_string(const char* string) noexcept {
+	std::putchar('"');
+	for (; *string != '\0'; string++) {
+		if (*string == '"' || *string == '\\') { std::putchar('\\'); }
+		std::putchar(*string);
+	}
+	std::putchar('"');
+}
+
+// Input generation:
+
+enum class entropy_profile_t { ZEROS, TEXT, RANDOM };
+
+inline const char* const entropy_profile_names[] = { "zeros", "text", "random" };
+
+// NOTE: offset is the position of buffer within the whole input, randomState carries the generator state over from the previous call.
+inline void generate_input_data(unsigned char* buffer, size_t size, entropy_profile_t profile, size_t offset, uint64_t& randomState) noexcept {
+	static const char text[] = "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua.\n";
+
+	for (size_t i = 0; i < size; i++) {
+		switch (profile) {
+		case entropy_profile_t::ZEROS: buffer[i] = 0; break;
+		case entropy_profile_t::TEXT: buffer[i] = text[(offset + i) % (sizeof(text) - 1)]; break;
+		case entropy_profile_t::RANDOM:
+			// xorshift64, good enough to defeat any compression-like effects in the compilers and branch predictors
+			randomState ^= randomState << 13;
+			randomState ^= randomState >> 7;
+			randomState ^= randomState << 17;
+			buffer[i] = randomState >> 56;
+			break;
+		}
+	}
+}
+
+inline constexpr uint64_t input_random_seed = 0x9E3779B97F4A7C15;
+
+inline void generate_input(const char* path, entropy_profile_t profile, size_t size) noexcept {
+	FILE* file = std::fopen(path, "wb");
+	if (file == nullptr) { REPORT_ERROR_AND_EXIT("failed to create input file"); }
+
+	uint64_t randomState = input_random_seed;
+
+	unsigned char buffer[65536];
+	for (size_t written = 0; written < size;) {
+		const size_t amount = std::min(sizeof(buffer), size - written);
+		generate_input_data(buffer, amount, profile, written, randomState);
+		if (std::fwrite(buffer, 1, amount, file) != amount) { REPORT_ERROR_AND_EXIT("failed to write input file"); }
+		written += amount;
+	}
+
+	if (std::fclose(file) == EOF) { REPORT_ERROR_AND_EXIT("failed to write input file"); }
+}
+
+inline void ensure_input(const char* path, entropy_profile_t profile, size_t size) noexcept {
+	if (get_file_size(path) != (long long)size) { generate_input(path, profile, size); }
+}
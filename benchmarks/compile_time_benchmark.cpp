@@ -0,0 +1,372 @@
+// Downstream compile-time benchmark:
+// What we really pay for when embedding a file is srcembed time plus compiler time, so this measures both.
+// It generates inputs of several sizes and entropy profiles, converts them into every output format we care about and runs each
+// result through the locally available C++ compilers.
+// Output is one JSON object per measurement (JSON lines) on stdout, progress and warnings go to stderr.
+
+// NOTE: srcembed itself only outputs decimal lists at the moment, the other formats are generated by this program so that
+// we have numbers to compare against when deciding which formats are worth adding.
+
+#include <cerrno>
+
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "benchmark_common.h"
+
+namespace flags {
+	const char* srcembed_path = "bin/srcembed";
+	const char* work_dir = nullptr;
+	size_t sizes[16] = { 64 * 1024, 1024 * 1024, 16 * 1024 * 1024 };
+	size_t sizes_count = 3;
+	unsigned int repetitions = 1;
+	size_t split_count = 0;
+}
+
+const char helpText[] = "usage: compile_time_benchmark [--srcembed <path>] [--work-dir <dir>] [--sizes <bytes,bytes,...>] [--repetitions <count>] [--split <part count>]\n" \
+			"\n" \
+			"function: measures generation time, compile wall time, peak compiler RSS and object size for every output format\n" \
+			"\n" \
+			"arguments:\n" \
+				"\t[--srcembed <path>]            --> srcembed binary to benchmark (default: bin/srcembed)\n" \
+				"\t[--work-dir <dir>]             --> directory for the generated files (default: a fresh directory in /tmp)\n" \
+				"\t[--sizes <bytes,bytes,...>]    --> input sizes (default: 65536,1048576,16777216)\n" \
+				"\t[--repetitions <count>]        --> compiles per measurement, the median is reported (default: 1)\n" \
+				"\t[--split <part count>]         --> part count for the split mode (default: amount of cores)\n" \
+			"\n" \
+			"output: one JSON object per line on stdout\n";
+
+struct process_result_t {
+	bool success;
+	double wall_seconds;
+	long peak_rss_kib;
+};
+
+// NOTE: All the given processes are started at the same time and waited for together, which is how a build system would
+// treat separately compilable parts. The peak RSS is the biggest of the individual peaks.
+process_result_t run_processes(const char* const* const* argvs, size_t count, const char* const* stdinPaths, const char* const* stdoutPaths) noexcept {
+	process_result_t result { true, 0, 0 };
+
+	pid_t pids[256];
+	if (count > sizeof(pids) / sizeof(pid_t)) { REPORT_ERROR_AND_EXIT("too many processes to run at once"); }
+
+	const double startTime = get_monotonic_seconds();
+	for (size_t i = 0; i < count; i++) {
+		const int stdinFd = stdinPaths && stdinPaths[i] ? open(stdinPaths[i], O_RDONLY) : -1;
+		const int stdoutFd = stdoutPaths && stdoutPaths[i] ? open(stdoutPaths[i], O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+		if ((stdinPaths && stdinPaths[i] && stdinFd == -1) || (stdoutPaths && stdoutPaths[i] && stdoutFd == -1)) { REPORT_ERROR_AND_EXIT("failed to open process stdin/stdout"); }
+		pids[i] = spawn_process(argvs[i], stdinFd, stdoutFd);
+		if (pids[i] == -1) { REPORT_ERROR_AND_EXIT("failed to spawn process: fork failed"); }
+		if (stdinFd != -1) { close(stdinFd); }
+		if (stdoutFd != -1) { close(stdoutFd); }
+	}
+	for (size_t i = 0; i < count; i++) {
+		int status;
+		struct rusage usage;
+		if (wait4(pids[i], &status, 0, &usage) == -1) { REPORT_ERROR_AND_EXIT("failed to wait for process: wait4 failed"); }
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) { result.success = false; }
+		result.peak_rss_kib = std::max(result.peak_rss_kib, usage.ru_maxrss);
+	}
+	result.wall_seconds = get_monotonic_seconds() - startTime;
+
+	return result;
+}
+
+process_result_t run_process(const char* const* argv, const char* stdinPath, const char* stdoutPath) noexcept {
+	return run_processes(&argv, 1, &stdinPath, &stdoutPath);
+}
+
+// Reference formats (the ones srcembed doesn't output (yet)):
+
+enum class reference_format_t { HEX_LIST, STRING_LITERAL, WIDE_WORDS, ASM_INCBIN, EMBED };
+
+bool generate_reference_format(reference_format_t format, const char* inputPath, const char* outputPath) noexcept {
+	FILE* input = std::fopen(inputPath, "rb");
+	if (input == nullptr) { return false; }
+	FILE* output = std::fopen(outputPath, "wb");
+	if (output == nullptr) { std::fclose(input); return false; }
+
+	const long long inputSize = get_file_size(inputPath);
+
+	switch (format) {
+	case reference_format_t::HEX_LIST:
+		{
+			std::fputs("extern const unsigned char data[] {", output);
+			int byte;
+			for (long long i = 0; (byte = std::fgetc(input)) != EOF; i++) {
+				std::fprintf(output, i == 0 ? " 0x%02x" : ", 0x%02x", byte);
+			}
+			std::fputs(" };\n", output);
+			break;
+		}
+	case reference_format_t::STRING_LITERAL:
+		// NOTE: Split into lines because some compilers get unhappy with gigantic single lines.
+		// Adjacent literals are concatenated by the compiler, the final NUL is cut off by the explicit size.
+		{
+			std::fprintf(output, "extern const char data[%lld] =\n\"", inputSize + 1);
+			int byte;
+			for (long long i = 0; (byte = std::fgetc(input)) != EOF; i++) {
+				if (i != 0 && i % 64 == 0) { std::fputs("\"\n\"", output); }
+				std::fprintf(output, "\\x%02x", byte);
+			}
+			std::fputs("\";\n", output);
+			break;
+		}
+	case reference_format_t::WIDE_WORDS:
+		{
+			std::fputs("#include <cstdint>\nextern const std::uint64_t data[] {", output);
+			unsigned char word[8];
+			size_t amount;
+			for (long long i = 0; (amount = std::fread(word, 1, sizeof(word), input)) != 0; i++) {
+				uint64_t value = 0;
+				for (size_t j = 0; j < amount; j++) { value |= (uint64_t)word[j] << (j * 8); }
+				std::fprintf(output, i == 0 ? " 0x%llxu" : ", 0x%llxu", (unsigned long long)value);
+			}
+			std::fprintf(output, " };\nextern const std::size_t data_size = %lld;\n", inputSize);
+			break;
+		}
+	case reference_format_t::ASM_INCBIN:
+		std::fprintf(output, "extern \"C\" const unsigned char data[];\n__asm__(\".section .rodata\\n.global data\\n.balign 64\\ndata:\\n.incbin \\\"%s\\\"\\n.previous\\n\");\n", inputPath);
+		break;
+	case reference_format_t::EMBED:
+		std::fprintf(output, "extern const unsigned char data[] {\n#embed \"%s\"\n};\n", inputPath);
+		break;
+	}
+
+	std::fclose(input);
+	return std::fclose(output) != EOF;
+}
+
+bool compiler_supports_embed(const char* compiler, const char* workDir) noexcept {
+	char sourcePath[4096];
+	char objectPath[4096];
+	char inputPath[4096];
+	std::snprintf(sourcePath, sizeof(sourcePath), "%s/embed_probe.cpp", workDir);
+	std::snprintf(objectPath, sizeof(objectPath), "%s/embed_probe.o", workDir);
+	std::snprintf(inputPath, sizeof(inputPath), "%s/embed_probe.bin", workDir);
+	generate_input(inputPath, entropy_profile_t::TEXT, 16);
+	if (!generate_reference_format(reference_format_t::EMBED, inputPath, sourcePath)) { return false; }
+	const char* const argv[] = { compiler, "-std=c++20", "-w", "-c", sourcePath, "-o", objectPath, nullptr };
+	const char* const devNull = "/dev/null";
+	const char* const* argvs[] = { argv };
+	return run_processes(argvs, 1, &devNull, &devNull).success;
+}
+
+// Measurement:
+
+enum class generator_t { SRCEMBED, SRCEMBED_SPLIT, XXD, REFERENCE };
+
+struct output_mode_t {
+	const char* name;
+	generator_t generator;
+	reference_format_t reference_format;		// NOTE: Only used for generator_t::REFERENCE.
+};
+
+const output_mode_t output_modes[] = {
+	{ "decimal_list", generator_t::SRCEMBED, { } },
+	{ "decimal_list_split", generator_t::SRCEMBED_SPLIT, { } },
+	{ "xxd_hex_list", generator_t::XXD, { } },
+	{ "hex_list", generator_t::REFERENCE, reference_format_t::HEX_LIST },
+	{ "string_literal", generator_t::REFERENCE, reference_format_t::STRING_LITERAL },
+	{ "wide_words", generator_t::REFERENCE, reference_format_t::WIDE_WORDS },
+	{ "asm_incbin", generator_t::REFERENCE, reference_format_t::ASM_INCBIN },
+	{ "embed", generator_t::REFERENCE, reference_format_t::EMBED }
+};
+
+void measure(const char* compiler, bool embedSupported, const output_mode_t& mode, const char* inputPath, entropy_profile_t profile, size_t size, unsigned int splitCount) noexcept {
+	char sourcePaths[256][4096];
+	char objectPaths[256][4096];
+	size_t sourceCount = 1;
+
+	std::snprintf(sourcePaths[0], sizeof(sourcePaths[0]), "%s/generated.cpp", flags::work_dir);
+
+	const char* status = "ok";
+	double generationSeconds = 0;
+	process_result_t compileResult { false, 0, 0 };
+	long long objectBytes = 0;
+
+	switch (mode.generator) {
+	case generator_t::REFERENCE:
+		{
+			if (mode.reference_format == reference_format_t::EMBED && !embedSupported) { status = "unsupported"; goto report; }
+			const double startTime = get_monotonic_seconds();
+			if (!generate_reference_format(mode.reference_format, inputPath, sourcePaths[0])) { status = "generation_failed"; goto report; }
+			generationSeconds = get_monotonic_seconds() - startTime;
+			break;
+		}
+	case generator_t::XXD:
+		{
+			if (!find_in_path("xxd")) { status = "unsupported"; goto report; }
+			// NOTE: xxd reading from stdin outputs the bare list, the declaration around it comes from us.
+			char listPath[4096];
+			std::snprintf(listPath, sizeof(listPath), "%s/xxd_output.inc", flags::work_dir);
+			const char* const argv[] = { "xxd", "-i", nullptr };
+			process_result_t result = run_process(argv, inputPath, listPath);
+			if (!result.success) { status = "generation_failed"; goto report; }
+			generationSeconds = result.wall_seconds;
+
+			FILE* source = std::fopen(sourcePaths[0], "wb");
+			if (source == nullptr) { status = "generation_failed"; goto report; }
+			std::fprintf(source, "extern const unsigned char data[] = {\n#include \"%s\"\n};\n", listPath);
+			if (std::fclose(source) == EOF) { status = "generation_failed"; goto report; }
+			break;
+		}
+	case generator_t::SRCEMBED:
+		{
+			const char* const argv[] = { flags::srcembed_path, "c++", nullptr };
+			process_result_t result = run_process(argv, inputPath, sourcePaths[0]);
+			if (!result.success) { status = "generation_failed"; goto report; }
+			generationSeconds = result.wall_seconds;
+			break;
+		}
+	case generator_t::SRCEMBED_SPLIT:
+		{
+			// NOTE: srcembed writes the parts into its working directory, so we run it from inside the work dir.
+			// Leftover parts from a previous measurement would get picked up below, so those go first.
+			for (size_t i = 0; i < 256; i++) {
+				std::snprintf(sourcePaths[i], sizeof(sourcePaths[i]), "%s/data_part_%zu.cpp", flags::work_dir, i);
+				unlink(sourcePaths[i]);
+			}
+
+			char splitCountText[32];
+			std::snprintf(splitCountText, sizeof(splitCountText), "%u", splitCount);
+			const char* const argv[] = { flags::srcembed_path, "--split", splitCountText, "c++", nullptr };
+			char headerPath[4096];
+			std::snprintf(headerPath, sizeof(headerPath), "%s/data.h", flags::work_dir);
+
+			char originalDir[4096];
+			if (getcwd(originalDir, sizeof(originalDir)) == nullptr || chdir(flags::work_dir) == -1) { REPORT_ERROR_AND_EXIT("failed to enter work dir"); }
+			process_result_t result = run_process(argv, inputPath, headerPath);
+			if (chdir(originalDir) == -1) { REPORT_ERROR_AND_EXIT("failed to leave work dir"); }
+			if (!result.success) { status = "generation_failed"; goto report; }
+			generationSeconds = result.wall_seconds;
+
+			for (sourceCount = 0; sourceCount < 256 && access(sourcePaths[sourceCount], F_OK) == 0; sourceCount++) { }
+			break;
+		}
+	}
+
+	if (mode.generator != generator_t::SRCEMBED_SPLIT) {
+		// NOTE: Some of the formats declare the array with internal linkage (srcembed's own output included), which
+		// would let the compiler throw the whole thing away. The wrapper makes sure the data ends up in the object file.
+		char wrapperPath[4096];
+		std::snprintf(wrapperPath, sizeof(wrapperPath), "%s/wrapper.cpp", flags::work_dir);
+		FILE* wrapper = std::fopen(wrapperPath, "wb");
+		if (wrapper == nullptr) { REPORT_ERROR_AND_EXIT("failed to create wrapper source file"); }
+		std::fprintf(wrapper, "#include \"%s\"\nextern const void* const srcembed_benchmark_keep = data;\n", sourcePaths[0]);
+		if (std::fclose(wrapper) == EOF) { REPORT_ERROR_AND_EXIT("failed to create wrapper source file"); }
+		std::strcpy(sourcePaths[0], wrapperPath);
+	}
+
+	{
+		// NOTE: srcembed outputs plain chars, so values over 127 are narrowing conversions in brace initialization.
+		// g++ and clang++ have different names for the switch that downgrades those errors.
+		const bool isClang = std::strstr(compiler, "clang") != nullptr;
+		const char* argvStorage[256][10];
+		const char* const* argvs[256];
+		for (size_t i = 0; i < sourceCount; i++) {
+			std::snprintf(objectPaths[i], sizeof(objectPaths[i]), "%s/generated_%zu.o", flags::work_dir, i);
+			const char* argv[] = { compiler, "-std=c++20", "-O2", "-w", isClang ? "-Wno-c++11-narrowing" : "-Wno-narrowing", "-c", sourcePaths[i], "-o", objectPaths[i], nullptr };
+			std::copy(argv, argv + sizeof(argv) / sizeof(const char*), argvStorage[i]);
+			argvs[i] = argvStorage[i];
+		}
+
+		double wallTimes[64];
+		const unsigned int repetitions = std::min(flags::repetitions, 64u);
+		for (unsigned int i = 0; i < repetitions; i++) {
+			process_result_t result = run_processes(argvs, sourceCount, nullptr, nullptr);
+			if (!result.success) { status = "compile_failed"; goto report; }
+			wallTimes[i] = result.wall_seconds;
+			compileResult.peak_rss_kib = std::max(compileResult.peak_rss_kib, result.peak_rss_kib);
+		}
+		std::sort(wallTimes, wallTimes + repetitions);
+		compileResult.wall_seconds = wallTimes[repetitions / 2];
+		compileResult.success = true;
+
+		for (size_t i = 0; i < sourceCount; i++) { objectBytes += get_file_size(objectPaths[i]); }
+	}
+
+report:
+	std::printf("{\"compiler\":");
+	print_json_string(compiler);
+	std::printf(",\"mode\":\"%s\",\"input\":\"%s\",\"input_bytes\":%zu,\"status\":\"%s\"", mode.name, entropy_profile_names[(int)profile], size, status);
+	if (compileResult.success) {
+		std::printf(",\"source_files\":%zu,\"generation_seconds\":%.6f,\"compile_wall_seconds\":%.6f,\"compiler_peak_rss_kib\":%ld,\"object_bytes\":%lld",
+			    sourceCount, generationSeconds, compileResult.wall_seconds, compileResult.peak_rss_kib, objectBytes);
+	}
+	std::printf("}\n");
+	std::fflush(stdout);
+}
+
+void manage_args(int argc, const char* const* argv) noexcept {
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--help") == 0) { std::fputs(helpText, stdout); std::exit(EXIT_SUCCESS); }
+		if (i + 1 == argc) { REPORT_ERROR_AND_EXIT("invalid args, use --help for usage"); }
+		if (std::strcmp(argv[i], "--srcembed") == 0) { flags::srcembed_path = argv[++i]; continue; }
+		if (std::strcmp(argv[i], "--work-dir") == 0) { flags::work_dir = argv[++i]; continue; }
+		if (std::strcmp(argv[i], "--repetitions") == 0) {
+			flags::repetitions = std::atoi(argv[++i]);
+			if (flags::repetitions == 0) { REPORT_ERROR_AND_EXIT("\"--repetitions\" requires a positive integer"); }
+			continue;
+		}
+		if (std::strcmp(argv[i], "--split") == 0) {
+			flags::split_count = std::atoi(argv[++i]);
+			if (flags::split_count == 0 || flags::split_count > 256) { REPORT_ERROR_AND_EXIT("\"--split\" requires an integer between 1 and 256"); }
+			continue;
+		}
+		if (std::strcmp(argv[i], "--sizes") == 0) {
+			flags::sizes_count = 0;
+			for (const char* size = argv[++i]; *size != '\0';) {
+				if (flags::sizes_count == sizeof(flags::sizes) / sizeof(size_t)) { REPORT_ERROR_AND_EXIT("too many sizes"); }
+				char* end;
+				flags::sizes[flags::sizes_count++] = std::strtoull(size, &end, 10);
+				if (end == size || flags::sizes[flags::sizes_count - 1] == 0) { REPORT_ERROR_AND_EXIT("\"--sizes\" requires a comma-separated list of positive integers"); }
+				size = *end == ',' ? end + 1 : end;
+			}
+			continue;
+		}
+		REPORT_ERROR_AND_EXIT("invalid args, use --help for usage");
+	}
+}
+
+int main(int argc, const char* const* argv) noexcept {
+	manage_args(argc, argv);
+
+	// NOTE: srcembed gets run from inside the work dir (see above), so the path has to be absolute.
+	static char srcembedPath[4096];
+	if (realpath(flags::srcembed_path, srcembedPath) == nullptr || access(srcembedPath, X_OK) == -1) { REPORT_ERROR_AND_EXIT("srcembed binary not found, build it first or pass \"--srcembed\""); }
+	flags::srcembed_path = srcembedPath;
+
+	static char workDir[] = "/tmp/srcembed_compile_benchmark_XXXXXX";
+	if (flags::work_dir == nullptr) {
+		if (mkdtemp(workDir) == nullptr) { REPORT_ERROR_AND_EXIT("failed to create work dir: mkdtemp failed"); }
+		flags::work_dir = workDir;
+	} else if (mkdir(flags::work_dir, 0755) == -1 && errno != EEXIST) {
+		REPORT_ERROR_AND_EXIT("failed to create work dir: mkdir failed");
+	}
+
+	const long coreCount = sysconf(_SC_NPROCESSORS_ONLN);
+	const unsigned int splitCount = flags::split_count != 0 ? flags::split_count : std::clamp(coreCount, 2L, 256L);
+
+	const char* const candidateCompilers[] = { "g++", "clang++" };
+	bool anyCompilerFound = false;
+	for (const char* compiler : candidateCompilers) {
+		if (!find_in_path(compiler)) { continue; }
+		anyCompilerFound = true;
+		const bool embedSupported = compiler_supports_embed(compiler, flags::work_dir);
+
+		for (size_t sizeIndex = 0; sizeIndex < flags::sizes_count; sizeIndex++) {
+			for (int profile = 0; profile < 3; profile++) {
+				char inputPath[4096];
+				std::snprintf(inputPath, sizeof(inputPath), "%s/input_%s_%zu.bin", flags::work_dir, entropy_profile_names[profile], flags::sizes[sizeIndex]);
+				ensure_input(inputPath, (entropy_profile_t)profile, flags::sizes[sizeIndex]);
+
+				for (const output_mode_t& mode : output_modes) {
+					std::fprintf(stderr, "%s: %s, %s, %zu bytes\n", compiler, mode.name, entropy_profile_names[profile], flags::sizes[sizeIndex]);
+					measure(compiler, embedSupported, mode, inputPath, (entropy_profile_t)profile, flags::sizes[sizeIndex], splitCount);
+				}
+			}
+		}
+	}
+	if (!anyCompilerFound) { REPORT_ERROR_AND_EXIT("neither g++ nor clang++ found in PATH"); }
+}
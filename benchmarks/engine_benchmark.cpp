@@ -0,0 +1,325 @@
+// Engine benchmark:
+// Runs srcembed with every engine forced (through "--engine") against synthetic inputs and the different kinds of sinks,
+// so that we can see what each data transfer path actually costs, instead of only ever measuring whatever auto picks.
+// xxd -i is measured alongside as a point of reference when it's available.
+// Output is one JSON object per measurement (JSON lines) on stdout, progress goes to stderr.
+
+// NOTE: The output of every srcembed run is hashed and compared against the output of the read_write engine,
+// so that a fast but broken engine doesn't go unnoticed.
+
+#include <sys/wait.h>
+#include <signal.h>
+
+#include "benchmark_common.h"
+
+namespace flags {
+	const char* srcembed_path = "bin/srcembed";
+	const char* work_dir = nullptr;
+	size_t size = 64 * 1024 * 1024;
+	unsigned int warmup = 2;
+	unsigned int repetitions = 10;
+}
+
+const char helpText[] = "usage: engine_benchmark [--srcembed <path>] [--work-dir <dir>] [--size <bytes>] [--warmup <count>] [--repetitions <count>]\n" \
+			"\n" \
+			"function: measures every srcembed engine (and xxd -i) for every input profile, stdin kind and sink kind\n" \
+			"\n" \
+			"arguments:\n" \
+				"\t[--srcembed <path>]       --> srcembed binary to benchmark (default: bin/srcembed)\n" \
+				"\t[--work-dir <dir>]        --> directory for the generated files (default: a fresh directory in /tmp)\n" \
+				"\t[--size <bytes>]          --> input size (default: 67108864)\n" \
+				"\t[--warmup <count>]        --> unmeasured runs before every measurement (default: 2)\n" \
+				"\t[--repetitions <count>]   --> measured runs per measurement (default: 10)\n" \
+			"\n" \
+			"output: one JSON object per line on stdout\n";
+
+enum class stdin_kind_t { FILE, PIPE };
+const char* const stdin_kind_names[] = { "file", "pipe" };
+
+enum class sink_kind_t { PIPE, FILE, DEV_NULL };
+const char* const sink_kind_names[] = { "pipe", "file", "dev_null" };
+
+struct engine_t {
+	const char* name;
+	bool requires_stdin_file;
+	bool requires_stdout_pipe;
+	// NOTE: 0 means no limit.
+	size_t max_input_size;
+};
+
+const engine_t engines[] = {
+	{ "auto", false, false, 0 },
+	{ "small_input", true, false, 65536 },
+	{ "mmap_vmsplice", true, true, 0 },
+	{ "mmap_write", true, false, 0 },
+	{ "read_vmsplice", false, true, 0 },
+	{ "read_write", false, false, 0 }
+};
+
+// NOTE: Not a cryptographic hash, just something fast that mixes whole words so that the drain doesn't become the bottleneck.
+struct output_hash_t {
+	uint64_t state = 0xCBF29CE484222325;
+	uint64_t length = 0;
+	unsigned char pending[8];
+	size_t pending_size = 0;
+
+	void update(const unsigned char* data, size_t size) noexcept {
+		length += size;
+		while (size != 0) {
+			const size_t amount = std::min(size, sizeof(pending) - pending_size);
+			std::memcpy(pending + pending_size, data, amount);
+			pending_size += amount;
+			data += amount;
+			size -= amount;
+			if (pending_size == sizeof(pending)) {
+				uint64_t word;
+				std::memcpy(&word, pending, sizeof(word));
+				state = (state ^ word) * 0x100000001B3;
+				state ^= state >> 29;
+				pending_size = 0;
+			}
+		}
+	}
+
+	uint64_t finish() noexcept {
+		uint64_t word = 0;
+		std::memcpy(&word, pending, pending_size);
+		return ((state ^ word) * 0x100000001B3) ^ length;
+	}
+};
+
+bool hash_file(const char* path, uint64_t& result) noexcept {
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) { return false; }
+	output_hash_t hash;
+	static unsigned char buffer[1 << 20];
+	while (true) {
+		const ssize_t bytesRead = read(fd, buffer, sizeof(buffer));
+		if (bytesRead == -1) { close(fd); return false; }
+		if (bytesRead == 0) { break; }
+		hash.update(buffer, bytesRead);
+	}
+	close(fd);
+	result = hash.finish();
+	return true;
+}
+
+// Feeds the input file into a pipe from a separate process, so that srcembed sees a real pipe on stdin.
+pid_t spawn_feeder(const char* inputPath, int pipeWriteFd) noexcept {
+	const pid_t pid = fork();
+	if (pid != 0) { return pid; }
+
+	int fd = open(inputPath, O_RDONLY);
+	if (fd == -1) { _exit(127); }
+	static char buffer[1 << 20];
+	while (true) {
+		const ssize_t bytesRead = read(fd, buffer, sizeof(buffer));
+		if (bytesRead == -1) { _exit(127); }
+		if (bytesRead == 0) { _exit(0); }
+		for (ssize_t written = 0; written < bytesRead;) {
+			const ssize_t result = write(pipeWriteFd, buffer + written, bytesRead - written);
+			if (result == -1) { _exit(127); }
+			written += result;
+		}
+	}
+}
+
+struct run_result_t {
+	bool success;
+	double seconds;
+	bool hashed;
+	uint64_t hash;
+};
+
+run_result_t run_once(const char* const* argv, const char* inputPath, stdin_kind_t stdinKind, sink_kind_t sinkKind) noexcept {
+	run_result_t result { true, 0, false, 0 };
+
+	char outputPath[4096];
+	std::snprintf(outputPath, sizeof(outputPath), "%s/output.txt", flags::work_dir);
+
+	const double startTime = get_monotonic_seconds();
+
+	int stdinFd;
+	int feederPipe[2] = { -1, -1 };
+	pid_t feederPid = -1;
+	if (stdinKind == stdin_kind_t::FILE) {
+		stdinFd = open(inputPath, O_RDONLY);
+		if (stdinFd == -1) { REPORT_ERROR_AND_EXIT("failed to open input file"); }
+	} else {
+		if (pipe(feederPipe) == -1) { REPORT_ERROR_AND_EXIT("failed to create pipe"); }
+		feederPid = spawn_feeder(inputPath, feederPipe[1]);
+		if (feederPid == -1) { REPORT_ERROR_AND_EXIT("failed to spawn feeder: fork failed"); }
+		close(feederPipe[1]);
+		stdinFd = feederPipe[0];
+	}
+
+	int stdoutFd = -1;
+	int drainPipe[2] = { -1, -1 };
+	switch (sinkKind) {
+	case sink_kind_t::PIPE:
+		if (pipe(drainPipe) == -1) { REPORT_ERROR_AND_EXIT("failed to create pipe"); }
+		stdoutFd = drainPipe[1];
+		break;
+	case sink_kind_t::FILE: stdoutFd = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644); break;
+	case sink_kind_t::DEV_NULL: stdoutFd = open("/dev/null", O_WRONLY); break;
+	}
+	if (stdoutFd == -1) { REPORT_ERROR_AND_EXIT("failed to open sink"); }
+
+	const pid_t pid = spawn_process(argv, stdinFd, stdoutFd);
+	if (pid == -1) { REPORT_ERROR_AND_EXIT("failed to spawn process: fork failed"); }
+	close(stdinFd);
+	close(stdoutFd);
+
+	if (sinkKind == sink_kind_t::PIPE) {
+		// The draining reader. It reads as fast as it can, which makes srcembed the bottleneck, which is what we want to measure.
+		output_hash_t hash;
+		static unsigned char buffer[1 << 20];
+		while (true) {
+			const ssize_t bytesRead = read(drainPipe[0], buffer, sizeof(buffer));
+			if (bytesRead == -1) { REPORT_ERROR_AND_EXIT("failed to drain pipe"); }
+			if (bytesRead == 0) { break; }
+			hash.update(buffer, bytesRead);
+		}
+		close(drainPipe[0]);
+		result.hashed = true;
+		result.hash = hash.finish();
+	}
+
+	int status;
+	if (waitpid(pid, &status, 0) == -1) { REPORT_ERROR_AND_EXIT("failed to wait for process: waitpid failed"); }
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) { result.success = false; }
+	if (feederPid != -1) {
+		// NOTE: If srcembed failed, the feeder might be stuck on a full pipe that nobody is ever going to read.
+		if (!result.success) { kill(feederPid, SIGKILL); }
+		waitpid(feederPid, nullptr, 0);
+	}
+
+	result.seconds = get_monotonic_seconds() - startTime;
+
+	if (sinkKind == sink_kind_t::FILE) { result.hashed = hash_file(outputPath, result.hash); }
+
+	return result;
+}
+
+double get_percentile(const double* sortedValues, size_t count, unsigned int percentile) noexcept {
+	// nearest-rank method
+	size_t rank = (percentile * count + 99) / 100;
+	if (rank == 0) { rank = 1; }
+	return sortedValues[rank - 1];
+}
+
+void measure(const char* toolName, const char* engineName, const char* const* argv, const char* inputPath, entropy_profile_t profile,
+	     stdin_kind_t stdinKind, sink_kind_t sinkKind, const uint64_t* referenceHash) noexcept {
+	std::fprintf(stderr, "%s %s: %s input, %s stdin, %s sink\n", toolName, engineName, entropy_profile_names[(int)profile], stdin_kind_names[(int)stdinKind], sink_kind_names[(int)sinkKind]);
+
+	static double times[1024];
+	const unsigned int repetitions = std::min(flags::repetitions, 1024u);
+
+	const char* status = "ok";
+	const char* outputMatches = "null";
+
+	for (unsigned int i = 0; i < flags::warmup; i++) {
+		if (!run_once(argv, inputPath, stdinKind, sinkKind).success) { status = "failed"; goto report; }
+	}
+	for (unsigned int i = 0; i < repetitions; i++) {
+		run_result_t result = run_once(argv, inputPath, stdinKind, sinkKind);
+		if (!result.success) { status = "failed"; goto report; }
+		times[i] = result.seconds;
+		if (referenceHash != nullptr && result.hashed) {
+			if (result.hash != *referenceHash) { outputMatches = "false"; }
+			else if (outputMatches[0] == 'n') { outputMatches = "true"; }
+		}
+	}
+	std::sort(times, times + repetitions);
+
+report:
+	std::printf("{\"tool\":\"%s\",\"engine\":\"%s\",\"input\":\"%s\",\"input_bytes\":%zu,\"stdin\":\"%s\",\"sink\":\"%s\",\"status\":\"%s\"",
+		    toolName, engineName, entropy_profile_names[(int)profile], flags::size, stdin_kind_names[(int)stdinKind], sink_kind_names[(int)sinkKind], status);
+	if (status[0] == 'o') {
+		double sum = 0;
+		for (unsigned int i = 0; i < repetitions; i++) { sum += times[i]; }
+		const double p50 = get_percentile(times, repetitions, 50);
+		std::printf(",\"warmup\":%u,\"repetitions\":%u,\"min_seconds\":%.6f,\"mean_seconds\":%.6f,\"p50_seconds\":%.6f,\"p90_seconds\":%.6f,\"p99_seconds\":%.6f,\"max_seconds\":%.6f,\"p50_throughput_mib_per_second\":%.2f,\"output_matches\":%s",
+			    flags::warmup, repetitions, times[0], sum / repetitions, p50, get_percentile(times, repetitions, 90), get_percentile(times, repetitions, 99), times[repetitions - 1],
+			    flags::size / p50 / (1024 * 1024), outputMatches);
+	}
+	std::printf("}\n");
+	std::fflush(stdout);
+}
+
+bool parse_unsigned_arg(const char* arg, unsigned long long& result) noexcept {
+	char* end;
+	result = std::strtoull(arg, &end, 10);
+	return end != arg && *end == '\0';
+}
+
+void manage_args(int argc, const char* const* argv) noexcept {
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--help") == 0) { std::fputs(helpText, stdout); std::exit(EXIT_SUCCESS); }
+		if (i + 1 == argc) { REPORT_ERROR_AND_EXIT("invalid args, use --help for usage"); }
+		if (std::strcmp(argv[i], "--srcembed") == 0) { flags::srcembed_path = argv[++i]; continue; }
+		if (std::strcmp(argv[i], "--work-dir") == 0) { flags::work_dir = argv[++i]; continue; }
+		unsigned long long value;
+		if (!parse_unsigned_arg(argv[i + 1], value)) { REPORT_ERROR_AND_EXIT("invalid args, use --help for usage"); }
+		if (std::strcmp(argv[i], "--size") == 0 && value != 0) { flags::size = value; i++; continue; }
+		if (std::strcmp(argv[i], "--warmup") == 0) { flags::warmup = value; i++; continue; }
+		if (std::strcmp(argv[i], "--repetitions") == 0 && value != 0) { flags::repetitions = value; i++; continue; }
+		REPORT_ERROR_AND_EXIT("invalid args, use --help for usage");
+	}
+}
+
+int main(int argc, const char* const* argv) noexcept {
+	manage_args(argc, argv);
+
+	if (access(flags::srcembed_path, X_OK) == -1) { REPORT_ERROR_AND_EXIT("srcembed binary not found, build it first or pass \"--srcembed\""); }
+
+	static char workDir[] = "/tmp/srcembed_engine_benchmark_XXXXXX";
+	if (flags::work_dir == nullptr) {
+		if (mkdtemp(workDir) == nullptr) { REPORT_ERROR_AND_EXIT("failed to create work dir: mkdtemp failed"); }
+		flags::work_dir = workDir;
+	}
+	mkdir(flags::work_dir, 0755);
+
+	const bool xxdAvailable = find_in_path("xxd");
+	if (!xxdAvailable) { std::fputs("xxd not found, skipping xxd -i comparison\n", stderr); }
+
+	char referencePath[4096];
+	std::snprintf(referencePath, sizeof(referencePath), "%s/reference.txt", flags::work_dir);
+
+	for (int profile = 0; profile < 3; profile++) {
+		char inputPath[4096];
+		std::snprintf(inputPath, sizeof(inputPath), "%s/input_%s_%zu.bin", flags::work_dir, entropy_profile_names[profile], flags::size);
+		ensure_input(inputPath, (entropy_profile_t)profile, flags::size);
+
+		// The reference output comes from the simplest engine.
+		const char* const referenceArgv[] = { flags::srcembed_path, "--engine", "read_write", "c++", nullptr };
+		const int referenceStdin = open(inputPath, O_RDONLY);
+		const int referenceStdout = open(referencePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (referenceStdin == -1 || referenceStdout == -1) { REPORT_ERROR_AND_EXIT("failed to create reference output"); }
+		const pid_t referencePid = spawn_process(referenceArgv, referenceStdin, referenceStdout);
+		close(referenceStdin);
+		close(referenceStdout);
+		int referenceStatus;
+		if (referencePid == -1 || waitpid(referencePid, &referenceStatus, 0) == -1 || !WIFEXITED(referenceStatus) || WEXITSTATUS(referenceStatus) != 0) {
+			REPORT_ERROR_AND_EXIT("failed to create reference output: srcembed failed");
+		}
+		uint64_t referenceHash;
+		if (!hash_file(referencePath, referenceHash)) { REPORT_ERROR_AND_EXIT("failed to hash reference output"); }
+
+		for (int stdinKind = 0; stdinKind < 2; stdinKind++) {
+			for (int sinkKind = 0; sinkKind < 3; sinkKind++) {
+				for (const engine_t& engine : engines) {
+					if (engine.requires_stdin_file && (stdin_kind_t)stdinKind != stdin_kind_t::FILE) { continue; }
+					if (engine.requires_stdout_pipe && (sink_kind_t)sinkKind != sink_kind_t::PIPE) { continue; }
+					if (engine.max_input_size != 0 && flags::size > engine.max_input_size) { continue; }
+					const char* const engineArgv[] = { flags::srcembed_path, "--engine", engine.name, "c++", nullptr };
+					measure("srcembed", engine.name, engineArgv, inputPath, (entropy_profile_t)profile, (stdin_kind_t)stdinKind, (sink_kind_t)sinkKind, &referenceHash);
+				}
+				if (xxdAvailable) {
+					const char* const xxdArgv[] = { "xxd", "-i", nullptr };
+					measure("xxd", "-i", xxdArgv, inputPath, (entropy_profile_t)profile, (stdin_kind_t)stdinKind, (sink_kind_t)sinkKind, nullptr);
+				}
+			}
+		}
+	}
+}
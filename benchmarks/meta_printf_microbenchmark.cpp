@@ -0,0 +1,213 @@
+// meta_printf microbenchmark:
+// Times the formatting kernels that srcembed's engines are built on in isolation, on in-memory buffers, without any I/O in the way.
+// Every variant formats the same input into ", <decimal byte>" sequences (the exact thing the engines produce),
+// the existing meta_printf kernels are compared against std::to_chars and snprintf.
+// Output is one JSON object per measurement (JSON lines) on stdout.
+
+// NOTE: Before anything is timed, the output of every variant is compared byte-for-byte against the snprintf variant,
+// a variant that doesn't produce identical output is a bug and makes the whole benchmark fail.
+
+#include <charconv>
+#include <utility>
+
+#include "benchmark_common.h"
+
+#include "../meta_printf.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <x86intrin.h>
+
+// NOTE: The TSC ticks at a constant reference frequency, not at the actual core frequency, so ticks aren't exactly cycles
+// if the core is boosting or throttling. It's still the most precise thing we have that doesn't need perf permissions.
+// The lfences stop the rdtsc from being executed out of order with the code that's being measured.
+inline uint64_t read_tick_counter() noexcept {
+	_mm_lfence();
+	const uint64_t result = __rdtsc();
+	_mm_lfence();
+	return result;
+}
+
+const char tick_counter_name[] = "rdtsc";
+
+#else
+
+inline uint64_t read_tick_counter() noexcept {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+const char tick_counter_name[] = "monotonic_ns";
+
+#endif
+
+namespace flags {
+	size_t size = 1024 * 1024;
+	unsigned int repetitions = 20;
+}
+
+const char helpText[] = "usage: meta_printf_microbenchmark [--size <bytes>] [--repetitions <count>]\n" \
+			"\n" \
+			"function: times the meta_printf formatting kernels (and std::to_chars and snprintf) on in-memory buffers\n" \
+			"\n" \
+			"arguments:\n" \
+				"\t[--size <bytes>]          --> input size (default: 1048576)\n" \
+				"\t[--repetitions <count>]   --> measured runs per variant and input (default: 20)\n" \
+			"\n" \
+			"output: one JSON object per line on stdout\n";
+
+// Every variant formats size input bytes into output and returns the amount of bytes it wrote.
+using formatter_t = size_t (*)(const unsigned char* input, size_t size, char* output) noexcept;
+
+inline constexpr auto single_pattern = meta::construct_meta_array(", %u");
+
+size_t format_meta_single(const unsigned char* input, size_t size, char* output) noexcept {
+	char* ptr = output;
+	for (size_t i = 0; i < size; i++) { ptr += meta_sprintf_no_terminator(ptr, single_pattern.data, input[i]); }
+	return ptr - output;
+}
+
+template <size_t... chunk_indices>
+consteval auto generate_chunked_pattern() {
+	meta::meta_string<sizeof...(chunk_indices) * (sizeof(single_pattern) - 1) + 1> result;
+	for (size_t i = 0; i < sizeof(result) - 1; i += sizeof(single_pattern) - 1) {
+		for (size_t j = 0; j < sizeof(single_pattern) - 1; j++) {
+			result[i + j] = single_pattern[j];
+		}
+	}
+	result[sizeof(result) - 1] = '\0';
+	return result;
+}
+
+template <size_t... chunk_indices>
+inline constexpr auto chunked_pattern = generate_chunked_pattern<chunk_indices...>();
+
+// Same as what the engines do: one meta_printf program for a whole chunk of bytes, the rest is done byte by byte.
+template <size_t... chunk_indices>
+size_t format_meta_chunked_impl(const unsigned char* input, size_t size, char* output, std::index_sequence<chunk_indices...>) noexcept {
+	char* ptr = output;
+	size_t i = 0;
+	for (; i + sizeof...(chunk_indices) <= size; i += sizeof...(chunk_indices)) {
+		ptr += meta_sprintf_no_terminator(ptr, chunked_pattern<chunk_indices...>.data, input[i + chunk_indices]...);
+	}
+	for (; i < size; i++) { ptr += meta_sprintf_no_terminator(ptr, single_pattern.data, input[i]); }
+	return ptr - output;
+}
+
+template <size_t chunk_size>
+size_t format_meta_chunked(const unsigned char* input, size_t size, char* output) noexcept {
+	return format_meta_chunked_impl(input, size, output, std::make_index_sequence<chunk_size>());
+}
+
+// Just the lookup table kernel, without the program around it.
+size_t format_output_uint8(const unsigned char* input, size_t size, char* output) noexcept {
+	meta::printf::memory_outputter outputter(output);
+	const meta::printf::memory_outputter begin = outputter;
+	for (size_t i = 0; i < size; i++) {
+		outputter.write_single_byte(',');
+		outputter.write_single_byte(' ');
+		meta::printf::output_uint8(outputter, input[i]);
+	}
+	return outputter - begin;
+}
+
+size_t format_to_chars(const unsigned char* input, size_t size, char* output) noexcept {
+	char* ptr = output;
+	for (size_t i = 0; i < size; i++) {
+		*ptr++ = ',';
+		*ptr++ = ' ';
+		ptr = std::to_chars(ptr, ptr + 3, input[i]).ptr;
+	}
+	return ptr - output;
+}
+
+size_t format_snprintf(const unsigned char* input, size_t size, char* output) noexcept {
+	char* ptr = output;
+	for (size_t i = 0; i < size; i++) {
+		// NOTE: snprintf always wants to write a NUL, the output buffer has one byte of slack at the end for it.
+		ptr += std::snprintf(ptr, 6, ", %u", input[i]);
+	}
+	return ptr - output;
+}
+
+struct variant_t {
+	const char* name;
+	formatter_t formatter;
+};
+
+// NOTE: The first variant is the reference that all the others are checked against.
+const variant_t variants[] = {
+	{ "snprintf", format_snprintf },
+	{ "to_chars", format_to_chars },
+	{ "output_uint8", format_output_uint8 },
+	{ "meta_single", format_meta_single },
+	{ "meta_chunked_8", format_meta_chunked<8> },
+	{ "meta_chunked_32", format_meta_chunked<32> }
+};
+
+// NOTE: ", 255" is the longest possible output for a single byte.
+constexpr size_t max_output_bytes_per_input_byte = 5;
+
+bool parse_unsigned_arg(const char* arg, unsigned long long& result) noexcept {
+	char* end;
+	result = std::strtoull(arg, &end, 10);
+	return end != arg && *end == '\0';
+}
+
+void manage_args(int argc, const char* const* argv) noexcept {
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--help") == 0) { std::fputs(helpText, stdout); std::exit(EXIT_SUCCESS); }
+		unsigned long long value;
+		if (i + 1 == argc || !parse_unsigned_arg(argv[i + 1], value) || value == 0) { REPORT_ERROR_AND_EXIT("invalid args, use --help for usage"); }
+		if (std::strcmp(argv[i], "--size") == 0) { flags::size = value; i++; continue; }
+		if (std::strcmp(argv[i], "--repetitions") == 0) { flags::repetitions = value; i++; continue; }
+		REPORT_ERROR_AND_EXIT("invalid args, use --help for usage");
+	}
+}
+
+int main(int argc, const char* const* argv) noexcept {
+	manage_args(argc, argv);
+
+	unsigned char* input = (unsigned char*)std::malloc(flags::size);
+	char* referenceOutput = (char*)std::malloc(flags::size * max_output_bytes_per_input_byte + 1);
+	char* output = (char*)std::malloc(flags::size * max_output_bytes_per_input_byte + 1);
+	uint64_t* ticks = (uint64_t*)std::malloc(flags::repetitions * sizeof(uint64_t));
+	double* seconds = (double*)std::malloc(flags::repetitions * sizeof(double));
+	if (input == nullptr || referenceOutput == nullptr || output == nullptr || ticks == nullptr || seconds == nullptr) { REPORT_ERROR_AND_EXIT("failed to allocate buffers"); }
+
+	for (int profile = 0; profile < 3; profile++) {
+		uint64_t randomState = input_random_seed;
+		generate_input_data(input, flags::size, (entropy_profile_t)profile, 0, randomState);
+
+		const size_t referenceOutputSize = variants[0].formatter(input, flags::size, referenceOutput);
+
+		for (const variant_t& variant : variants) {
+			// equivalence check, which doubles as the warmup run
+			std::memset(output, 0, flags::size * max_output_bytes_per_input_byte);
+			const size_t outputSize = variant.formatter(input, flags::size, output);
+			if (outputSize != referenceOutputSize || std::memcmp(output, referenceOutput, outputSize) != 0) {
+				std::fprintf(stderr, "ERROR: variant \"%s\" doesn't match the reference output on %s input\n", variant.name, entropy_profile_names[profile]);
+				std::exit(EXIT_FAILURE);
+			}
+
+			for (unsigned int i = 0; i < flags::repetitions; i++) {
+				const double startTime = get_monotonic_seconds();
+				const uint64_t startTicks = read_tick_counter();
+				variant.formatter(input, flags::size, output);
+				ticks[i] = read_tick_counter() - startTicks;
+				seconds[i] = get_monotonic_seconds() - startTime;
+			}
+			std::sort(ticks, ticks + flags::repetitions);
+			std::sort(seconds, seconds + flags::repetitions);
+			const uint64_t medianTicks = ticks[flags::repetitions / 2];
+			const double medianSeconds = seconds[flags::repetitions / 2];
+
+			std::printf("{\"variant\":\"%s\",\"input\":\"%s\",\"input_bytes\":%zu,\"output_bytes\":%zu,\"repetitions\":%u,\"tick_counter\":\"%s\","
+				    "\"min_ticks\":%llu,\"median_ticks\":%llu,\"median_seconds\":%.9f,\"input_bytes_per_tick\":%.4f,\"output_bytes_per_tick\":%.4f,\"matches_reference\":true}\n",
+				    variant.name, entropy_profile_names[profile], flags::size, outputSize, flags::repetitions, tick_counter_name,
+				    (unsigned long long)ticks[0], (unsigned long long)medianTicks, medianSeconds,
+				    (double)flags::size / medianTicks, (double)outputSize / medianTicks);
+		}
+	}
+}
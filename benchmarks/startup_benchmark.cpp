@@ -0,0 +1,216 @@
+// Startup latency benchmark:
+// For big batches of tiny embeds, srcembed's runtime is mostly process startup (exec, dynamic loading, static init) and not formatting.
+// This runs every given srcembed binary many times on tiny inputs and reports the wall time per run, which is what a build system
+// that embeds thousands of small files actually waits for. Meant for comparing the build_static output against the build output (the dynamic build):
+// the first binary is the baseline, and every measurement also reports its median wall time relative to the baseline's.
+// NOTE: build_static is the same program statically linked, not a freestanding (-nostdlib) build, see build_static for what it does and doesn't remove.
+// Next to the wall time, every measurement reports the size of the binary and the page faults per run (from wait4()'s rusage).
+// Minor faults are mostly the code and data pages that get touched on the way to the first write, so they go up
+// with every bit of code that startup has to page in, long before the wall time shows it.
+// Output is one JSON object per measurement (JSON lines) on stdout.
+
+// NOTE: Before anything is timed, every binary's output is compared byte-for-byte against the first binary's output,
+// a binary that produces something else is a bug and makes the whole benchmark fail.
+
+#include <cerrno>
+
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "benchmark_common.h"
+
+namespace flags {
+	const char* binaries[16] = { "bin/srcembed", "bin/srcembed_static" };
+	size_t binaries_count = 2;
+	const char* work_dir = nullptr;
+	size_t sizes[16] = { 16, 4096, 65536 };
+	size_t sizes_count = 3;
+	unsigned int warmup = 20;
+	unsigned int runs = 500;
+}
+
+const char helpText[] = "usage: startup_benchmark [--binaries <path,path,...>] [--work-dir <dir>] [--sizes <bytes,bytes,...>] [--warmup <count>] [--runs <count>]\n" \
+			"\n" \
+			"function: measures the wall time and page faults of whole srcembed runs on tiny inputs (startup latency), next to the binary sizes\n" \
+			"\n" \
+			"arguments:\n" \
+				"\t[--binaries <path,path,...>]   --> srcembed binaries to compare, the first one is the baseline (default: bin/srcembed,bin/srcembed_static)\n" \
+				"\t[--work-dir <dir>]             --> directory for the generated inputs (default: a fresh directory in /tmp)\n" \
+				"\t[--sizes <bytes,bytes,...>]    --> input sizes (default: 16,4096,65536)\n" \
+				"\t[--warmup <count>]             --> untimed runs before every measurement (default: 20)\n" \
+				"\t[--runs <count>]               --> timed runs per measurement (default: 500)\n" \
+			"\n" \
+			"output: one JSON object per line on stdout\n";
+
+struct fault_counts_t {
+	long minor;
+	long major;
+};
+
+// NOTE: Returns the wall time of the run, or a negative number if it failed.
+double run_once(const char* binary, const char* inputPath, const char* outputPath, fault_counts_t* faults = nullptr) noexcept {
+	const char* const argv[] = { binary, "c++", nullptr };
+
+	const int stdinFd = open(inputPath, O_RDONLY);
+	const int stdoutFd = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (stdinFd == -1 || stdoutFd == -1) { REPORT_ERROR_AND_EXIT("failed to open process stdin/stdout"); }
+
+	const double startTime = get_monotonic_seconds();
+	const pid_t pid = spawn_process(argv, stdinFd, stdoutFd);
+	if (pid == -1) { REPORT_ERROR_AND_EXIT("failed to spawn process: fork failed"); }
+	int status;
+	struct rusage usage;
+	if (wait4(pid, &status, 0, &usage) == -1) { REPORT_ERROR_AND_EXIT("failed to wait for process: wait4 failed"); }
+	const double wallSeconds = get_monotonic_seconds() - startTime;
+
+	close(stdinFd);
+	close(stdoutFd);
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) { return -1; }
+	if (faults != nullptr) { *faults = { usage.ru_minflt, usage.ru_majflt }; }
+	return wallSeconds;
+}
+
+bool files_equal(const char* pathA, const char* pathB) noexcept {
+	FILE* fileA = std::fopen(pathA, "rb");
+	FILE* fileB = std::fopen(pathB, "rb");
+	bool result = fileA != nullptr && fileB != nullptr;
+	while (result) {
+		const int byteA = std::fgetc(fileA);
+		if (byteA != std::fgetc(fileB)) { result = false; }
+		if (byteA == EOF) { break; }
+	}
+	if (fileA != nullptr) { std::fclose(fileA); }
+	if (fileB != nullptr) { std::fclose(fileB); }
+	return result;
+}
+
+// Returns the median wall time, or a negative number if a run failed.
+// NOTE: baselineMedianSeconds is negative for the baseline itself (and when the baseline failed), there's no ratio in the output then.
+double measure(const char* binary, const char* inputPath, size_t size, const char* outputPath, double baselineMedianSeconds) noexcept {
+	std::fprintf(stderr, "%s: %zu bytes\n", binary, size);
+
+	const char* status = "ok";
+	double medianSeconds = -1;
+	static double wallTimes[1000000];
+	static long minorFaults[1000000];
+	static long majorFaults[1000000];
+	const unsigned int runs = std::min(flags::runs, (unsigned int)(sizeof(wallTimes) / sizeof(double)));
+
+	for (unsigned int i = 0; i < flags::warmup; i++) {
+		if (run_once(binary, inputPath, outputPath) < 0) { status = "failed"; goto report; }
+	}
+	for (unsigned int i = 0; i < runs; i++) {
+		fault_counts_t faults;
+		wallTimes[i] = run_once(binary, inputPath, outputPath, &faults);
+		if (wallTimes[i] < 0) { status = "failed"; goto report; }
+		minorFaults[i] = faults.minor;
+		majorFaults[i] = faults.major;
+	}
+
+report:
+	std::printf("{\"binary\":");
+	print_json_string(binary);
+	std::printf(",\"binary_bytes\":%lld,\"input_bytes\":%zu,\"status\":\"%s\"", get_file_size(binary), size, status);
+	if (std::strcmp(status, "ok") == 0) {
+		double totalSeconds = 0;
+		for (unsigned int i = 0; i < runs; i++) { totalSeconds += wallTimes[i]; }
+		std::sort(wallTimes, wallTimes + runs);
+		medianSeconds = wallTimes[runs / 2];
+		std::printf(",\"runs\":%u,\"min_seconds\":%.6f,\"median_seconds\":%.6f,\"p90_seconds\":%.6f,\"mean_seconds\":%.6f",
+			    runs, wallTimes[0], medianSeconds, wallTimes[runs * 9 / 10], totalSeconds / runs);
+		if (baselineMedianSeconds >= 0) {
+			std::printf(",\"baseline\":");
+			print_json_string(flags::binaries[0]);
+			std::printf(",\"median_vs_baseline\":%.3f", medianSeconds / baselineMedianSeconds);
+		}
+		std::sort(minorFaults, minorFaults + runs);
+		std::sort(majorFaults, majorFaults + runs);
+		std::printf(",\"min_minor_faults\":%ld,\"median_minor_faults\":%ld,\"median_major_faults\":%ld", minorFaults[0], minorFaults[runs / 2], majorFaults[runs / 2]);
+	}
+	std::printf("}\n");
+	std::fflush(stdout);
+	return medianSeconds;
+}
+
+// NOTE: Parses a comma-separated list in place, the pointers point into argv.
+size_t parse_list(char* list, const char** result, size_t capacity) noexcept {
+	size_t count = 0;
+	for (char* entry = list; *entry != '\0';) {
+		if (count == capacity) { REPORT_ERROR_AND_EXIT("too many list entries"); }
+		result[count++] = entry;
+		char* end = std::strchr(entry, ',');
+		if (end == nullptr) { break; }
+		*end = '\0';
+		entry = end + 1;
+	}
+	return count;
+}
+
+void manage_args(int argc, char** argv) noexcept {
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--help") == 0) { std::fputs(helpText, stdout); std::exit(EXIT_SUCCESS); }
+		if (i + 1 == argc) { REPORT_ERROR_AND_EXIT("invalid args, use --help for usage"); }
+		if (std::strcmp(argv[i], "--binaries") == 0) {
+			flags::binaries_count = parse_list(argv[++i], flags::binaries, sizeof(flags::binaries) / sizeof(const char*));
+			if (flags::binaries_count == 0) { REPORT_ERROR_AND_EXIT("\"--binaries\" requires a comma-separated list of paths"); }
+			continue;
+		}
+		if (std::strcmp(argv[i], "--work-dir") == 0) { flags::work_dir = argv[++i]; continue; }
+		if (std::strcmp(argv[i], "--warmup") == 0) { flags::warmup = std::atoi(argv[++i]); continue; }
+		if (std::strcmp(argv[i], "--runs") == 0) {
+			flags::runs = std::atoi(argv[++i]);
+			if (flags::runs == 0) { REPORT_ERROR_AND_EXIT("\"--runs\" requires a positive integer"); }
+			continue;
+		}
+		if (std::strcmp(argv[i], "--sizes") == 0) {
+			flags::sizes_count = 0;
+			for (const char* size = argv[++i]; *size != '\0';) {
+				if (flags::sizes_count == sizeof(flags::sizes) / sizeof(size_t)) { REPORT_ERROR_AND_EXIT("too many sizes"); }
+				char* end;
+				flags::sizes[flags::sizes_count++] = std::strtoull(size, &end, 10);
+				if (end == size || flags::sizes[flags::sizes_count - 1] == 0) { REPORT_ERROR_AND_EXIT("\"--sizes\" requires a comma-separated list of positive integers"); }
+				size = *end == ',' ? end + 1 : end;
+			}
+			continue;
+		}
+		REPORT_ERROR_AND_EXIT("invalid args, use --help for usage");
+	}
+}
+
+int main(int argc, char** argv) noexcept {
+	manage_args(argc, argv);
+
+	for (size_t i = 0; i < flags::binaries_count; i++) {
+		if (access(flags::binaries[i], X_OK) == -1) { REPORT_ERROR_AND_EXIT("srcembed binary not found, build it first (build and build_static) or pass \"--binaries\""); }
+	}
+
+	static char workDir[] = "/tmp/srcembed_startup_benchmark_XXXXXX";
+	if (flags::work_dir == nullptr) {
+		if (mkdtemp(workDir) == nullptr) { REPORT_ERROR_AND_EXIT("failed to create work dir: mkdtemp failed"); }
+		flags::work_dir = workDir;
+	} else if (mkdir(flags::work_dir, 0755) == -1 && errno != EEXIST) {
+		REPORT_ERROR_AND_EXIT("failed to create work dir: mkdir failed");
+	}
+
+	char referencePath[4096];
+	char outputPath[4096];
+	std::snprintf(referencePath, sizeof(referencePath), "%s/reference.cpp", flags::work_dir);
+	std::snprintf(outputPath, sizeof(outputPath), "%s/output.cpp", flags::work_dir);
+
+	for (size_t sizeIndex = 0; sizeIndex < flags::sizes_count; sizeIndex++) {
+		char inputPath[4096];
+		std::snprintf(inputPath, sizeof(inputPath), "%s/input_%zu.bin", flags::work_dir, flags::sizes[sizeIndex]);
+		ensure_input(inputPath, entropy_profile_t::RANDOM, flags::sizes[sizeIndex]);
+
+		if (run_once(flags::binaries[0], inputPath, referencePath) < 0) { REPORT_ERROR_AND_EXIT("reference run failed"); }
+		for (size_t i = 1; i < flags::binaries_count; i++) {
+			if (run_once(flags::binaries[i], inputPath, outputPath) < 0 || !files_equal(referencePath, outputPath)) {
+				REPORT_ERROR_AND_EXIT("binaries don't produce identical output");
+			}
+		}
+
+		const double baselineMedianSeconds = measure(flags::binaries[0], inputPath, flags::sizes[sizeIndex], outputPath, -1);
+		for (size_t i = 1; i < flags::binaries_count; i++) { measure(flags::binaries[i], inputPath, flags::sizes[sizeIndex], outputPath, baselineMedianSeconds); }
+	}
+}
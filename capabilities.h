@@ -0,0 +1,205 @@
+#pragma once
+
+// Everything we want to know about the system we're running on, in one place.
+// Every capability is probed lazily, the first time somebody asks for it, so a run only pays for the probes its engine actually needs
+// (the read_write engine never looks at huge pages, split mode never looks at the pipe size limit, etc...).
+// NOTE: The host-wide capabilities (the ones that only change when the admin changes them) can also be seeded from the --tune cache,
+// in which case they cost no syscalls at all. Only --tune writes that cache, so a host that never ran it probes the ones a run needs every time.
+// That's on purpose: a normal run doesn't leave files behind, and doesn't probe anything its engine doesn't need just to fill in a cache.
+// The per-process ones (core count, cgroup limits) always get probed live, since they depend on how this particular process was started.
+
+#include "crossplatform_io.h"
+
+#ifdef PLATFORM_WINDOWS
+#error "capabilities.h" header file cannot be included when compiling for Windows
+#endif
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+#include <atomic>
+#include <thread>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+#include "meta_dfa.h"
+
+namespace capabilities {
+
+	enum class thp_mode_t : uint8_t {
+		UNKNOWN,
+		ALWAYS,
+		MADVISE,
+		NEVER
+	};
+
+	inline const char* const thp_mode_names[] = { "unknown", "always", "madvise", "never" };
+
+	enum cpu_feature_t : uint32_t {
+		CPU_FEATURE_SSE2 = 1 << 0,
+		CPU_FEATURE_SSE4_2 = 1 << 1,
+		CPU_FEATURE_AVX2 = 1 << 2,
+		CPU_FEATURE_AVX512BW = 1 << 3,
+		CPU_FEATURE_BMI2 = 1 << 4
+	};
+
+	// NOTE: Atomic, because the library can ask for these from several threads at once (concurrent embed() calls).
+	// Every probe computes its result on its own and only stores the final value, before setting known. Two threads that probe at the same time
+	// both store the same value, which costs one extra probe and nothing else.
+	template <typename T>
+	struct lazy_t {
+		std::atomic<bool> known = false;
+		std::atomic<T> value;
+
+		bool is_known() const noexcept { return known.load(std::memory_order_acquire); }
+		T get() const noexcept { return value.load(std::memory_order_relaxed); }
+		T set(T new_value) noexcept {
+			value.store(new_value, std::memory_order_relaxed);
+			known.store(true, std::memory_order_release);
+			return new_value;
+		}
+	};
+
+	inline lazy_t<long> cached_page_size;
+	inline lazy_t<size_t> cached_huge_page_size;
+	inline lazy_t<thp_mode_t> cached_thp_mode;
+	inline lazy_t<size_t> cached_pipe_max_size;
+	inline lazy_t<bool> cached_io_uring_available;
+	inline lazy_t<uint32_t> cached_cpu_features;
+	inline lazy_t<size_t> cached_core_count;
+	inline lazy_t<size_t> cached_cgroup_memory_limit;
+
+	// The key sets for every file we read, the state tables get generated at compile-time.
+	inline constexpr auto meminfo_dfa = meta::dfa::build("\nHugepagesize:");
+	inline constexpr auto thp_mode_dfa = meta::dfa::build("[always]", "[madvise]", "[never]");
+	// "<quota> <period>" or "max <period>"
+	inline constexpr auto cpu_max_dfa = meta::dfa::build("\n", " ");
+	// For files that only contain a number (or "max").
+	inline constexpr auto number_dfa = meta::dfa::build("\n");
+
+	// Runs the whole file through the scanner. The reads can split the file wherever they like, the scanner doesn't care.
+	template <const auto& dfa>
+	bool scan_file(const char* path, meta::dfa::scanner<dfa>& scanner) noexcept {
+		const int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd == -1) { return false; }
+		char buffer[1024];
+		while (true) {
+			const ssize_t bytes_read = read_entire_buffer(fd, buffer, sizeof(buffer));
+			if (bytes_read == -1) { close(fd); return false; }
+			scanner.feed(buffer, bytes_read);
+			if (bytes_read != sizeof(buffer)) { break; }
+		}
+		close(fd);
+		return true;
+	}
+
+	inline bool read_number_file(const char* path, size_t& result) noexcept {
+		meta::dfa::scanner<number_dfa> scanner;
+		if (!scan_file(path, scanner) || !scanner.values[0].has_value) { return false; }
+		result = scanner.values[0].value;
+		return true;
+	}
+
+	inline long page_size() noexcept {
+		if (cached_page_size.is_known()) { return cached_page_size.get(); }
+		return cached_page_size.set(sysconf(_SC_PAGE_SIZE));
+	}
+
+	// NOTE: 0 means there are no (explicit) huge pages.
+	inline size_t huge_page_size() noexcept {
+		if (cached_huge_page_size.is_known()) { return cached_huge_page_size.get(); }
+		meta::dfa::scanner<meminfo_dfa> scanner;
+		// NOTE: meminfo is in kB.
+		if (scan_file("/proc/meminfo", scanner) && scanner.values[0].has_value) { return cached_huge_page_size.set(scanner.values[0].value * 1024); }
+		return cached_huge_page_size.set(0);
+	}
+
+	// The selected mode is the one in brackets, e.g. "always [madvise] never".
+	inline thp_mode_t thp_mode() noexcept {
+		if (cached_thp_mode.is_known()) { return cached_thp_mode.get(); }
+		thp_mode_t mode = thp_mode_t::UNKNOWN;
+		meta::dfa::scanner<thp_mode_dfa> scanner;
+		if (scan_file("/sys/kernel/mm/transparent_hugepage/enabled", scanner)) {
+			if (scanner.values[0].matched) { mode = thp_mode_t::ALWAYS; }
+			else if (scanner.values[1].matched) { mode = thp_mode_t::MADVISE; }
+			else if (scanner.values[2].matched) { mode = thp_mode_t::NEVER; }
+		}
+		return cached_thp_mode.set(mode);
+	}
+
+	// NOTE: The largest pipe size an unprivileged process can ask for with F_SETPIPE_SZ. 0 means unknown.
+	inline size_t pipe_max_size() noexcept {
+		if (cached_pipe_max_size.is_known()) { return cached_pipe_max_size.get(); }
+		size_t size;
+		if (!read_number_file("/proc/sys/fs/pipe-max-size", size)) { size = 0; }
+		return cached_pipe_max_size.set(size);
+	}
+
+	// NOTE: io_uring can be compiled out, blocked by seccomp (most container runtimes) or disabled through kernel.io_uring_disabled,
+	// actually setting up a (tiny) ring is the only reliable way to find out.
+	inline bool io_uring_available() noexcept {
+		if (cached_io_uring_available.is_known()) { return cached_io_uring_available.get(); }
+		bool available = false;
+#ifdef SYS_io_uring_setup
+		// NOTE: This is struct io_uring_params, which is 120 bytes. We don't need any of its fields, so we don't need the header for it.
+		alignas(8) unsigned char params[120] = { };
+		const long fd = syscall(SYS_io_uring_setup, 1, params);
+		if (fd >= 0) {
+			close(fd);
+			available = true;
+		}
+#endif
+		return cached_io_uring_available.set(available);
+	}
+
+	// NOTE: No syscalls here, the compiler runtime reads cpuid once at startup anyway.
+	inline uint32_t cpu_features() noexcept {
+		if (cached_cpu_features.is_known()) { return cached_cpu_features.get(); }
+		uint32_t features = 0;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse2")) { features |= CPU_FEATURE_SSE2; }
+		if (__builtin_cpu_supports("sse4.2")) { features |= CPU_FEATURE_SSE4_2; }
+		if (__builtin_cpu_supports("avx2")) { features |= CPU_FEATURE_AVX2; }
+		if (__builtin_cpu_supports("avx512bw")) { features |= CPU_FEATURE_AVX512BW; }
+		if (__builtin_cpu_supports("bmi2")) { features |= CPU_FEATURE_BMI2; }
+#endif
+		return cached_cpu_features.set(features);
+	}
+
+	// The amount of cores we can actually use: the affinity mask, capped by the cgroup CPU quota (cgroup v2 cpu.max, "<quota> <period>" or "max <period>").
+	// NOTE: std::thread::hardware_concurrency() counts every core in the machine, which is way too many threads inside of a container that's allowed two.
+	inline size_t core_count() noexcept {
+		if (cached_core_count.is_known()) { return cached_core_count.get(); }
+		size_t count;
+		cpu_set_t affinity;
+		if (sched_getaffinity(0, sizeof(affinity), &affinity) == 0) { count = CPU_COUNT(&affinity); }
+		else { count = std::thread::hardware_concurrency(); }
+
+		meta::dfa::scanner<cpu_max_dfa> scanner;
+		if (scan_file("/sys/fs/cgroup/cpu.max", scanner) && scanner.values[0].has_value && scanner.values[1].has_value && scanner.values[1].value != 0) {
+			const size_t quota = scanner.values[0].value;
+			const size_t period = scanner.values[1].value;
+			const size_t quota_cores = (quota + period - 1) / period;
+			if (quota_cores < count) { count = quota_cores; }
+		}
+
+		return cached_core_count.set(count != 0 ? count : 1);
+	}
+
+	// NOTE: cgroup v2 memory.max, 0 means there is no limit (or we couldn't find out).
+	inline size_t cgroup_memory_limit() noexcept {
+		if (cached_cgroup_memory_limit.is_known()) { return cached_cgroup_memory_limit.get(); }
+		size_t limit;
+		if (!read_number_file("/sys/fs/cgroup/memory.max", limit)) { limit = 0; }
+		return cached_cgroup_memory_limit.set(limit);
+	}
+
+	// For seeding the host-wide capabilities from the --tune cache.
+	template <typename T>
+	void seed(lazy_t<T>& capability, T value) noexcept { capability.set(value); }
+
+}
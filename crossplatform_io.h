@@ -39,3 +39,13 @@ inline ssize_t read_entire_buffer(int fd, void* buffer, size_t size) noexcept {
 		*(char**)&buffer += bytes_read;
 	}
 }
+
+inline bool write_entire_buffer(int fd, const void* buffer, size_t size) noexcept {
+	while (size != 0) {
+		sioret_t bytes_written = crossplatform_write(fd, buffer, size);
+		if (bytes_written == -1) { return false; }
+		size -= bytes_written;
+		*(const char**)&buffer += bytes_written;
+	}
+	return true;
+}
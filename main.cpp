@@ -2,42 +2,91 @@
 
 #ifndef PLATFORM_WINDOWS
 
-#include <sys/mman.h>		// for mmap(), munmap() and posix_madvise() support
-#include <sys/stat.h>		// for fstat() support
-#include <fcntl.h>		// for posix_fadvise() support
+#include <sys/mman.h>		// for memfd_create() (--tune)
+#include <fcntl.h>		// for open() (--tune)
+#include <signal.h>		// for sigaction() (SIGUSR1 and --progress)
+#include <sys/time.h>		// for setitimer() (--progress)
+#include <sys/wait.h>		// for waitpid() (--tune)
 
 #endif
 
 #include <cstring>		// for std::strcmp() and std::memcpy()
+#include <cerrno>		// for errno
 
 #include <cstdio>		// we use just a tiny bit of C stdio because we use normal printf in one or two places
 
-#include "crossplatform_io.h"
-#include "async_streamed_io.h"
+#include <chrono>		// for timing things for --stats
 
-// These (technically just stdout_stream) need to be located before meta_printf.h include.
-using stdin_stream = asyncio::stdin_stream<65536>;
-using stdout_stream = asyncio::stdout_stream<65536>;
+#include "crossplatform_io.h"
+#include "async_streamed_io.h"	// for the stream thread hooks
+#include "trace.h"		// for --trace
+#include "usdt.h"		// for the static tracepoints (bpftrace, perf, SystemTap)
+#include "progress.h"		// for --progress and SIGUSR1 snapshots
+#include "tuning.h"		// for --tune and the per-host parameters it stores
 
-#include "meta_printf.h"	// for compile-time printf
+#include "srcembed.h"		// for the engines, split and sparse mode, everything that actually turns stdin into source
 
 #ifndef PLATFORM_WINDOWS
 
-#include "meminfo_parser.h"	// for getting huge page size from /proc/meminfo
-
-const long pagesize = sysconf(_SC_PAGE_SIZE);
+#include "capabilities.h"	// for page size, huge page size, core count and everything else we need to know about the system
+#include "arena.h"		// for the one region that all the buffers come out of
+#include "topology.h"		// for --pin and NUMA placement
+#include "perf_counters.h"	// for --perf-counters
 
 #endif
 
-const char helpText[] = "usage: srcembed <--help> || ([--varname <variable name>] <language>)\n" \
+const char helpText[] = "usage: srcembed <--help> || <--tune> || ([--varname <variable name>] <language>)\n" \
 			"\n" \
 			"function: converts input byte stream into source file (output through stdout)\n" \
 			"\n" \
 			"arguments:\n" \
 				"\t<--help>                      --> displays help text\n" \
 				"\t[--varname <variable name>]   --> specifies the variable name by which the embedded file shall be referred to in code\n" \
+				"\t[--align <bytes>]             --> aligns the array to the given power of two (alignas, _Alignas in C) and adds a size symbol (see below)\n" \
+				"\t[--section <name>]            --> puts the array into the given section (GCC and Clang) and adds a size symbol (see below)\n" \
+				"\t[--pad]                       --> rounds the array size up to a multiple of the \"--align\" value, so that the array has its aligned blocks to itself (requires stdin to be a regular file) (Linux only)\n" \
+				"\t[--split <part count>]        --> splits the data into exactly the given amount of separately compilable source files, stdin needs at least 64 bytes per part (see below)\n" \
+				"\t[--split-size <bytes>]        --> splits the data into source files that each hold the given amount of input bytes, rounded up to a multiple of 64 (see below)\n" \
+				"\t[--sparse]                    --> leaves out trailing zeros (explicit array size) and long zero runs (designated initializers, C only), reads around the holes of sparse files (see below)\n" \
+				"\t[--engine <engine>]           --> forces the data transfer engine instead of picking one based on stdin and stdout (see below)\n" \
+				"\t[--stats[=json]]              --> prints statistics about the engine and its I/O to stderr at exit (as a single line of JSON with \"=json\")\n" \
+				"\t[--perf-counters[=json]]      --> prints hardware performance counters for the formatter, reader and flusher threads to stderr at exit (Linux only)\n" \
+				"\t[--trace <file>]              --> records a timeline of buffer fills, syscalls and waits on every thread into the given file (Chrome trace format, open with Perfetto)\n" \
+				"\t<--tune>                      --> measures the engine parameters (buffer, chunk and pipe sizes, huge pages, split threads) on this host and caches the best ones for later runs\n" \
+				"\t[--progress]                  --> prints bytes processed, throughput, ETA and the blocked stage to stderr once a second (send SIGUSR1 for a single snapshot, works without this flag too)\n" \
+				"\t[--io-thread]                 --> does all reading and writing on one thread that sleeps in epoll while it waits, instead of a spinning reader and flusher thread (Linux only)\n" \
+				"\t[--pin[=auto|<cpu,cpu,cpu>]]  --> pins the formatter, reader and flusher threads (in that order, the I/O thread takes the reader's place) to cpus that share a cache, picked from the topology by default (Linux only)\n" \
+				"\t[--memory-budget <bytes>]     --> caps the memory used for I/O and formatting buffers (default: 268435456, engines that don't fit fall back or fail) (Linux only)\n" \
 				"\t<language>                    --> specifies the source language\n" \
 			"\n" \
+			"engines (possible inputs for <engine> field):\n" \
+				"\tauto             (default) picks the fastest one that works with the given stdin and stdout\n" \
+				"\tsmall_input      requires stdin to be a regular file of at most 65536 bytes (one read, one write, no threads)\n" \
+				"\tmmap_vmsplice    requires stdin to be a regular file and stdout to be a pipe\n" \
+				"\tmmap_write       requires stdin to be a regular file\n" \
+				"\tread_vmsplice    requires stdout to be a pipe\n" \
+				"\tread_write       works everywhere\n" \
+			"\n" \
+			"split mode (requires stdin to be a regular file):\n" \
+				"\tthe parts are written (in parallel) to \"<variable name>_part_<index>.<c/cpp>\" in the working directory,\n" \
+				"\teach one holding an array called \"<variable name>_part_<index>\" in the \".srcembed\" section.\n" \
+				"\ta header declaring the parts, \"<variable name>_parts\", \"<variable name>_part_sizes\", \"<variable name>_part_count\",\n" \
+				"\t\"<variable name>\" (pointer to the first part) and \"<variable name>_size\" is output through stdout.\n" \
+				"\tthe parts are separate arrays, walk \"<variable name>_parts\" and \"<variable name>_part_sizes\" to read the data.\n" \
+				"\treading all of it through \"<variable name>\" reads past the end of the first part, which only works without LTO\n" \
+				"\tand with the part objects linked in order. it's a convenience for those builds only.\n" \
+				"\tthe parts are marked used and retain (where supported), so that --gc-sections doesn't drop the ones nothing refers to.\n" \
+			"\n" \
+			"placement (--align, --section):\n" \
+				"\ta \"<variable name>_size\" symbol is output after the array (constexpr std::size_t in C++, const size_t in C), holding the input size.\n" \
+				"\tthe section attribute comes with \"used\", so the array stays in the object file even if nothing refers to it.\n" \
+				"\tpage-aligned and padded (\"--align 4096 --pad\"), the array can be madvise()d or dropped from the page cache without affecting anything else.\n" \
+			"\n" \
+			"sparse mode (requires stdin to be a regular file):\n" \
+				"\tthe array gets an explicit size, so that the compiler fills in everything after the last non-zero byte with zeros.\n" \
+				"\tin C, zero runs of at least 16 bytes are skipped with designators (\"[<index>] = \"), C++ doesn't have those and keeps them.\n" \
+				"\tholes in the stdin file are found with SEEK_DATA/SEEK_HOLE and never read.\n" \
+			"\n" \
 			"supported languages (possible inputs for <language> field):\n" \
 				"\tc++\n" \
 				"\tc\n";
@@ -64,630 +113,828 @@ void writeErrorAndExit(const char (&message)[message_size], int exitCode) noexce
 
 #define REPORT_ERROR_AND_EXIT(message, exitCode) writeErrorAndExit("ERROR: " message "\n", exitCode)
 
-/*
-EPIPHANY:
-	- the second best way to transmit data is to have super big buffers and read, then write with those buffers (unless you've got splice and such)
-	- this'll save on syscalls, which is great.
-	- there'll be big gaps in between sends where you refill your buffer, but that doesn't matter because with smaller buffers, there might be smaller gaps, but there'll be more of them, so it equals out
-	- if the program after you is the bottleneck, your sends will take forever, but it doesn't matter because the speed of the write doesn't change anything about the gap equality law thing above.
-	- same thing with reads
-
-	- the absolute best way to make use of reads and writes is to double your buffer and read and write simultaeniously
-	- you'll always be reading and writing at the same time, double the speed
-
-	- if the goal is to make the buffers as big as possible within the constraints of your usage and system and such, that begs the question:
-		- what the hell is BUFSIZ for?
-			- Maybe that's just the recommended buffer size because they didn't want programs using too much RAM?
-			- I can't see any other reason since it offers no performance benefits apparently.
-			- TODO: Research this, maybe I've made a crucial mistake in my thought process.
-*/
+// NOTE: Used by all the flags that report something at exit.
+enum class report_format_t {
+	NONE,
+	TEXT,
+	JSON
+};
 
-#ifndef PLATFORM_WINDOWS
+namespace flags {
+	const char* varname = nullptr;
+	size_t split_count = 0;
+	size_t split_size = 0;
+	srcembed::engine_t engine = srcembed::engine_t::AUTO;
+	report_format_t stats_format = report_format_t::NONE;
+	report_format_t perf_counters_format = report_format_t::NONE;
+	const char* trace_path = nullptr;
+	bool progress = false;
+	bool tune = false;
+	bool io_thread = false;
+	bool pin = false;
+	int pin_cpus[3];		// formatter, reader (or I/O thread), flusher
+	size_t pin_cpu_count = 0;	// 0 means auto
+	size_t memory_budget = 0;		// 0 means arena::default_size
+	bool sparse = false;
+	size_t alignment = 0;		// 0 means no alignment attribute
+	const char* section = nullptr;
+	bool pad = false;
+}
 
-ssize_t mmap_write_double_buffer_simple(char*& bufferA, char*& bufferB, size_t bufferSize) noexcept {
-	bufferA = (char*)mmap(nullptr, bufferSize, PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	if (bufferA == MAP_FAILED) { return -1; }
+// Instrumentation for --stats:
+// NOTE: The engines fill in the report (see srcembed::report_t), the stream threads keep their own counters and embed() copies them over
+// once the streams are stopped. Anything that needs a clock read is only done if stats are enabled (asyncio::measure_wait_times).
+namespace stats {
+	std::chrono::steady_clock::time_point start_time;
 
-	bufferB = (char*)mmap(nullptr, bufferSize, PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	if (bufferB == MAP_FAILED) {
-		munmap(bufferA, bufferSize);
-		// NOTE: We don't handle error here because the program still has a chance at
-		// completing it's job even if the above call fails, we just end up leaking the memory.
-		return -1;
-	}
+	srcembed::report_t report;
 
-	return bufferSize;
+#ifndef PLATFORM_WINDOWS
+	// NOTE: The cpu every thread was on when we last looked (the stream threads right after they start, the formatter at the end), -1 if it never ran.
+	int thread_cpus[4] = { -1, -1, -1, -1 };
+#endif
 }
 
-ssize_t mmapWriteDoubleBuffer(char*& bufferA, char*& bufferB, size_t bufferSize) noexcept {
-	const size_t huge_page_size = parse_huge_page_size_from_meminfo_file();
-	if (huge_page_size <= 0) { return mmap_write_double_buffer_simple(bufferA, bufferB, bufferSize); }
-
-	// TODO: Consider picking the best huge page size for the job dynamically instead of just using the default one.
-
-	bufferA = (char*)mmap(nullptr, bufferSize, PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
-	if (bufferA == MAP_FAILED) { return mmap_write_double_buffer_simple(bufferA, bufferB, bufferSize); }
+#ifndef PLATFORM_WINDOWS
+// NOTE: count stays 0 if --pin isn't given (or auto placement decided against pinning).
+topology::placement_t thread_placement;
 
-	// Round up to nearest huge page boundary.
-	const size_t rounded_bufferSize = bufferSize + huge_page_size - (((bufferSize - 1) % huge_page_size) + 1);
-	// NOTE: Sadly, the above rounding mechanism seems to be as efficient as we can get it. I reckon assembly could do it faster, the compiler will almost definitely optimize if that's the case.
+// Everything embed() allocates comes out of the arena, see arena.h for why.
+const srcembed::allocator_t arenaAllocator = {
+	[](void*, size_t size, size_t alignment) noexcept { return arena::allocate(size, alignment); },
+	[](void*, void* memory, size_t size) noexcept { arena::deallocate(memory, size); }, nullptr };
 
-	bufferB = (char*)mmap(nullptr, rounded_bufferSize, PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
-	if (bufferB == MAP_FAILED) {
-		bufferB = (char*)mmap(nullptr, bufferSize, PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-		if (bufferB == MAP_FAILED) {
-			munmap(bufferA, rounded_bufferSize);
-			return -1;
-		}
-	}
+// NOTE: Static instead of out of the arena, so that the small_input engine stays one read and one write, without any setup in front of it.
+alignas(arena::cache_line_size) char smallInputScratch[srcembed::small_input_scratch_size];
+#endif
 
-	return rounded_bufferSize;
+// NOTE: Everything that comes from the tuning parameters, shared with the tuning runs (which try out other parameters than the loaded ones).
+void applyParameters(srcembed::options_t& options, const tuning::parameters_t& parameters) noexcept {
+	options.chunk_size = parameters.chunk_size;
+	options.stream_buffer_size = parameters.stream_buffer_size;
+	options.pipe_size = parameters.pipe_size;
+	options.split_thread_count = parameters.split_thread_count;
+#ifndef PLATFORM_WINDOWS
+	options.allocator = arenaAllocator;
+	options.scratch = smallInputScratch;
+#endif
 }
 
-const unsigned char* mmapStdinFile(size_t stdinFileSize) noexcept {
-	// NOTE: Can't see huge pages being beneficial here, so we're leaving them out.
-	unsigned char* stdinFileData = (unsigned char*)mmap(nullptr, stdinFileSize, PROT_READ, MAP_PRIVATE | MAP_NORESERVE | MAP_POPULATE, STDIN_FILENO, 0);
-	// NOTE: We don't handle errors on purpose, the caller handles those.
-
-	// NOTE: I'm pretty sure these don't overwrite each other, but just in case, I put the more important one second.
-	posix_madvise(stdinFileData, stdinFileSize, POSIX_MADV_WILLNEED);
-	posix_madvise(stdinFileData, stdinFileSize, POSIX_MADV_SEQUENTIAL);
-
-	return stdinFileData;
+// NOTE: Flags that weren't given leave the library's defaults in place, so this doesn't depend on anything manageArgs() fills in.
+srcembed::options_t embedOptions() noexcept {
+	srcembed::options_t options;
+	if (flags::varname != nullptr) { options.varname = flags::varname; }
+	options.alignment = flags::alignment;
+	options.section = flags::section;
+	options.pad_to_alignment = flags::pad;
+	options.engine = flags::engine;
+	options.sparse = flags::sparse;
+	options.split_count = flags::split_count;
+	options.split_size = flags::split_size;
+	options.io_thread = flags::io_thread;
+	applyParameters(options, tuning::parameters);
+#ifndef PLATFORM_WINDOWS
+	// NOTE: With --pin the formatter is already on one cpu, which is narrower than the node, so we leave its affinity alone then.
+	options.pin_to_input_node = !flags::pin;
+#endif
+	return options;
 }
 
-enum class DataTransferExitCode {
-	SUCCESS,
-	NEEDS_FALLBACK,
-	NEEDS_FALLBACK_FROM_MMAP,
-	NO_INPUT_DATA
-};
-
-template <size_t pattern_size>
-consteval size_t calculate_max_printf_write_length(const char (&pattern)[pattern_size]) {
-	size_t result = pattern_size - 1;
-	for (size_t i = 0; i < pattern_size; i++) {
-		if (pattern[i] == '%') { result++; }
+bool parse_size_arg(const char* arg, size_t& result) noexcept {
+	if (*arg == '\0') { return false; }
+	result = 0;
+	for (; *arg != '\0'; arg++) {
+		const unsigned char digit = (unsigned char)*arg - '0';
+		if (digit > 9) { return false; }
+		if (result > ((size_t)-1 - digit) / 10) { return false; }
+		result = result * 10 + digit;
 	}
-	return result;
+	return true;
 }
 
-// TODO: I can't find this anywhere online, are function parameters aligned to their natural alignment when they are passed (assuming they are passed on the stack)?
-template <const auto& initial_printf_pattern, const auto& printf_pattern, const auto& single_printf_pattern, unsigned char... chunk_indices>
-DataTransferExitCode dataMode_mmap_vmsplice(size_t stdinFileSize) noexcept {
-	constexpr size_t max_printf_write_length = calculate_max_printf_write_length(printf_pattern.data);
-	constexpr unsigned char bytes_per_chunk = sizeof...(chunk_indices);
-
-	int stdoutPipeBufferSize = fcntl(STDOUT_FILENO, F_GETPIPE_SZ);
-	if (stdoutPipeBufferSize == -1) { return DataTransferExitCode::NEEDS_FALLBACK; }
-
-	struct iovec stdoutBufferMemorySpan_entireLength;
-	stdoutBufferMemorySpan_entireLength.iov_len = stdoutPipeBufferSize;
-	struct iovec stdoutBufferMemorySpan;
-
-	// NOTE: We separate buffers to avoid cache contention.
-	/*
-	   It works like this as far as I understand at the moment:
-	   	- if we just did "char stdoutBuffers[stdoutPipeBufferSize * 2]", that wouldn't be as efficient since
-			the stack-frame itself isn't guaranteed to be aligned to a cacheline (it's alignment is standardized most of the time I think, but it depends on the architecture and defo isn't 64 bytes).
-			Even if it were, the previous variable declarations would mess it up anyway for us. Basically, what I'm saying is "stdoutBuffers" wouldn't be aligned to a cacheline most of the time.
-				- That would cause more cache lines to be used than necessary, but it would also cause one cacheline to straddle the junction between the two buffers, which is bad.
-				--> we give one buffer at a time to the kernel, which gets played with from a different thread I believe, so it wouldn't be uncommon that the straddling cacheline
-					is pulled into two different caches at the same time ---> CACHE CONTENTION!
-					--> Not good because now both threads have to do complex locking stuff just to avoid stepping on eachother's toes when writing to the cache line. At least that would be logical.
-
-		- obviously this would not be a concern if char was 64 bytes big (size of cache line, at least thats what I'm assuming for this example), since then the alignment would be forced, but it isn't.
-		- to avoid all this, we put two pointers on the stack and have mmap allocate our buffers for us. They will probably be right after one another in memory in the case of this program, but that doesn't matter.
-			--> the point is that they will be aligned to at least the cache boundaries (since they will both start at page starts, which are definitely sufficiently aligned)
-				--> this means efficient cache usage but ALSO THAT NO CACHELINES WILL STRADDLE THE BUFFERS, so we can rest easy.
-
-		// NOTE: I admit, we could have just had one pointer in this case and allocate everything with one mmap call, since that would probably still have aligned to cachlines properly.
-		// But I think this system is better anyway since if the user was ever stupid enough to make the buffers weird non-powers-of-two sizes, this would mitigate the damage by still preventing cache contention,
-		// whereas the one pointer method would not.
-		// I don't even know if the one pointer method would work since vmsplice might require page-aligned memory input or something.
-	*/
-	char* stdoutBuffers[2];
-
-	const ssize_t actual_pipe_buffer_size = mmapWriteDoubleBuffer(stdoutBuffers[0], stdoutBuffers[1], stdoutPipeBufferSize);
-	if (actual_pipe_buffer_size == -1) { return DataTransferExitCode::NEEDS_FALLBACK_FROM_MMAP; }
-
-	bool stdoutBufferToggle = false;
-	char* currentStdoutBuffer = stdoutBuffers[0];
-
-	char tempBuffer[max_printf_write_length * 2];
-	size_t tempBuffer_head = 0;
-	size_t tempBuffer_tail = 0;
-
-	const unsigned char* stdinFileData = mmapStdinFile(stdinFileSize);
-	if (stdinFileData == MAP_FAILED) { return DataTransferExitCode::NEEDS_FALLBACK_FROM_MMAP; }
-	size_t stdinFileDataCutoff = stdinFileSize - bytes_per_chunk;
-	size_t stdinFileDataPosition = 1;
-
-	int bytesWritten = meta_sprintf_no_terminator(currentStdoutBuffer, initial_printf_pattern.data, stdinFileData[0]);
-	if (bytesWritten == -1) { REPORT_ERROR_AND_EXIT("failed to process data: meta_sprintf_no_terminator failed", EXIT_FAILURE); }
-	size_t amountOfBufferFilled = bytesWritten;
-
-	while (true) {
-		while (amountOfBufferFilled <= stdoutPipeBufferSize - max_printf_write_length) {
-			if (stdinFileDataPosition > stdinFileDataCutoff) {
-				for (; stdinFileDataPosition < stdinFileSize; stdinFileDataPosition++) {
-					bytesWritten = meta_sprintf_no_terminator(currentStdoutBuffer + amountOfBufferFilled, single_printf_pattern.data, stdinFileData[stdinFileDataPosition]);
-					if (bytesWritten == -1) { REPORT_ERROR_AND_EXIT("failed to process data: meta_sprintf_no_terminator failed", EXIT_FAILURE); }
-					amountOfBufferFilled += bytesWritten;
-				}
-
-				tempBuffer_head = amountOfBufferFilled % pagesize;
-				stdoutBufferMemorySpan.iov_base = currentStdoutBuffer;
-				stdoutBufferMemorySpan.iov_len = amountOfBufferFilled - tempBuffer_head;
-				if (vmsplice(STDOUT_FILENO, &stdoutBufferMemorySpan, 1, SPLICE_F_GIFT) == -1) { REPORT_ERROR_AND_EXIT("failed to output to stdout: vmsplice failed", EXIT_FAILURE); }
-
-				if (!stdout_stream::write(currentStdoutBuffer + stdoutBufferMemorySpan.iov_len, tempBuffer_head)) {
-					REPORT_ERROR_AND_EXIT("failed to output to stdout: stdout_stream::write failed", EXIT_FAILURE);
-				}
-
-				if (munmap((unsigned char*)stdinFileData, stdinFileSize) == -1) { REPORT_ERROR_AND_EXIT("failed to munmap stdin file", EXIT_FAILURE); }
-				if (munmap((unsigned char*)stdoutBuffers[0], actual_pipe_buffer_size) == -1) { REPORT_ERROR_AND_EXIT("failed to munmap stdout buffer", EXIT_FAILURE); }
-				if (munmap((unsigned char*)stdoutBuffers[1], actual_pipe_buffer_size) == -1) { REPORT_ERROR_AND_EXIT("failed to munmap stdout buffer", EXIT_FAILURE); }
-
-				return DataTransferExitCode::SUCCESS;
-			}
-
-			bytesWritten = meta_sprintf_no_terminator(currentStdoutBuffer + amountOfBufferFilled, printf_pattern.data, stdinFileData[stdinFileDataPosition + chunk_indices]...);
-			if (bytesWritten == -1) { REPORT_ERROR_AND_EXIT("failed to process data: meta_sprintf_no_terminator failed", EXIT_FAILURE); }
-			stdinFileDataPosition += bytes_per_chunk;
-			amountOfBufferFilled += bytesWritten;
-		}
-
-		// NOTE: There is a possibility that changing all this code to work with more pointers instead of offsets into arrays would be better, but it looks fine to me right now.
-		// I don't reckon we would change that much by doing that, I'm betting it would be pretty much exactly as fast in this case.
-		// Anyway, I'm confident enough that I'm not going to try rewriting it with pointers in order to check my theory. That would be a pain if I'm being honest.
-
-		tempBuffer_tail = stdoutPipeBufferSize - amountOfBufferFilled;
-		for (tempBuffer_head = 0; tempBuffer_head < tempBuffer_tail;) {
-			if (stdinFileDataPosition > stdinFileDataCutoff) {
-				for (; stdinFileDataPosition < stdinFileSize; stdinFileDataPosition++) {
-					bytesWritten = meta_sprintf_no_terminator(tempBuffer + tempBuffer_head, single_printf_pattern.data, stdinFileData[stdinFileDataPosition]);
-					if (bytesWritten == -1) { REPORT_ERROR_AND_EXIT("failed to process data: meta_sprintf_no_terminator failed", EXIT_FAILURE); }
-					tempBuffer_head += bytesWritten;
-				}
-
-				if (tempBuffer_head <= tempBuffer_tail) {
-					std::memcpy(currentStdoutBuffer + amountOfBufferFilled, tempBuffer, tempBuffer_head);
-					amountOfBufferFilled += tempBuffer_head;
-
-					tempBuffer_head = amountOfBufferFilled % pagesize;
-					stdoutBufferMemorySpan.iov_base = currentStdoutBuffer;
-					stdoutBufferMemorySpan.iov_len = amountOfBufferFilled - tempBuffer_head;
-					if (vmsplice(STDOUT_FILENO, &stdoutBufferMemorySpan, 1, SPLICE_F_GIFT) == -1) {
-						REPORT_ERROR_AND_EXIT("failed to output to stdout: vmsplice failed", EXIT_FAILURE);
+int manageArgs(int argc, const char* const * argv) noexcept {
+	int normalArgIndex = 0;
+	for (int i = 1; i < argc; i++) {
+		if (argv[i][0] == '-') {
+			switch (argv[i][1]) {
+			case '-':
+				{
+					const char* flagContent = argv[i] + 2;
+					if (std::strcmp(flagContent, "varname") == 0) {
+						if (flags::varname != nullptr) {
+							REPORT_ERROR_AND_EXIT("more than one instance of \"--varname\" flag illegal", EXIT_SUCCESS);
+						}
+						i++;
+						if (i == argc) {
+							REPORT_ERROR_AND_EXIT("\"--varname\" flag requires a value", EXIT_SUCCESS);
+						}
+						flags::varname = argv[i];
+						continue;
 					}
-
-					if (!stdout_stream::write(currentStdoutBuffer + stdoutBufferMemorySpan.iov_len, tempBuffer_head)) {
-						REPORT_ERROR_AND_EXIT("failed to output to stdout: stdout_stream::write failed", EXIT_FAILURE);
+					if (std::strcmp(flagContent, "align") == 0) {
+						if (flags::alignment != 0) {
+							REPORT_ERROR_AND_EXIT("more than one instance of \"--align\" flag illegal", EXIT_SUCCESS);
+						}
+						i++;
+						if (i == argc) {
+							REPORT_ERROR_AND_EXIT("\"--align\" flag requires a value", EXIT_SUCCESS);
+						}
+						if (!parse_size_arg(argv[i], flags::alignment) || flags::alignment == 0 || (flags::alignment & (flags::alignment - 1)) != 0) {
+							REPORT_ERROR_AND_EXIT("\"--align\" flag value must be a power of two", EXIT_SUCCESS);
+						}
+						continue;
 					}
-
-					if (munmap((unsigned char*)stdinFileData, stdinFileSize) == -1) { REPORT_ERROR_AND_EXIT("failed to munmap stdin file", EXIT_FAILURE); }
-					if (munmap((unsigned char*)stdoutBuffers[0], actual_pipe_buffer_size) == -1) { REPORT_ERROR_AND_EXIT("failed to munmap stdout buffer", EXIT_FAILURE); }
-					if (munmap((unsigned char*)stdoutBuffers[1], actual_pipe_buffer_size) == -1) { REPORT_ERROR_AND_EXIT("failed to munmap stdout buffer", EXIT_FAILURE); }
-
-					return DataTransferExitCode::SUCCESS;
-				}
-
-				std::memcpy(currentStdoutBuffer + amountOfBufferFilled, tempBuffer, tempBuffer_tail);
-
-				stdoutBufferMemorySpan_entireLength.iov_base = currentStdoutBuffer;
-				if (vmsplice(STDOUT_FILENO, &stdoutBufferMemorySpan_entireLength, 1, SPLICE_F_GIFT) == -1) {
-					REPORT_ERROR_AND_EXIT("failed to output to stdout: vmsplice failed", EXIT_FAILURE);
-				}
-
-				if (munmap((unsigned char*)stdinFileData, stdinFileSize) == -1) { REPORT_ERROR_AND_EXIT("failed to munmap stdin file", EXIT_FAILURE); }
-				if (munmap((unsigned char*)stdoutBuffers[0], actual_pipe_buffer_size) == -1) { REPORT_ERROR_AND_EXIT("failed to munmap stdout buffer", EXIT_FAILURE); }
-				if (munmap((unsigned char*)stdoutBuffers[1], actual_pipe_buffer_size) == -1) { REPORT_ERROR_AND_EXIT("failed to munmap stdout buffer", EXIT_FAILURE); }
-
-				amountOfBufferFilled = tempBuffer_head - tempBuffer_tail;
-				if (!stdout_stream::write(tempBuffer + tempBuffer_tail, amountOfBufferFilled)) {
-					REPORT_ERROR_AND_EXIT("failed to output to stdout: stdout_stream::write failed", EXIT_FAILURE);
+					if (std::strcmp(flagContent, "section") == 0) {
+						if (flags::section != nullptr) {
+							REPORT_ERROR_AND_EXIT("more than one instance of \"--section\" flag illegal", EXIT_SUCCESS);
+						}
+						i++;
+						if (i == argc) {
+							REPORT_ERROR_AND_EXIT("\"--section\" flag requires a value", EXIT_SUCCESS);
+						}
+						flags::section = argv[i];
+						continue;
+					}
+					if (std::strcmp(flagContent, "pad") == 0) {
+#ifndef PLATFORM_WINDOWS
+						if (flags::pad) {
+							REPORT_ERROR_AND_EXIT("more than one instance of \"--pad\" flag illegal", EXIT_SUCCESS);
+						}
+						flags::pad = true;
+						continue;
+#else
+						REPORT_ERROR_AND_EXIT("\"--pad\" flag is not supported on Windows", EXIT_SUCCESS);
+#endif
+					}
+					if (std::strcmp(flagContent, "engine") == 0) {
+						if (flags::engine != srcembed::engine_t::AUTO) {
+							REPORT_ERROR_AND_EXIT("more than one instance of \"--engine\" flag illegal", EXIT_SUCCESS);
+						}
+						i++;
+						if (i == argc) {
+							REPORT_ERROR_AND_EXIT("\"--engine\" flag requires a value", EXIT_SUCCESS);
+						}
+						if (!srcembed::parse_engine(argv[i], flags::engine)) { REPORT_ERROR_AND_EXIT("invalid \"--engine\" flag value", EXIT_SUCCESS); }
+						continue;
+					}
+					if (std::strcmp(flagContent, "stats") == 0 || std::strcmp(flagContent, "stats=json") == 0) {
+						if (flags::stats_format != report_format_t::NONE) {
+							REPORT_ERROR_AND_EXIT("more than one instance of \"--stats\" flag illegal", EXIT_SUCCESS);
+						}
+						flags::stats_format = flagContent[5] == '\0' ? report_format_t::TEXT : report_format_t::JSON;
+						continue;
+					}
+					if (std::strcmp(flagContent, "perf-counters") == 0 || std::strcmp(flagContent, "perf-counters=json") == 0) {
+#ifndef PLATFORM_WINDOWS
+						if (flags::perf_counters_format != report_format_t::NONE) {
+							REPORT_ERROR_AND_EXIT("more than one instance of \"--perf-counters\" flag illegal", EXIT_SUCCESS);
+						}
+						flags::perf_counters_format = flagContent[13] == '\0' ? report_format_t::TEXT : report_format_t::JSON;
+						continue;
+#else
+						REPORT_ERROR_AND_EXIT("\"--perf-counters\" flag is not supported on Windows", EXIT_SUCCESS);
+#endif
+					}
+					if (std::strcmp(flagContent, "trace") == 0) {
+						if (flags::trace_path != nullptr) {
+							REPORT_ERROR_AND_EXIT("more than one instance of \"--trace\" flag illegal", EXIT_SUCCESS);
+						}
+						i++;
+						if (i == argc) {
+							REPORT_ERROR_AND_EXIT("\"--trace\" flag requires a value", EXIT_SUCCESS);
+						}
+						flags::trace_path = argv[i];
+						continue;
+					}
+					if (std::strcmp(flagContent, "progress") == 0) {
+#ifndef PLATFORM_WINDOWS
+						if (flags::progress) {
+							REPORT_ERROR_AND_EXIT("more than one instance of \"--progress\" flag illegal", EXIT_SUCCESS);
+						}
+						flags::progress = true;
+						continue;
+#else
+						REPORT_ERROR_AND_EXIT("\"--progress\" flag is not supported on Windows", EXIT_SUCCESS);
+#endif
+					}
+					if (std::strcmp(flagContent, "split") == 0) {
+						if (flags::split_count != 0 || flags::split_size != 0) {
+							REPORT_ERROR_AND_EXIT("more than one instance of \"--split\" or \"--split-size\" flags illegal", EXIT_SUCCESS);
+						}
+						i++;
+						if (i == argc) {
+							REPORT_ERROR_AND_EXIT("\"--split\" flag requires a value", EXIT_SUCCESS);
+						}
+						if (!parse_size_arg(argv[i], flags::split_count) || flags::split_count == 0) {
+							REPORT_ERROR_AND_EXIT("\"--split\" flag value must be a positive integer", EXIT_SUCCESS);
+						}
+						continue;
+					}
+					if (std::strcmp(flagContent, "split-size") == 0) {
+						if (flags::split_count != 0 || flags::split_size != 0) {
+							REPORT_ERROR_AND_EXIT("more than one instance of \"--split\" or \"--split-size\" flags illegal", EXIT_SUCCESS);
+						}
+						i++;
+						if (i == argc) {
+							REPORT_ERROR_AND_EXIT("\"--split-size\" flag requires a value", EXIT_SUCCESS);
+						}
+						if (!parse_size_arg(argv[i], flags::split_size) || flags::split_size == 0) {
+							REPORT_ERROR_AND_EXIT("\"--split-size\" flag value must be a positive integer", EXIT_SUCCESS);
+						}
+						continue;
+					}
+					if (std::strcmp(flagContent, "pin") == 0 || std::strncmp(flagContent, "pin=", 4) == 0) {
+#ifndef PLATFORM_WINDOWS
+						if (flags::pin) {
+							REPORT_ERROR_AND_EXIT("more than one instance of \"--pin\" flag illegal", EXIT_SUCCESS);
+						}
+						flags::pin = true;
+						if (flagContent[3] == '\0' || std::strcmp(flagContent + 4, "auto") == 0) { continue; }
+						for (const char* cpu = flagContent + 4; ; ) {
+							if (flags::pin_cpu_count == sizeof(flags::pin_cpus) / sizeof(int)) {
+								REPORT_ERROR_AND_EXIT("\"--pin\" flag takes at most three cpus (formatter, reader, flusher)", EXIT_SUCCESS);
+							}
+							char* end;
+							const unsigned long value = std::strtoul(cpu, &end, 10);
+							if (end == cpu || value >= CPU_SETSIZE || (*end != ',' && *end != '\0')) {
+								REPORT_ERROR_AND_EXIT("\"--pin\" flag value must be \"auto\" or a comma-separated list of cpu numbers", EXIT_SUCCESS);
+							}
+							flags::pin_cpus[flags::pin_cpu_count++] = value;
+							if (*end == '\0') { break; }
+							cpu = end + 1;
+						}
+						continue;
+#else
+						REPORT_ERROR_AND_EXIT("\"--pin\" flag is not supported on Windows", EXIT_SUCCESS);
+#endif
+					}
+					if (std::strcmp(flagContent, "io-thread") == 0) {
+#ifndef PLATFORM_WINDOWS
+						if (flags::io_thread) {
+							REPORT_ERROR_AND_EXIT("more than one instance of \"--io-thread\" flag illegal", EXIT_SUCCESS);
+						}
+						flags::io_thread = true;
+						continue;
+#else
+						REPORT_ERROR_AND_EXIT("\"--io-thread\" flag is not supported on Windows", EXIT_SUCCESS);
+#endif
+					}
+					if (std::strcmp(flagContent, "sparse") == 0) {
+#ifndef PLATFORM_WINDOWS
+						if (flags::sparse) {
+							REPORT_ERROR_AND_EXIT("more than one instance of \"--sparse\" flag illegal", EXIT_SUCCESS);
+						}
+						flags::sparse = true;
+						continue;
+#else
+						REPORT_ERROR_AND_EXIT("\"--sparse\" flag is not supported on Windows", EXIT_SUCCESS);
+#endif
+					}
+					if (std::strcmp(flagContent, "memory-budget") == 0) {
+#ifndef PLATFORM_WINDOWS
+						if (flags::memory_budget != 0) {
+							REPORT_ERROR_AND_EXIT("more than one instance of \"--memory-budget\" flag illegal", EXIT_SUCCESS);
+						}
+						i++;
+						if (i == argc) {
+							REPORT_ERROR_AND_EXIT("\"--memory-budget\" flag requires a value", EXIT_SUCCESS);
+						}
+						if (!parse_size_arg(argv[i], flags::memory_budget) || flags::memory_budget == 0) {
+							REPORT_ERROR_AND_EXIT("\"--memory-budget\" flag value must be a positive integer", EXIT_SUCCESS);
+						}
+						continue;
+#else
+						REPORT_ERROR_AND_EXIT("\"--memory-budget\" flag is not supported on Windows", EXIT_SUCCESS);
+#endif
+					}
+					if (std::strcmp(flagContent, "tune") == 0) {
+#ifndef PLATFORM_WINDOWS
+						if (argc != 2) { REPORT_ERROR_AND_EXIT("use of \"--tune\" flag with other args is illegal", EXIT_SUCCESS); }
+						flags::tune = true;
+						return 0;
+#else
+						REPORT_ERROR_AND_EXIT("\"--tune\" flag is not supported on Windows", EXIT_SUCCESS);
+#endif
+					}
+					if (std::strcmp(flagContent, "help") == 0) {
+						if (argc != 2) { REPORT_ERROR_AND_EXIT("use of \"--help\" flag with other args is illegal", EXIT_SUCCESS); }
+						if (crossplatform_write(STDOUT_FILENO, helpText, sizeof(helpText) - 1) == -1) {
+							REPORT_ERROR_AND_EXIT("failed to write to stdout", EXIT_FAILURE);
+						}
+						std::exit(EXIT_SUCCESS);
+					}
+					REPORT_ERROR_AND_EXIT("one or more invalid flags specified", EXIT_SUCCESS);
 				}
-
-				return DataTransferExitCode::SUCCESS;
+			default: REPORT_ERROR_AND_EXIT("one or more invalid flags specified", EXIT_SUCCESS);
 			}
-
-			bytesWritten = meta_sprintf_no_terminator(tempBuffer + tempBuffer_head, printf_pattern.data, stdinFileData[stdinFileDataPosition + chunk_indices]...);
-			if (bytesWritten == -1) { REPORT_ERROR_AND_EXIT("failed to process data: meta_sprintf_no_terminator failed", EXIT_FAILURE); }
-			stdinFileDataPosition += bytes_per_chunk;
-			tempBuffer_head += bytesWritten;
-		}
-
-		std::memcpy(currentStdoutBuffer + amountOfBufferFilled, tempBuffer, tempBuffer_tail);
-
-		stdoutBufferMemorySpan_entireLength.iov_base = currentStdoutBuffer;
-		// TODO: Future improvement possibility:
-		// You could have a separate thread and have it run vmsplice when signalled by this thread.
-		// By doing the vmsplice call asynchronously, this code doesn't have to wait for vmsplice to
-		// finish translating vm to physical mem. That would make everything a little bit faster presumably (at least in situations where the entity
-		// reading our stdout is less of a bottleneck than we are).
-		// You would just have to replace each vmsplice call with a call to a custom function, not that hard.
-		if (vmsplice(STDOUT_FILENO, &stdoutBufferMemorySpan_entireLength, 1, SPLICE_F_MORE) == -1) {
-			REPORT_ERROR_AND_EXIT("failed to output to stdout: vmsplice failed", EXIT_FAILURE);
 		}
-
-		currentStdoutBuffer = stdoutBuffers[stdoutBufferToggle = !stdoutBufferToggle];
-
-		amountOfBufferFilled = tempBuffer_head - tempBuffer_tail;
-		std::memcpy(currentStdoutBuffer, tempBuffer + tempBuffer_tail, amountOfBufferFilled);
+		if (normalArgIndex != 0) { REPORT_ERROR_AND_EXIT("too many non-flag args", EXIT_SUCCESS); }
+		normalArgIndex = i;
 	}
-}
-
-template <const auto& initial_printf_pattern, const auto& printf_pattern, const auto& single_printf_pattern, size_t... chunk_indices>
-bool dataMode_mmap_write(size_t stdinFileSize) noexcept {
-	constexpr unsigned char bytes_per_chunk = sizeof...(chunk_indices);
-
-	const unsigned char* stdinFileData = mmapStdinFile(stdinFileSize);
-	if (stdinFileData == MAP_FAILED) { return false; }
-
-	if (meta_printf_no_terminator(initial_printf_pattern.data, stdinFileData[0]) == -1) { REPORT_ERROR_AND_EXIT("failed to output to stdout: meta_printf_no_terminator failed", EXIT_FAILURE); }
-
-	size_t i;
-	for (i = 1; i < stdinFileSize + 1 - bytes_per_chunk; i += bytes_per_chunk) {
-		if (meta_printf_no_terminator(printf_pattern.data, stdinFileData[i + chunk_indices]...) == -1) {
-			REPORT_ERROR_AND_EXIT("failed to output to stdout: meta_printf_no_terminator failed", EXIT_FAILURE);
-		}
+	if (normalArgIndex == 0) { REPORT_ERROR_AND_EXIT("not enough non-flags args", EXIT_SUCCESS); }
+	if (flags::stats_format != report_format_t::NONE && (flags::split_count != 0 || flags::split_size != 0)) {
+		REPORT_ERROR_AND_EXIT("\"--stats\" flag isn't supported in split mode", EXIT_SUCCESS);
 	}
-	for (; i < stdinFileSize; i++) {
-		if (meta_printf_no_terminator(single_printf_pattern.data, stdinFileData[i]) == -1) {
-			REPORT_ERROR_AND_EXIT("failed to output to stdout: meta_printf_no_terminator failed", EXIT_FAILURE);
-		}
+	if (flags::perf_counters_format != report_format_t::NONE && (flags::split_count != 0 || flags::split_size != 0)) {
+		REPORT_ERROR_AND_EXIT("\"--perf-counters\" flag isn't supported in split mode", EXIT_SUCCESS);
 	}
-
-	if (munmap((unsigned char*)stdinFileData, stdinFileSize) == -1) { REPORT_ERROR_AND_EXIT("failed to munmap stdin file", EXIT_FAILURE); }
-
-	return true;
+	if (flags::trace_path != nullptr && (flags::split_count != 0 || flags::split_size != 0)) {
+		REPORT_ERROR_AND_EXIT("\"--trace\" flag isn't supported in split mode", EXIT_SUCCESS);
+	}
+	if (flags::progress && (flags::split_count != 0 || flags::split_size != 0)) {
+		REPORT_ERROR_AND_EXIT("\"--progress\" flag isn't supported in split mode", EXIT_SUCCESS);
+	}
+	if (flags::sparse && (flags::split_count != 0 || flags::split_size != 0)) {
+		REPORT_ERROR_AND_EXIT("\"--sparse\" flag isn't supported in split mode", EXIT_SUCCESS);
+	}
+	// NOTE: Sparse mode doesn't use any of the engines (or their threads), so there's nothing for these to pick or measure.
+	if (flags::sparse && flags::engine != srcembed::engine_t::AUTO) {
+		REPORT_ERROR_AND_EXIT("\"--engine\" flag isn't supported in sparse mode", EXIT_SUCCESS);
+	}
+	if (flags::sparse && flags::io_thread) {
+		REPORT_ERROR_AND_EXIT("\"--io-thread\" flag isn't supported in sparse mode", EXIT_SUCCESS);
+	}
+	if (flags::sparse && flags::stats_format != report_format_t::NONE) {
+		REPORT_ERROR_AND_EXIT("\"--stats\" flag isn't supported in sparse mode", EXIT_SUCCESS);
+	}
+	if (flags::sparse && flags::perf_counters_format != report_format_t::NONE) {
+		REPORT_ERROR_AND_EXIT("\"--perf-counters\" flag isn't supported in sparse mode", EXIT_SUCCESS);
+	}
+	// NOTE: Split mode doesn't use the engines either.
+	if (flags::engine != srcembed::engine_t::AUTO && (flags::split_count != 0 || flags::split_size != 0)) {
+		REPORT_ERROR_AND_EXIT("\"--engine\" flag isn't supported in split mode", EXIT_SUCCESS);
+	}
+	// NOTE: Split mode has its own alignment and section (see srcembed::write_split_part()).
+	if ((flags::alignment != 0 || flags::section != nullptr || flags::pad) && (flags::split_count != 0 || flags::split_size != 0)) {
+		REPORT_ERROR_AND_EXIT("\"--align\", \"--section\" and \"--pad\" flags aren't supported in split mode", EXIT_SUCCESS);
+	}
+	if (flags::pad && flags::alignment == 0) {
+		REPORT_ERROR_AND_EXIT("\"--pad\" flag requires \"--align\" flag", EXIT_SUCCESS);
+	}
+#ifdef PLATFORM_WINDOWS
+	if (flags::split_count != 0 || flags::split_size != 0) { REPORT_ERROR_AND_EXIT("split mode is not supported on Windows", EXIT_SUCCESS); }
+	if (flags::engine != srcembed::engine_t::AUTO && flags::engine != srcembed::engine_t::READ_WRITE) { REPORT_ERROR_AND_EXIT("forced engine is not supported on Windows", EXIT_SUCCESS); }
+#endif
+	// NOTE: Every other combination embed() would reject has been ruled out above, so this only ever trips over the section name.
+	if (!srcembed::valid_options(embedOptions())) {
+		REPORT_ERROR_AND_EXIT("\"--section\" flag value must be non-empty and can't contain quotes, backslashes or control characters", EXIT_SUCCESS);
+	}
+	return normalArgIndex;
 }
 
-template <const auto& initial_printf_pattern, const auto& printf_pattern, const auto& single_printf_pattern, unsigned char... chunk_indices>
-DataTransferExitCode dataMode_read_vmsplice() noexcept {
-	constexpr size_t max_printf_write_length = calculate_max_printf_write_length(printf_pattern.data);
-	constexpr unsigned char bytes_per_chunk = sizeof...(chunk_indices);
-
-	int stdoutPipeBufferSize = fcntl(STDOUT_FILENO, F_GETPIPE_SZ);
-	if (stdoutPipeBufferSize == -1) { return DataTransferExitCode::NEEDS_FALLBACK; }
-
-	struct iovec stdoutBufferMemorySpan_entireLength;
-	stdoutBufferMemorySpan_entireLength.iov_len = stdoutPipeBufferSize;
-	struct iovec stdoutBufferMemorySpan;
-
-	char* stdoutBuffers[2];
-
-	const ssize_t actual_pipe_buffer_size = mmapWriteDoubleBuffer(stdoutBuffers[0], stdoutBuffers[1], stdoutPipeBufferSize);
-	if (actual_pipe_buffer_size == -1) { return DataTransferExitCode::NEEDS_FALLBACK_FROM_MMAP; }
-
-	bool stdoutBufferToggle = false;
-	char* currentStdoutBuffer = stdoutBuffers[0];
-
-	char tempBuffer[max_printf_write_length * 2];
-	size_t tempBuffer_head = 0;
-	size_t tempBuffer_tail = 0;
-
-	char inputBuffer[bytes_per_chunk];
-	stdin_stream::data_ptr_return_t data_ptr = stdin_stream::get_data_ptr(inputBuffer, 1);
-	if (!data_ptr.data_ptr) { REPORT_ERROR_AND_EXIT("failed to read from stdin: stdin_stream::get_data_ptr failed", EXIT_FAILURE); }
-	if (data_ptr.size == 0) { return DataTransferExitCode::NO_INPUT_DATA; }
+// Maps what embed() returns to the messages the CLI has always printed. The same code can mean different things depending on the mode,
+// so the options decide which message it gets.
+void reportEmbedError(srcembed::error_code_t error, const srcembed::options_t& options) noexcept {
+	const bool split = options.split_count != 0 || options.split_size != 0;
+	const bool forcedSmallInput = options.engine == srcembed::engine_t::SMALL_INPUT;
+
+	switch (error) {
+	case srcembed::error_code_t::NONE: return;
+	case srcembed::error_code_t::INVALID_OPTIONS: REPORT_ERROR_AND_EXIT("failed to process data: invalid options", EXIT_FAILURE);
+	case srcembed::error_code_t::NO_DATA: REPORT_ERROR_AND_EXIT("no data received, language requires data", EXIT_FAILURE);
+	case srcembed::error_code_t::READ_FAILED: REPORT_ERROR_AND_EXIT("failed to read from stdin: read failed", EXIT_FAILURE);
+	case srcembed::error_code_t::WRITE_FAILED:
+	case srcembed::error_code_t::SINK_FULL: REPORT_ERROR_AND_EXIT("failed to output to stdout: write failed", EXIT_FAILURE);
+	case srcembed::error_code_t::NOT_A_REGULAR_FILE:
+		if (split) { REPORT_ERROR_AND_EXIT("split mode requires stdin to be a regular file", EXIT_FAILURE); }
+		if (options.sparse) { REPORT_ERROR_AND_EXIT("sparse mode requires stdin to be a regular file", EXIT_FAILURE); }
+		if (options.pad_to_alignment) { REPORT_ERROR_AND_EXIT("\"--pad\" flag requires stdin to be a regular file", EXIT_FAILURE); }
+		REPORT_ERROR_AND_EXIT("forced engine requires stdin to be a regular file", EXIT_FAILURE);
+	case srcembed::error_code_t::NOT_A_PIPE: REPORT_ERROR_AND_EXIT("forced engine requires stdout to be a pipe", EXIT_FAILURE);
+	case srcembed::error_code_t::INPUT_TOO_LARGE:
+		if (forcedSmallInput) { REPORT_ERROR_AND_EXIT("forced engine requires stdin to be at most 65536 bytes", EXIT_FAILURE); }
+		if (split) { REPORT_ERROR_AND_EXIT("stdin file too large to split", EXIT_FAILURE); }
+		if (options.sparse) { REPORT_ERROR_AND_EXIT("stdin file too large for sparse mode", EXIT_FAILURE); }
+		if (options.pad_to_alignment) { REPORT_ERROR_AND_EXIT("stdin file too large to pad", EXIT_FAILURE); }
+		REPORT_ERROR_AND_EXIT("forced engine failed: stdin file too large to mmap", EXIT_FAILURE);
+	case srcembed::error_code_t::INPUT_TOO_SMALL: REPORT_ERROR_AND_EXIT("split mode requires stdin to have at least 64 bytes per part (except for the last one)", EXIT_FAILURE);
+	case srcembed::error_code_t::MMAP_FAILED:
+		if (split) { REPORT_ERROR_AND_EXIT("failed to mmap stdin file", EXIT_FAILURE); }
+		REPORT_ERROR_AND_EXIT("forced engine failed: mmap failed", EXIT_FAILURE);
+	case srcembed::error_code_t::OUT_OF_MEMORY:
+#ifndef PLATFORM_WINDOWS
+		if (arena::map_failed) { REPORT_ERROR_AND_EXIT("failed to map buffer arena", EXIT_FAILURE); }
+#endif
+		REPORT_ERROR_AND_EXIT("failed to allocate buffers: memory budget exceeded", EXIT_FAILURE);
+	case srcembed::error_code_t::NAME_TOO_LONG:
+		if (split) { REPORT_ERROR_AND_EXIT("failed to create split part: variable name too long", EXIT_FAILURE); }
+		REPORT_ERROR_AND_EXIT("forced engine failed: variable or section name too long", EXIT_FAILURE);
+	case srcembed::error_code_t::PART_FAILED: REPORT_ERROR_AND_EXIT("failed to write split part: open, write or close failed", EXIT_FAILURE);
+	case srcembed::error_code_t::THREAD_FAILED: REPORT_ERROR_AND_EXIT("failed to start stream threads", EXIT_FAILURE);
+	}
+}
 
-	int bytesWritten = meta_sprintf_no_terminator(currentStdoutBuffer, initial_printf_pattern.data, (uint8_t)data_ptr.data_ptr[0]);
-	if (bytesWritten == -1) { REPORT_ERROR_AND_EXIT("failed to process data: meta_sprintf_no_terminator failed", EXIT_FAILURE); }
-	size_t amountOfBufferFilled = bytesWritten;
+// Embeds stdin into stdout, exits with the matching message if that fails.
+void runEmbed(const srcembed::options_t& options) noexcept {
+	// NOTE: tuning only ever picks one of the kernels' chunk sizes (tuning::chunk_size_candidates), but a cache file can be edited by hand.
+	if (srcembed::select_kernel(options.chunk_size) == nullptr) { REPORT_ERROR_AND_EXIT("invalid chunk size: no formatter kernel for it", EXIT_FAILURE); }
 
-	while (true) {
-		while (amountOfBufferFilled <= stdoutPipeBufferSize - max_printf_write_length) {
-			data_ptr = stdin_stream::get_data_ptr(inputBuffer, bytes_per_chunk);
-			if (!data_ptr.data_ptr) { REPORT_ERROR_AND_EXIT("failed to read from stdin: stdin_stream::get_data_ptr failed", EXIT_FAILURE); }
+	srcembed::sink_t sink(STDOUT_FILENO);
+	reportEmbedError(srcembed::embed(srcembed::input_t(STDIN_FILENO), sink, options, &stats::report), options);
+}
 
-			if (data_ptr.size < bytes_per_chunk) {
-				for (unsigned char i = 0; i < data_ptr.size; i++) {
-					bytesWritten = meta_sprintf_no_terminator(currentStdoutBuffer + amountOfBufferFilled, single_printf_pattern.data, (uint8_t)data_ptr.data_ptr[i]);
-					if (bytesWritten == -1) { REPORT_ERROR_AND_EXIT("failed to process data: meta_sprintf_no_terminator failed", EXIT_FAILURE); }
-					amountOfBufferFilled += bytesWritten;
-				}
+void outputSource(const char* language) noexcept {
+	srcembed::options_t options = embedOptions();
+	if (!srcembed::parse_language(language, options.language)) { REPORT_ERROR_AND_EXIT("invalid language", EXIT_SUCCESS); }
+	runEmbed(options);
+}
 
-				tempBuffer_head = amountOfBufferFilled % pagesize;
-				stdoutBufferMemorySpan.iov_base = currentStdoutBuffer;
-				stdoutBufferMemorySpan.iov_len = amountOfBufferFilled - tempBuffer_head;
-				if (vmsplice(STDOUT_FILENO, &stdoutBufferMemorySpan, 1, SPLICE_F_GIFT) == -1) { REPORT_ERROR_AND_EXIT("failed to output to stdout: vmsplice failed", EXIT_FAILURE); }
+#ifndef PLATFORM_WINDOWS
 
-				if (!stdout_stream::write(currentStdoutBuffer + stdoutBufferMemorySpan.iov_len, tempBuffer_head)) {
-					REPORT_ERROR_AND_EXIT("failed to output to stdout: stdout_stream::write failed", EXIT_FAILURE);
-				}
+// NOTE: Random bytes are the worst case for the formatter (lots of three digit numbers), which is what we want to be fast at.
+constexpr size_t tuning_input_size = 16 * 1024 * 1024;
+constexpr unsigned int tuning_repetitions = 3;
+constexpr size_t tuning_split_part_count = 64;
+// NOTE: The split scenario writes its parts under this name, and the cleanup removes them under the same name.
+constexpr const char* tuning_varname = "data";
+
+enum class tuning_scenario_t {
+	FILE_TO_PIPE,
+	READ_WRITE,
+	SPLIT
+};
 
-				if (munmap(stdoutBuffers[0], actual_pipe_buffer_size) == -1) { REPORT_ERROR_AND_EXIT("failed to munmap stdout buffer", EXIT_FAILURE); }
-				if (munmap(stdoutBuffers[1], actual_pipe_buffer_size) == -1) { REPORT_ERROR_AND_EXIT("failed to munmap stdout buffer", EXIT_FAILURE); }
+const char* const tuning_scenario_names[] = { "file to pipe", "read_write engine", "split mode" };
 
-				return DataTransferExitCode::SUCCESS;
-			}
+struct tuning_context_t {
+	int inputFd;
+	const char* splitDirectory;
+	char* drainBuffer;
+	size_t drainBufferSize;
+};
 
-			bytesWritten = meta_sprintf_no_terminator(currentStdoutBuffer + amountOfBufferFilled, printf_pattern.data, (uint8_t)data_ptr.data_ptr[chunk_indices]...);
-			if (bytesWritten == -1) { REPORT_ERROR_AND_EXIT("failed to process data: meta_sprintf_no_terminator failed", EXIT_FAILURE); }
-			amountOfBufferFilled += bytesWritten;
+// Converts the tuning input once with the given parameters and returns the wall time, or -1 if the run failed.
+// NOTE: Every run happens in a forked child, so that the streams, the engine state and the stats all start out fresh, just like in a real run.
+double time_tuning_run(const tuning::parameters_t& candidate, tuning_scenario_t scenario, const tuning_context_t& context) noexcept {
+	int outputPipe[2];
+	if (scenario != tuning_scenario_t::SPLIT && pipe(outputPipe) == -1) { return -1; }
+
+	const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	const pid_t child = fork();
+	if (child == -1) {
+		if (scenario != tuning_scenario_t::SPLIT) {
+			close(outputPipe[0]);
+			close(outputPipe[1]);
 		}
+		return -1;
+	}
 
-		tempBuffer_tail = stdoutPipeBufferSize - amountOfBufferFilled;
-		for (tempBuffer_head = 0; tempBuffer_head < tempBuffer_tail;) {
-			data_ptr = stdin_stream::get_data_ptr(inputBuffer, bytes_per_chunk);
-			if (!data_ptr.data_ptr) { REPORT_ERROR_AND_EXIT("failed to read from stdin: stdin_stream::get_data_ptr failed", EXIT_FAILURE); }
-
-			if (data_ptr.size < bytes_per_chunk) {
-				for (unsigned char i = 0; i < data_ptr.size; i++) {
-					bytesWritten = meta_sprintf_no_terminator(tempBuffer + tempBuffer_head, single_printf_pattern.data, (uint8_t)data_ptr.data_ptr[i]);
-					if (bytesWritten == -1) { REPORT_ERROR_AND_EXIT("failed to process data: meta_sprintf_no_terminator failed", EXIT_FAILURE); }
-					tempBuffer_head += bytesWritten;
-				}
-
-				if (tempBuffer_head <= tempBuffer_tail) {
-					std::memcpy(currentStdoutBuffer + amountOfBufferFilled, tempBuffer, tempBuffer_head);
-					amountOfBufferFilled += tempBuffer_head;
-
-					tempBuffer_head = amountOfBufferFilled % pagesize;
-					stdoutBufferMemorySpan.iov_base = currentStdoutBuffer;
-					stdoutBufferMemorySpan.iov_len = amountOfBufferFilled - tempBuffer_head;
-					if (vmsplice(STDOUT_FILENO, &stdoutBufferMemorySpan, 1, SPLICE_F_GIFT) == -1) {
-						REPORT_ERROR_AND_EXIT("failed to output to stdout: vmsplice failed", EXIT_FAILURE);
-					}
-
-					if (!stdout_stream::write(currentStdoutBuffer + stdoutBufferMemorySpan.iov_len, tempBuffer_head)) {
-						REPORT_ERROR_AND_EXIT("failed to output to stdout: stdout_stream::write failed", EXIT_FAILURE);
-					}
-
-					if (munmap(stdoutBuffers[0], actual_pipe_buffer_size) == -1) { REPORT_ERROR_AND_EXIT("failed to munmap stdout buffer", EXIT_FAILURE); }
-					if (munmap(stdoutBuffers[1], actual_pipe_buffer_size) == -1) { REPORT_ERROR_AND_EXIT("failed to munmap stdout buffer", EXIT_FAILURE); }
-
-					return DataTransferExitCode::SUCCESS;
-				}
-
-				std::memcpy(currentStdoutBuffer + amountOfBufferFilled, tempBuffer, tempBuffer_tail);
-
-				stdoutBufferMemorySpan_entireLength.iov_base = currentStdoutBuffer;
-				if (vmsplice(STDOUT_FILENO, &stdoutBufferMemorySpan_entireLength, 1, SPLICE_F_GIFT) == -1) {
-					REPORT_ERROR_AND_EXIT("failed to output to stdout: vmsplice failed", EXIT_FAILURE);
-				}
+	if (child == 0) {
+		// NOTE: Built from scratch instead of from the flags, --tune doesn't take any others.
+		srcembed::options_t options;
+		options.varname = tuning_varname;
+		options.language = srcembed::language_t::C;
+		applyParameters(options, candidate);
+
+		if (dup2(context.inputFd, STDIN_FILENO) == -1 || lseek(STDIN_FILENO, 0, SEEK_SET) == -1) { _exit(EXIT_FAILURE); }
+		if (scenario == tuning_scenario_t::SPLIT) {
+			const int nullFd = open("/dev/null", O_WRONLY);
+			if (nullFd == -1 || dup2(nullFd, STDOUT_FILENO) == -1 || chdir(context.splitDirectory) == -1) { _exit(EXIT_FAILURE); }
+			options.split_count = tuning_split_part_count;
+		} else {
+			if (dup2(outputPipe[1], STDOUT_FILENO) == -1) { _exit(EXIT_FAILURE); }
+			close(outputPipe[0]);
+			close(outputPipe[1]);
+			if (scenario == tuning_scenario_t::READ_WRITE) { options.engine = srcembed::engine_t::READ_WRITE; }
+		}
 
-				// NOTE: munmap after SPLICE_F_GIFT is okay, don't worry.
-				if (munmap(stdoutBuffers[0], actual_pipe_buffer_size) == -1) { REPORT_ERROR_AND_EXIT("failed to munmap stdout buffer", EXIT_FAILURE); }
-				if (munmap(stdoutBuffers[1], actual_pipe_buffer_size) == -1) { REPORT_ERROR_AND_EXIT("failed to munmap stdout buffer", EXIT_FAILURE); }
+		arena::configure(arena::default_size, candidate.huge_pages);
+		runEmbed(options);
+		_exit(EXIT_SUCCESS);
+	}
 
-				amountOfBufferFilled = tempBuffer_head - tempBuffer_tail;
-				if (!stdout_stream::write(tempBuffer + tempBuffer_tail, amountOfBufferFilled)) {
-					REPORT_ERROR_AND_EXIT("failed to output to stdout: stdout_stream::write failed", EXIT_FAILURE);
-				}
+	if (scenario != tuning_scenario_t::SPLIT) {
+		close(outputPipe[1]);
+		while (read(outputPipe[0], context.drainBuffer, context.drainBufferSize) > 0) { }
+		close(outputPipe[0]);
+	}
 
-				return DataTransferExitCode::SUCCESS;
-			}
+	int status;
+	if (waitpid(child, &status, 0) == -1) { return -1; }
+	const double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS ? elapsedSeconds : -1;
+}
 
-			bytesWritten = meta_sprintf_no_terminator(tempBuffer + tempBuffer_head, printf_pattern.data, (uint8_t)data_ptr.data_ptr[chunk_indices]...);
-			if (bytesWritten == -1) { REPORT_ERROR_AND_EXIT("failed to process data: meta_sprintf_no_terminator failed", EXIT_FAILURE); }
-			tempBuffer_head += bytesWritten;
+// Tries every candidate value for one parameter (keeping all the others at their best values so far) and keeps the fastest.
+// NOTE: This is a coordinate descent, not a full search. The parameters are mostly independent of each other,
+// and a full search would multiply the run time by the size of every candidate list.
+template <typename setter_t>
+void tune_parameter(const char* name, const size_t* candidates, size_t candidateCount, setter_t setter,
+		    tuning_scenario_t scenario, const tuning_context_t& context, tuning::parameters_t& best) noexcept {
+	double bestSeconds = -1;
+	size_t bestCandidate = 0;
+	for (size_t i = 0; i < candidateCount; i++) {
+		tuning::parameters_t candidate = best;
+		setter(candidate, candidates[i]);
+
+		double candidateSeconds = -1;
+		for (unsigned int j = 0; j < tuning_repetitions; j++) {
+			const double runSeconds = time_tuning_run(candidate, scenario, context);
+			if (runSeconds < 0) { candidateSeconds = -1; break; }
+			if (candidateSeconds < 0 || runSeconds < candidateSeconds) { candidateSeconds = runSeconds; }
+			// NOTE: A candidate that's this far behind isn't going to win, repeating it would only make --tune take longer.
+			if (bestSeconds >= 0 && candidateSeconds > bestSeconds * 2) { break; }
 		}
 
-		std::memcpy(currentStdoutBuffer + amountOfBufferFilled, tempBuffer, tempBuffer_tail);
-
-		stdoutBufferMemorySpan_entireLength.iov_base = currentStdoutBuffer;
-		if (vmsplice(STDOUT_FILENO, &stdoutBufferMemorySpan_entireLength, 1, SPLICE_F_MORE) == -1) {
-			REPORT_ERROR_AND_EXIT("failed to output to stdout: vmsplice failed", EXIT_FAILURE);
+		if (candidateSeconds < 0) { std::fprintf(stderr, "tune: %s=%zu (%s): failed\n", name, candidates[i], tuning_scenario_names[(int)scenario]); continue; }
+		std::fprintf(stderr, "tune: %s=%zu (%s): %.4f s\n", name, candidates[i], tuning_scenario_names[(int)scenario], candidateSeconds);
+		if (bestSeconds < 0 || candidateSeconds < bestSeconds) {
+			bestSeconds = candidateSeconds;
+			bestCandidate = candidates[i];
 		}
-
-		currentStdoutBuffer = stdoutBuffers[stdoutBufferToggle = !stdoutBufferToggle];
-
-		amountOfBufferFilled = tempBuffer_head - tempBuffer_tail;
-		std::memcpy(currentStdoutBuffer, tempBuffer + tempBuffer_tail, amountOfBufferFilled);
 	}
+	if (bestSeconds < 0) { REPORT_ERROR_AND_EXIT("tuning failed: every candidate failed", EXIT_FAILURE); }
+	setter(best, bestCandidate);
 }
 
-#endif
-
-template <const auto& initial_printf_pattern, const auto& printf_pattern, const auto& single_printf_pattern, unsigned char... chunk_indices>
-bool dataMode_read_write() noexcept {
-	constexpr unsigned char bytes_per_chunk = sizeof...(chunk_indices);
-
-#ifndef PLATFORM_WINDOWS
-	if (posix_fadvise(STDIN_FILENO, 0, 0, POSIX_FADV_NOREUSE) == 0) {
-		if (posix_fadvise(STDIN_FILENO, 0, 0, POSIX_FADV_WILLNEED) == 0) {
-			posix_fadvise(STDIN_FILENO, 0, 0, POSIX_FADV_SEQUENTIAL);
+void run_tuning() noexcept {
+	const int inputFd = memfd_create("srcembed-tune", 0);
+	if (inputFd == -1) { REPORT_ERROR_AND_EXIT("failed to create tuning input: memfd_create failed", EXIT_FAILURE); }
+
+	tuning_context_t context;
+	context.inputFd = inputFd;
+	context.drainBufferSize = 1024 * 1024;
+	context.drainBuffer = (char*)std::malloc(context.drainBufferSize);
+	if (context.drainBuffer == nullptr) { REPORT_ERROR_AND_EXIT("failed to allocate tuning buffer", EXIT_FAILURE); }
+
+	uint64_t randomState = 0x9e3779b97f4a7c15;
+	for (size_t written = 0; written < tuning_input_size; written += context.drainBufferSize) {
+		for (size_t i = 0; i < context.drainBufferSize; i += sizeof(uint64_t)) {
+			randomState ^= randomState << 13;
+			randomState ^= randomState >> 7;
+			randomState ^= randomState << 17;
+			std::memcpy(context.drainBuffer + i, &randomState, sizeof(uint64_t));
 		}
+		if (!write_entire_buffer(inputFd, context.drainBuffer, context.drainBufferSize)) { REPORT_ERROR_AND_EXIT("failed to create tuning input: write failed", EXIT_FAILURE); }
 	}
-#endif
 
-	char buffer[bytes_per_chunk];
+	const char* temporaryDirectory = std::getenv("TMPDIR");
+	char splitDirectory[4096];
+	const int splitDirectoryLength = std::snprintf(splitDirectory, sizeof(splitDirectory), "%s/srcembed-tune-XXXXXX", temporaryDirectory != nullptr && temporaryDirectory[0] != '\0' ? temporaryDirectory : "/tmp");
+	if (splitDirectoryLength < 0 || (size_t)splitDirectoryLength >= sizeof(splitDirectory) || mkdtemp(splitDirectory) == nullptr) {
+		REPORT_ERROR_AND_EXIT("failed to create tuning directory: mkdtemp failed", EXIT_FAILURE);
+	}
+	context.splitDirectory = splitDirectory;
 
-	stdin_stream::data_ptr_return_t data_ptr = stdin_stream::get_data_ptr(buffer, 1);
-	if (!data_ptr.data_ptr) { REPORT_ERROR_AND_EXIT("failed to read from stdin: stdin_stream:get_data_ptr failed", EXIT_FAILURE); }
-	if (data_ptr.size == 0) { return false; }
+	tuning::parameters_t best = tuning::default_parameters;
 
-	if (meta_printf_no_terminator(initial_printf_pattern.data, (unsigned char)data_ptr.data_ptr[0]) == -1) { REPORT_ERROR_AND_EXIT("failed to output to stdout: meta_printf_no_terminator failed", EXIT_FAILURE); }
+	tune_parameter("chunk_size", tuning::chunk_size_candidates, sizeof(tuning::chunk_size_candidates) / sizeof(size_t),
+		       [](tuning::parameters_t& parameters, size_t value) { parameters.chunk_size = value; }, tuning_scenario_t::FILE_TO_PIPE, context, best);
 
-	while (true) {
-		stdin_stream::data_ptr_return_t data_ptr = stdin_stream::get_data_ptr(buffer, bytes_per_chunk);
+	const size_t hugePagesCandidates[] = { 1, 0 };
+	tune_parameter("huge_pages", hugePagesCandidates, sizeof(hugePagesCandidates) / sizeof(size_t),
+		       [](tuning::parameters_t& parameters, size_t value) { parameters.huge_pages = value; }, tuning_scenario_t::FILE_TO_PIPE, context, best);
 
-		if (data_ptr.size == bytes_per_chunk) {
-			if (meta_printf_no_terminator(printf_pattern.data, (unsigned char)data_ptr.data_ptr[chunk_indices]...) == -1) {
-				REPORT_ERROR_AND_EXIT("failed to output to stdout: meta_printf_no_terminator failed", EXIT_FAILURE);
-			}
-			continue;
-		}
+	tune_parameter("pipe_size", tuning::pipe_size_candidates, sizeof(tuning::pipe_size_candidates) / sizeof(size_t),
+		       [](tuning::parameters_t& parameters, size_t value) { parameters.pipe_size = value; }, tuning_scenario_t::FILE_TO_PIPE, context, best);
 
-		if (!data_ptr.data_ptr) {
-			REPORT_ERROR_AND_EXIT("failed to read from stdin: stdin_stream:get_data_ptr failed", EXIT_FAILURE);
-		}
+	tune_parameter("stream_buffer_size", tuning::stream_buffer_size_candidates, sizeof(tuning::stream_buffer_size_candidates) / sizeof(size_t),
+		       [](tuning::parameters_t& parameters, size_t value) { parameters.stream_buffer_size = value; }, tuning_scenario_t::READ_WRITE, context, best);
 
-		for (unsigned char i = 0; i < data_ptr.size; i++) {
-			if (meta_printf_no_terminator(single_printf_pattern.data, (unsigned char)data_ptr.data_ptr[i]) == -1) {
-				REPORT_ERROR_AND_EXIT("failed to output to stdout: meta_printf_no_terminator failed", EXIT_FAILURE);
-			}
-		}
+	// NOTE: Powers of two up to the core count, plus the core count itself.
+	const size_t coreCount = std::min(capabilities::core_count(), srcembed::max_split_thread_count);
+	size_t threadCountCandidates[32];
+	size_t threadCountCandidateCount = 0;
+	for (size_t threadCount = 1; threadCount < coreCount; threadCount *= 2) { threadCountCandidates[threadCountCandidateCount++] = threadCount; }
+	threadCountCandidates[threadCountCandidateCount++] = coreCount;
+	tune_parameter("split_thread_count", threadCountCandidates, threadCountCandidateCount,
+		       [](tuning::parameters_t& parameters, size_t value) { parameters.split_thread_count = value; }, tuning_scenario_t::SPLIT, context, best);
 
-		return true;
+	// NOTE: Failing to clean up doesn't invalidate the measurements, so it's only reported. A part that isn't there was never written.
+	for (size_t i = 0; i < tuning_split_part_count; i++) {
+		char partPath[4096 + 64];
+		std::snprintf(partPath, sizeof(partPath), "%s/%s_part_%zu.c", splitDirectory, tuning_varname, i);
+		if (unlink(partPath) == -1 && errno != ENOENT) { std::fprintf(stderr, "tune: failed to remove %s: %s\n", partPath, std::strerror(errno)); }
 	}
+	if (rmdir(splitDirectory) == -1) { std::fprintf(stderr, "tune: failed to remove %s: %s\n", splitDirectory, std::strerror(errno)); }
+	close(inputFd);
+	std::free(context.drainBuffer);
+
+	char cachePath[4096];
+	if (!tuning::save(best, cachePath, sizeof(cachePath))) { REPORT_ERROR_AND_EXIT("failed to write tuning cache", EXIT_FAILURE); }
+	std::fprintf(stderr, "tune: stream_buffer_size=%zu chunk_size=%zu pipe_size=%zu huge_pages=%u split_thread_count=%zu\ntune: saved to %s\n",
+		     best.stream_buffer_size, best.chunk_size, best.pipe_size, (unsigned int)best.huge_pages, best.split_thread_count, cachePath);
 }
 
-template <const auto& initial_printf_pattern, const auto& printf_pattern, const auto& single_printf_pattern, unsigned char... chunk_indices>
-bool optimizedDataTransformationAndOutput_raw() noexcept {
-	static_assert(sizeof...(chunk_indices) != 0, "parameter pack \"chunk_indices\" must contain at least 1 element");
-	static_assert(sizeof...(chunk_indices) < 256, "parameter pack \"chunk_indices\" must contain less than 256 elements");
+#endif
 
-#ifndef PLATFORM_WINDOWS
+// NOTE: The formatter (the main thread) comes first, then the stream threads, in the order of asyncio::stream_thread_t.
+const char* const thread_names[] = { "formatter", "reader", "flusher", "io" };
+constexpr size_t thread_count = sizeof(thread_names) / sizeof(const char*);
 
-	struct stat statusA;
-	if (fstat(STDIN_FILENO, &statusA) == 0) {
-		if (S_ISREG(statusA.st_mode)) {
-			struct stat statusB;
-			if (fstat(STDOUT_FILENO, &statusB) == 0) {
-				if (S_ISFIFO(statusB.st_mode)) {
-					if (statusA.st_size == 0) { return false; }
-					if (sizeof(size_t) >= sizeof(off_t) || statusA.st_size <= (size_t)-1) {
-						switch (dataMode_mmap_vmsplice<initial_printf_pattern, printf_pattern, single_printf_pattern, chunk_indices...>(statusA.st_size)) {
-						case DataTransferExitCode::SUCCESS: return true;
-						case DataTransferExitCode::NEEDS_FALLBACK_FROM_MMAP: goto use_data_mode_read_vmsplice;
-						case DataTransferExitCode::NEEDS_FALLBACK: break;
-						}
-					}
-				}
-			}
+void print_stats() noexcept {
+	const double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - stats::start_time).count();
 
-			if (statusA.st_size == 0) { return false; }
-			// NOTE: If size_t is 32-bit and linux large file extention is enabled (off_t is 64-bit),
-			// only allow mmapping if file length can fit into size_t.
-			if (sizeof(size_t) >= sizeof(off_t) && statusA.st_size <= (size_t)-1) {
-				if (dataMode_mmap_write<initial_printf_pattern, printf_pattern, single_printf_pattern, chunk_indices...>(statusA.st_size)) { return true; }
-			}
+	const srcembed::report_t& report = stats::report;
+	const double throughput = elapsedSeconds == 0 ? 0 : report.input_bytes / elapsedSeconds / (1024 * 1024);
+	const double blockedOnOutputSeconds = report.vmsplice_seconds + report.producer_wait_seconds;
+#ifndef PLATFORM_WINDOWS
+	stats::thread_cpus[0] = sched_getcpu();
+#endif
 
-			return dataMode_read_write<initial_printf_pattern, printf_pattern, single_printf_pattern, chunk_indices...>();
+	if (flags::stats_format == report_format_t::JSON) {
+		std::fprintf(stderr, "{\"engine\":\"%s\",\"engine_forced\":%s,\"fallbacks\":[", srcembed::engine_names[(int)report.engine], report.engine_forced ? "true" : "false");
+		for (unsigned char i = 0; i < report.fallback_count; i++) {
+			std::fprintf(stderr, "%s{\"engine\":\"%s\",\"reason\":\"%s\"}", i == 0 ? "" : ",", srcembed::engine_names[(int)report.fallbacks[i].engine], report.fallbacks[i].reason);
 		}
+		std::fprintf(stderr, "],\"input_bytes\":%zu,\"output_bytes\":%zu,\"elapsed_seconds\":%.6f,\"input_throughput_mib_per_second\":%.2f," \
+				     "\"read_syscalls\":%zu,\"write_syscalls\":%zu,\"vmsplice_syscalls\":%zu,\"temp_buffer_spill_bytes\":%zu," \
+				     "\"blocked_on_output_seconds\":%.6f,\"waiting_for_input_seconds\":%.6f,\"reader_thread_waiting_seconds\":%.6f,\"flusher_thread_waiting_seconds\":%.6f," \
+				     "\"tuning\":{\"from_cache\":%s,\"stream_buffer_size\":%zu,\"chunk_size\":%zu,\"pipe_size\":%zu,\"huge_pages\":%s,\"split_thread_count\":%zu}",
+			     report.input_bytes, report.output_bytes, elapsedSeconds, throughput,
+			     report.read_syscall_count, report.write_syscall_count, report.vmsplice_syscall_count, report.temp_buffer_spill_bytes,
+			     blockedOnOutputSeconds, report.consumer_wait_seconds, report.reader_wait_seconds, report.flusher_wait_seconds,
+			     tuning::loaded_from_cache ? "true" : "false", tuning::parameters.stream_buffer_size, tuning::parameters.chunk_size, tuning::parameters.pipe_size,
+			     tuning::parameters.huge_pages ? "true" : "false", tuning::parameters.split_thread_count);
+		std::fprintf(stderr, ",\"handoff_latency_us\":{\"to_reader\":%.3f,\"to_formatter_from_reader\":%.3f,\"to_flusher\":%.3f,\"to_formatter_from_flusher\":%.3f}",
+			     report.reader_handoff_seconds * 1000000, report.consumer_handoff_seconds * 1000000,
+			     report.flusher_handoff_seconds * 1000000, report.producer_handoff_seconds * 1000000);
+#ifndef PLATFORM_WINDOWS
+		std::fprintf(stderr, ",\"placement\":{\"pinned\":%s,\"shared_cache_level\":%u,\"cpus\":{", thread_placement.count != 0 ? "true" : "false", (unsigned int)thread_placement.shared_cache_level);
+		for (size_t i = 0; i < thread_count; i++) { std::fprintf(stderr, "%s\"%s\":%d", i == 0 ? "" : ",", thread_names[i], stats::thread_cpus[i]); }
+		std::fputs("}}", stderr);
+		std::fprintf(stderr, ",\"arena\":{\"size\":%zu,\"used\":%zu,\"huge_page_advised_size\":%zu,\"huge_page_backed_bytes\":%zu}",
+			     arena::size, arena::peak_used.load(std::memory_order_relaxed), arena::huge_page_advised_size, arena::huge_page_backed_bytes());
+		std::fprintf(stderr, ",\"capabilities\":{\"page_size\":%ld,\"huge_page_size\":%zu,\"thp_mode\":\"%s\",\"pipe_max_size\":%zu,\"io_uring\":%s," \
+				     "\"cpu_features\":%u,\"core_count\":%zu,\"numa_node_count\":%d,\"cgroup_memory_limit\":%zu}",
+			     capabilities::page_size(), capabilities::huge_page_size(), capabilities::thp_mode_names[(int)capabilities::thp_mode()], capabilities::pipe_max_size(),
+			     capabilities::io_uring_available() ? "true" : "false", capabilities::cpu_features(), capabilities::core_count(), topology::numa_node_count(), capabilities::cgroup_memory_limit());
+#endif
+		std::fputs("}\n", stderr);
+		return;
 	}
 
-	if (fstat(STDOUT_FILENO, &statusA) == 0) {
-		if (S_ISFIFO(statusA.st_mode)) {
-use_data_mode_read_vmsplice:
-			switch (dataMode_read_vmsplice<initial_printf_pattern, printf_pattern, single_printf_pattern, chunk_indices...>()) {
-			case DataTransferExitCode::SUCCESS: return true;
-			case DataTransferExitCode::NO_INPUT_DATA: return false;
-			case DataTransferExitCode::NEEDS_FALLBACK_FROM_MMAP: case DataTransferExitCode::NEEDS_FALLBACK: break;
-			}
-		}
+	std::fprintf(stderr, "srcembed stats:\n\tengine:                    %s%s\n", srcembed::engine_names[(int)report.engine], report.engine_forced ? " (forced)" : "");
+	for (unsigned char i = 0; i < report.fallback_count; i++) {
+		std::fprintf(stderr, "\tskipped engine:            %s (%s)\n", srcembed::engine_names[(int)report.fallbacks[i].engine], report.fallbacks[i].reason);
 	}
-
+	std::fprintf(stderr, "\tinput bytes:               %zu\n" \
+			     "\toutput bytes:              %zu\n" \
+			     "\telapsed:                   %.6f s\n" \
+			     "\tinput throughput:          %.2f MiB/s\n" \
+			     "\tread syscalls:             %zu\n" \
+			     "\twrite syscalls:            %zu\n" \
+			     "\tvmsplice syscalls:         %zu\n" \
+			     "\ttemp buffer spill bytes:   %zu\n" \
+			     "\tblocked on output:         %.6f s\n" \
+			     "\twaiting for input:         %.6f s\n" \
+			     "\treader thread waiting:     %.6f s\n" \
+			     "\tflusher thread waiting:    %.6f s\n",
+		     report.input_bytes, report.output_bytes, elapsedSeconds, throughput,
+		     report.read_syscall_count, report.write_syscall_count, report.vmsplice_syscall_count, report.temp_buffer_spill_bytes,
+		     blockedOnOutputSeconds, report.consumer_wait_seconds, report.reader_wait_seconds, report.flusher_wait_seconds);
+	// NOTE: Average time from one thread handing a buffer over to the waiting thread noticing (only counts handovers somebody was waiting for).
+	std::fprintf(stderr, "\thandoff latency:           to reader %.3f us, reader to formatter %.3f us, to flusher %.3f us, flusher to formatter %.3f us\n",
+		     report.reader_handoff_seconds * 1000000, report.consumer_handoff_seconds * 1000000,
+		     report.flusher_handoff_seconds * 1000000, report.producer_handoff_seconds * 1000000);
+#ifndef PLATFORM_WINDOWS
+	std::fprintf(stderr, "\tplacement:                 ");
+	if (thread_placement.count == 0) { std::fputs("not pinned", stderr); }
+	else if (thread_placement.shared_cache_level == 0) { std::fputs("pinned, no shared cache", stderr); }
+	else { std::fprintf(stderr, "pinned, shared L%u", (unsigned int)thread_placement.shared_cache_level); }
+	for (size_t i = 0; i < thread_count; i++) {
+		if (stats::thread_cpus[i] != -1) { std::fprintf(stderr, ", %s on cpu %d", thread_names[i], stats::thread_cpus[i]); }
+	}
+	std::fputc('\n', stderr);
+	std::fprintf(stderr, "\tarena:                     %zu of %zu bytes used at peak, ", arena::peak_used.load(std::memory_order_relaxed), arena::size);
+	if (arena::base == nullptr) { std::fputs("never mapped\n", stderr); }
+	else if (arena::huge_page_advised_size == 0) { std::fputs("small pages\n", stderr); }
+	else { std::fprintf(stderr, "huge pages requested (%zu byte pages), %zu bytes backed by huge pages\n", arena::huge_page_advised_size, arena::huge_page_backed_bytes()); }
+#endif
+	std::fprintf(stderr, "\ttuning:                    %s (stream buffer %zu, chunk %zu, pipe %zu, huge pages %s)\n",
+		     tuning::loaded_from_cache ? "from cache" : "defaults", tuning::parameters.stream_buffer_size, tuning::parameters.chunk_size, tuning::parameters.pipe_size,
+		     tuning::parameters.huge_pages ? "on" : "off");
+#ifndef PLATFORM_WINDOWS
+	// NOTE: This probes everything, which is fine since nobody is timing the run at this point anymore.
+	std::fprintf(stderr, "\tcapabilities:              page size %ld, huge page size %zu, THP %s, pipe max size %zu, io_uring %s, cpu features 0x%x, %zu cores, %d NUMA nodes, cgroup memory limit %zu\n",
+		     capabilities::page_size(), capabilities::huge_page_size(), capabilities::thp_mode_names[(int)capabilities::thp_mode()], capabilities::pipe_max_size(),
+		     capabilities::io_uring_available() ? "yes" : "no", capabilities::cpu_features(), capabilities::core_count(), topology::numa_node_count(), capabilities::cgroup_memory_limit());
 #endif
-
-	return dataMode_read_write<initial_printf_pattern, printf_pattern, single_printf_pattern, chunk_indices...>();
 }
 
-// SIDE-NOTE: No reinterpret_cast's allowed in constant expressions, seems restrictive, and it is, but it's got a pretty reasonable explanation:
-// 		--> reinterpretation relies on how the types are represented, which is implementation defined in a lot of cases AFAIK.
-//		--> you could standardize the way they look when running consteval functions, but that would mean that they would look one way
-//			in the rest of your code and another in the consteval functions, which is probably why they didn't do that.
-//		--> not to mention it would complicate the writing of constexpr functions, since the behaviour could change between runtime and compile-time.
-template <const auto& single_printf_pattern, unsigned char... chunk_indices>
-consteval auto generate_chunked_printf_pattern() {
-	meta::meta_string<sizeof...(chunk_indices) * (sizeof(single_printf_pattern) - 1) + 1> result;
-	for (size_t i = 0; i < sizeof(result) - 1; i += sizeof(single_printf_pattern) - 1) {
-		for (size_t j = 0; j < sizeof(single_printf_pattern) - 1; j++) {
-			result[i + j] = single_printf_pattern[j];
-		}
-	}
-	result[sizeof(result) - 1] = '\0';
-	return result;
-}
+#ifndef PLATFORM_WINDOWS
 
-#define optimizedDataTransformationAndOutput(initialPrintfPattern, singlePrintfPattern, ...) [&]() { static constexpr auto initial_printf_pattern = meta::construct_meta_array(initialPrintfPattern); static constexpr auto single_printf_pattern = meta::construct_meta_array(singlePrintfPattern); static constexpr auto printf_pattern = generate_chunked_printf_pattern<single_printf_pattern, __VA_ARGS__>(); return optimizedDataTransformationAndOutput_raw<initial_printf_pattern, printf_pattern, single_printf_pattern, __VA_ARGS__>(); }()
+perf::thread_counters thread_perf_counters[thread_count];
 
-namespace flags {
-	const char* varname = nullptr;
-}
+#endif
 
-int manageArgs(int argc, const char* const * argv) noexcept {
-	int normalArgIndex = 0;
-	for (int i = 1; i < argc; i++) {
-		if (argv[i][0] == '-') {
-			switch (argv[i][1]) {
-			case '-':
-				{
-					const char* flagContent = argv[i] + 2;
-					if (std::strcmp(flagContent, "varname") == 0) {
-						if (flags::varname != nullptr) {
-							REPORT_ERROR_AND_EXIT("more than one instance of \"--varname\" flag illegal", EXIT_SUCCESS);
-						}
-						i++;
-						if (i == argc) {
-							REPORT_ERROR_AND_EXIT("\"--varname\" flag requires a value", EXIT_SUCCESS);
-						}
-						flags::varname = argv[i];
-						continue;
-					}
-					if (std::strcmp(flagContent, "help") == 0) {
-						if (argc != 2) { REPORT_ERROR_AND_EXIT("use of \"--help\" flag with other args is illegal", EXIT_SUCCESS); }
-						if (crossplatform_write(STDOUT_FILENO, helpText, sizeof(helpText) - 1) == -1) {
-							REPORT_ERROR_AND_EXIT("failed to write to stdout", EXIT_FAILURE);
-						}
-						std::exit(EXIT_SUCCESS);
-					}
-					REPORT_ERROR_AND_EXIT("one or more invalid flags specified", EXIT_SUCCESS);
-				}
-			default: REPORT_ERROR_AND_EXIT("one or more invalid flags specified", EXIT_SUCCESS);
-			}
+#ifndef PLATFORM_WINDOWS
+
+// Picks the cpus for --pin and pins the formatter (the calling thread), the stream threads pin themselves when they start (see on_stream_thread_start()).
+// NOTE: Has to happen before anything touches the arena, so that the buffers end up on the formatter's NUMA node.
+void setup_pinning() noexcept {
+	if (flags::split_count != 0 || flags::split_size != 0) { REPORT_ERROR_AND_EXIT("\"--pin\" flag is not supported in split mode", EXIT_SUCCESS); }
+
+	const size_t threadCount = flags::io_thread ? 2 : 3;
+	if (flags::pin_cpu_count == 0) {
+		// NOTE: Not having enough cpus for every thread to get its own isn't an error, we just leave the placement to the scheduler then.
+		if (!topology::auto_placement(threadCount, thread_placement)) {
+			thread_placement.count = 0;
+			return;
 		}
-		if (normalArgIndex != 0) { REPORT_ERROR_AND_EXIT("too many non-flag args", EXIT_SUCCESS); }
-		normalArgIndex = i;
+	} else {
+		thread_placement.count = std::min(flags::pin_cpu_count, threadCount);
+		std::copy(flags::pin_cpus, flags::pin_cpus + thread_placement.count, thread_placement.cpus);
+		thread_placement.shared_cache_level = topology::shared_cache_level(thread_placement);
 	}
-	if (normalArgIndex == 0) { REPORT_ERROR_AND_EXIT("not enough non-flags args", EXIT_SUCCESS); }
-	if (flags::varname == nullptr) { flags::varname = "data"; }
-	return normalArgIndex;
+
+	if (!topology::pin_current_thread(thread_placement.cpus[0])) { REPORT_ERROR_AND_EXIT("failed to pin formatter thread: sched_setaffinity failed", EXIT_FAILURE); }
 }
 
-#define COUNT_TO_31_FROM_0 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31
+#endif
 
-void output_C_CPP_array_data() noexcept {
-	if (optimizedDataTransformationAndOutput("%u", ", %u", COUNT_TO_31_FROM_0) == false) {
-		REPORT_ERROR_AND_EXIT("no data received, language requires data", EXIT_FAILURE);
+void on_stream_thread_start(asyncio::stream_thread_t thread) noexcept {
+	if (flags::trace_path != nullptr) { trace::register_thread(thread_names[1 + (int)thread]); }
+#ifndef PLATFORM_WINDOWS
+	// NOTE: The I/O thread takes the reader's cpu.
+	const size_t placementSlot = thread == asyncio::stream_thread_t::FLUSHER ? 2 : 1;
+	if (placementSlot < thread_placement.count && !topology::pin_current_thread(thread_placement.cpus[placementSlot])) {
+		REPORT_ERROR_AND_EXIT("failed to pin stream thread: sched_setaffinity failed", EXIT_FAILURE);
 	}
+	stats::thread_cpus[1 + (int)thread] = sched_getcpu();
+	if (flags::perf_counters_format != report_format_t::NONE) { thread_perf_counters[1 + (int)thread].start(); }
+#endif
 }
 
-template <size_t output_size>
-void writeOutput(const char (&output)[output_size]) noexcept {
-	if (!stdout_stream::write(output, output_size - sizeof(char))) {
-		REPORT_ERROR_AND_EXIT("failed to output to stdout: stdout_stream::write failed", EXIT_FAILURE);
-	}
+void on_stream_thread_exit(asyncio::stream_thread_t thread) noexcept {
+#ifndef PLATFORM_WINDOWS
+	if (flags::perf_counters_format != report_format_t::NONE) { thread_perf_counters[1 + (int)thread].stop(); }
+#endif
 }
 
-void initialize_streams() noexcept {
-	if (!stdin_stream::initialize()) { REPORT_ERROR_AND_EXIT("failed to initialize stdin stream: stdin_stream::initialize failed", EXIT_FAILURE); }
-	stdout_stream::initialize();
-}
+#ifndef PLATFORM_WINDOWS
 
-void outputSource(const char* language) noexcept {
-	if (std::strcmp(language, "c++") == 0) {
-		if (std::printf("const char %s[] { ", flags::varname) < 0) {
-			REPORT_ERROR_AND_EXIT("failed to output to stdout: std::printf failed", EXIT_FAILURE);
-		}
-		if (fflush(stdout) == EOF) {
-			REPORT_ERROR_AND_EXIT("failed to flush stdout: fflush failed", EXIT_FAILURE);
+void print_perf_counters() noexcept {
+	bool userSpaceOnly = false;
+	for (size_t i = 0; i < thread_count; i++) { userSpaceOnly |= thread_perf_counters[i].user_space_only; }
+
+	if (flags::perf_counters_format == report_format_t::JSON) {
+		std::fprintf(stderr, "{\"user_space_only\":%s,\"threads\":{", userSpaceOnly ? "true" : "false");
+		for (size_t i = 0; i < thread_count; i++) {
+			std::fprintf(stderr, "%s\"%s\":", i == 0 ? "" : ",", thread_names[i]);
+			if (!thread_perf_counters[i].started) { std::fputs("null", stderr); continue; }
+			for (size_t j = 0; j < perf::counter_count; j++) {
+				const int64_t value = thread_perf_counters[i].values[j];
+				if (value == -1) { std::fprintf(stderr, "%s\"%s\":null", j == 0 ? "{" : ",", perf::counter_names[j]); }
+				else { std::fprintf(stderr, "%s\"%s\":%lld", j == 0 ? "{" : ",", perf::counter_names[j], (long long)value); }
+			}
+			std::fputc('}', stderr);
 		}
-		initialize_streams();
-		output_C_CPP_array_data();
-		writeOutput(" };\n");
+		std::fputs("}}\n", stderr);
 		return;
 	}
-	if (std::strcmp(language, "c") == 0) {
-		if (std::printf("const char %s[] = { ", flags::varname) < 0) {
-			REPORT_ERROR_AND_EXIT("failed to output to stdout: std::printf failed", EXIT_FAILURE);
-		}
-		if (fflush(stdout) == EOF) {
-			REPORT_ERROR_AND_EXIT("failed to flush stdout: fflush failed", EXIT_FAILURE);
+
+	std::fprintf(stderr, "srcembed perf counters%s:\n\t%-12s", userSpaceOnly ? " (user space only)" : "", "thread");
+	for (size_t j = 0; j < perf::counter_count; j++) { std::fprintf(stderr, "%18s", perf::counter_names[j]); }
+	std::fputc('\n', stderr);
+	for (size_t i = 0; i < thread_count; i++) {
+		std::fprintf(stderr, "\t%-12s", thread_names[i]);
+		for (size_t j = 0; j < perf::counter_count; j++) {
+			const int64_t value = thread_perf_counters[i].started ? thread_perf_counters[i].values[j] : -1;
+			if (value == -1) { std::fprintf(stderr, "%18s", "n/a"); }
+			else { std::fprintf(stderr, "%18lld", (long long)value); }
 		}
-		initialize_streams();
-		output_C_CPP_array_data();
-		writeOutput(" };\n");
-		return;
+		std::fputc('\n', stderr);
 	}
+}
 
-	REPORT_ERROR_AND_EXIT("invalid language", EXIT_SUCCESS);
+void on_progress_signal(int) noexcept {
+	// NOTE: write() can clobber errno, and we could be interrupting code that's just about to look at it.
+	const int savedErrno = errno;
+	progress::write_snapshot(STDERR_FILENO);
+	errno = savedErrno;
 }
 
+// NOTE: SIGUSR1 is always hooked up (outside of split mode), --progress just adds a timer that raises SIGALRM once a second.
+// SA_RESTART makes the blocking reads and writes carry on after a snapshot instead of failing with EINTR.
+bool setup_progress_reporting() noexcept {
+	progress::start();
+
+	struct sigaction action;
+	std::memset(&action, 0, sizeof(action));
+	action.sa_handler = on_progress_signal;
+	action.sa_flags = SA_RESTART;
+	// NOTE: Both signals are blocked while either handler runs, so snapshots can't interleave (at least not on the same thread).
+	sigemptyset(&action.sa_mask);
+	sigaddset(&action.sa_mask, SIGUSR1);
+	sigaddset(&action.sa_mask, SIGALRM);
+
+	if (sigaction(SIGUSR1, &action, nullptr) == -1) { return false; }
+	if (!flags::progress) { return true; }
+
+	if (sigaction(SIGALRM, &action, nullptr) == -1) { return false; }
+	const struct itimerval interval = { { 1, 0 }, { 1, 0 } };
+	return setitimer(ITIMER_REAL, &interval, nullptr) != -1;
+}
+
+void finish_progress_reporting() noexcept {
+	const struct itimerval disarmed = { };
+	setitimer(ITIMER_REAL, &disarmed, nullptr);
+	progress::write_snapshot(STDERR_FILENO);
+}
+
+#endif
+
 int main(int argc, const char* const * argv) noexcept {
 	// C++ standard I/O can suck it, it's super slow.
 	// We were using C standard I/O, while that's super fast, it's not fast enough, so we're using a custom I/O system now.
@@ -714,8 +961,49 @@ int main(int argc, const char* const * argv) noexcept {
 		// most pipes are that big.
 
 	int normalArgIndex = manageArgs(argc, argv);
+
+#ifndef PLATFORM_WINDOWS
+	if (flags::tune) {
+		run_tuning();
+		return 0;
+	}
+	// NOTE: No cache (or a cache from another host) just means we run with the defaults.
+	tuning::load();
+
+	if (flags::pin) { setup_pinning(); }
+
+	// NOTE: The arena is only mapped once an engine allocates from it, the small_input engine never does.
+	arena::configure(flags::memory_budget != 0 ? flags::memory_budget : arena::default_size, tuning::parameters.huge_pages);
+#endif
+
+	if (flags::stats_format != report_format_t::NONE) {
+		asyncio::measure_wait_times = true;
+		stats::start_time = std::chrono::steady_clock::now();
+	}
+
+	asyncio::stream_thread_start_hook = on_stream_thread_start;
+	asyncio::stream_thread_exit_hook = on_stream_thread_exit;
+
+	if (flags::trace_path != nullptr) {
+		trace::enabled = true;
+		trace::register_thread(thread_names[0]);
+	}
+
+#ifndef PLATFORM_WINDOWS
+	if (flags::perf_counters_format != report_format_t::NONE) { thread_perf_counters[0].start(); }
+	if (flags::split_count == 0 && flags::split_size == 0 && !setup_progress_reporting()) {
+		REPORT_ERROR_AND_EXIT("failed to set up progress reporting", EXIT_FAILURE);
+	}
+#endif
+
+	progress::set_state(progress::thread_t::FORMATTER, progress::state_t::WORKING);
 	outputSource(argv[normalArgIndex]);
 
+#ifndef PLATFORM_WINDOWS
+	// NOTE: The formatter's counters stop here. That includes waiting for the stream threads to wind down, embed() stops them before it returns.
+	if (flags::perf_counters_format != report_format_t::NONE) { thread_perf_counters[0].stop(); }
+#endif
+
 	// The following was part of the previous system with C standard I/O.
 		// NOTE: We have to explicitly close stdin and stdout because we can't let them automatically close
 		// after stdin_buffer and stdout_buffer have already been freed. fclose will try to flush remaining
@@ -728,8 +1016,22 @@ int main(int argc, const char* const * argv) noexcept {
 		//fclose(stdout);
 		//fclose(stdin);
 
-	stdin_stream::dispose();
-	stdout_stream::dispose();
+	progress::set_state(progress::thread_t::FORMATTER, progress::state_t::NOT_RUNNING);
+
+#ifndef PLATFORM_WINDOWS
+	if (flags::progress) { finish_progress_reporting(); }
+#endif
+
+	if (flags::stats_format != report_format_t::NONE) { print_stats(); }
+#ifndef PLATFORM_WINDOWS
+	if (flags::perf_counters_format != report_format_t::NONE) { print_perf_counters(); }
+#endif
+	if (flags::trace_path != nullptr && !trace::write_chrome_trace(flags::trace_path)) { REPORT_ERROR_AND_EXIT("failed to write trace file", EXIT_FAILURE); }
+
+#ifndef PLATFORM_WINDOWS
+	// NOTE: Last, because the stats above still read arena::peak_used.
+	if (!arena::dispose()) { REPORT_ERROR_AND_EXIT("failed to unmap buffer arena", EXIT_FAILURE); }
+#endif
 }
 
 // TODO: Why is it that this pipeline: yes | cpipe -vt | ./bin/srcembed c++ | cat > /dev/null is faster than this pipeline: yes | cpipe -vt | ./bin/srcembed c++ > /dev/null?
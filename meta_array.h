@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace meta {
+
+	// Facilities for handling strings at compile-time:
+	// NOTE: You have the following elsewhere as well probably, but just to reiterate:
+	// 	- you can accept const char*'s as template inputs, but you can't send string literals through those inputs.
+	//		- The mechanics of exactly how this is disallowed are weird, but the reasoning is somewhat understandable:
+	//			- string literals don't have to have same address even if they are same, in fact sometimes they don't have
+	//			any addresses because they can be represented as immediates in some instructions apparently.
+	//			- that means two types might look the same but be totally different to the naked eye, which isn't nice.
+	//	- accepting const char*'s is still useful though, if those const char*'s don't point to literals but point to arrays and such.
+	//	- you can also accept const auto& to accept types (among others) of const char (&)[N].
+	//		- you can't put string literals into those either, but you can put references to static constexpr char arrays in there.
+	//		- you can probably shrink the possible inputs to just char arrays if you make use of concepts, but that's a different
+	//		story.
+	// 	- you can accept the const char (&)[N] (and also const char*) as args of constexpr/consteval functions.
+	//		- this works with string literals, because the type can't be messed up like above, so the language is ok with it.
+	//		- this works and has the added bonus that you can use template arg deduction to figure out the length of the char array.
+	//		- PROBLEM: You can't pass the args into template args because the function args aren't considered constant expressions.
+	//			(super interesting, for reasoning see below somewhere)
+	//		--> interestingly, you can pass the args into other consteval/constexpr functions, since those functions don't have to evaluate to constant expressions inside other consteval/constexpr functions.
+	//	- The only practical alternative that is left open to you is to put an array in a struct and pass that around by reference
+	//	within the template args. If you don't plan on passing text to template args you can also accept it in function args of constexpr
+	//	or consteval function as mentioned above.
+	//	- There might also be another option, I haven't tested this though, it should work though:
+	//		Simply initialize a static constexpr char[] with a string literal and pass a pointer to the start of it into the template args, they should be able to accept that.
+	//		--> slightly more annoying to work with since you have to pass the size of the string in along side the pointer
+	//		--> AFAIK this wouldn't even be faster since we're passing the struct from before by reference, not value, so it's not better than the struct version.
+	//	--> for simplicity's sake I think the struct version is probably the best.
+
+	template <typename data_type, size_t length>
+	struct meta_array {
+		data_type data[length];
+
+		// NOTE: These should be consteval's, but due to a clang bug, this only works properly with constexpr.
+		// Hopefully this will get fixed in the future.
+		constexpr data_type& operator[](size_t index) { return data[index]; }
+		constexpr const data_type& operator[](size_t index) const { return data[index]; }
+		// NOTE: cv and rvalue/lvalue ref markers towards the end of the function declaration affect the invisible this
+		// argument and thereby participate in overload resolution. That means that the above two functions can both exist
+		// at the same time as two different overloads. The const version will be selected when that one more closely matches
+		// the input parameters.
+	};
+
+	template <typename data_type, size_t length>
+	consteval auto construct_meta_array(const data_type (&source_array)[length]) {
+		meta_array<data_type, length> result;
+		// NOTE: std::copy should be constexpr but it isn't because of outdated stdlib, see memory_outputter in meta_printf.h.
+		//std::copy(source_array, source_array + length, result.data);
+		for (size_t i = 0; i < length; i++) { result[i] = source_array[i]; }
+		return result;
+	}
+
+	template <size_t string_size>
+	using meta_string = meta_array<char, string_size>;
+
+	template <size_t string_size>
+	consteval auto construct_meta_string(const char (&string)[string_size]) {
+		meta_string<string_size - 1> result;
+		// NOTE: Same deal as above.
+		//std::copy(string, string + string_size - 1, result.data);
+		for (size_t i = 0; i < string_size - 1; i++) { result[i] = string[i]; }
+		return result;
+	}
+
+	template <size_t size>
+	using meta_byte_array = meta_array<uint8_t, size>;
+
+	// NOTE: Deliberately has no implementation, see the long note in meta_printf.h's create_program() for why this works.
+	void report_consteval_error(const char* message);
+
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+// Compile-time DFA generation for scanning the little text files the kernel hands us (/proc/meminfo, /sys/..., cgroup files).
+// build() takes a set of keys and turns them into an Aho-Corasick automaton at compile-time, flattened into a plain state table,
+// plus two extra states per key that skip the blanks after the key and parse the decimal value that follows it (if there is one).
+// Scanning is then one table lookup per byte. The whole scanner state is a single state index, so it doesn't matter where
+// the read() boundaries fall (the old hand-written meminfo parser could miss keys like "bbba" across a "bb|bba" seam, this can't).
+// NOTE: Scanning starts as if a '\n' had just been seen. That means a key that starts with '\n' only matches at the start of a line
+// (the first line included), and a key that's just "\n" matches the start of the file, which is how you read files that only contain a number.
+// NOTE: While blanks or a value are being consumed, no other keys are being looked for. When two keys end at the same byte,
+// the longer one wins. Neither of those ever matters for the files we read.
+
+#include <cstdint>
+#include <cstddef>
+
+#include "meta_array.h"
+
+namespace meta {
+
+	namespace dfa {
+
+		enum class action_t : uint8_t { NONE, KEY, DIGIT };
+
+		struct transition_t {
+			uint8_t next_state;
+			action_t action;
+		};
+
+		template <size_t state_count_param, size_t key_count_param>
+		struct dfa_t {
+			static constexpr size_t state_count = state_count_param;
+			static constexpr size_t key_count = key_count_param;
+
+			meta_array<transition_t, state_count * 256> table;
+			meta_array<uint8_t, state_count> state_keys;		// which key a blank-skipping or value state belongs to
+		};
+
+		template <size_t... key_sizes>
+		consteval auto build(const char (&... keys)[key_sizes]) {
+			constexpr size_t key_count = sizeof...(key_sizes);
+			// NOTE: This is an upper bound, keys with common prefixes share trie states. The leftover states just never get reached.
+			constexpr size_t trie_state_count = 1 + ((key_sizes - 1) + ...);
+			constexpr size_t state_count = trie_state_count + key_count * 2;
+			static_assert(state_count <= 256, "meta::dfa invalid: too many states for uint8_t state indices");
+
+			const char* const key_pointers[key_count] = { keys... };
+			const size_t key_lengths[key_count] = { (key_sizes - 1)... };
+
+			// The trie, -1 means there is no edge (yet).
+			meta_array<int16_t, trie_state_count * 256> automaton { };
+			meta_array<int16_t, trie_state_count> terminal_keys { };
+			for (size_t i = 0; i < trie_state_count * 256; i++) { automaton[i] = -1; }
+			for (size_t i = 0; i < trie_state_count; i++) { terminal_keys[i] = -1; }
+
+			size_t trie_size = 1;
+			for (size_t key = 0; key < key_count; key++) {
+				if (key_lengths[key] == 0) { report_consteval_error("meta::dfa invalid: empty key"); }
+				size_t state = 0;
+				for (size_t i = 0; i < key_lengths[key]; i++) {
+					const size_t index = state * 256 + (unsigned char)key_pointers[key][i];
+					if (automaton[index] == -1) { automaton[index] = trie_size++; }
+					state = automaton[index];
+				}
+				if (terminal_keys[state] != -1) { report_consteval_error("meta::dfa invalid: duplicate key"); }
+				terminal_keys[state] = key;
+			}
+
+			// Breadth-first walk that fills every missing edge with the edge of the failure state (the longest proper suffix that's also in the trie).
+			// That's what turns the trie into the full automaton: no backtracking at runtime, ever.
+			// NOTE: A state also inherits the key of its failure state if it doesn't end a key itself, so "xab" still finds "ab".
+			meta_array<int16_t, trie_state_count> failure { };
+			meta_array<int16_t, trie_state_count> queue { };
+			size_t queue_begin = 0;
+			size_t queue_end = 0;
+			for (size_t character = 0; character < 256; character++) {
+				const int16_t target = automaton[character];
+				if (target == -1) { automaton[character] = 0; continue; }
+				failure[target] = 0;
+				queue[queue_end++] = target;
+			}
+			while (queue_begin != queue_end) {
+				const int16_t state = queue[queue_begin++];
+				if (terminal_keys[state] == -1) { terminal_keys[state] = terminal_keys[failure[state]]; }
+				for (size_t character = 0; character < 256; character++) {
+					const int16_t target = automaton[state * 256 + character];
+					const int16_t failure_target = automaton[failure[state] * 256 + character];
+					if (target == -1) { automaton[state * 256 + character] = failure_target; continue; }
+					failure[target] = failure_target;
+					queue[queue_end++] = target;
+				}
+			}
+
+			dfa_t<state_count, key_count> result { };
+
+			for (size_t state = 0; state < trie_size; state++) {
+				for (size_t character = 0; character < 256; character++) {
+					const int16_t target = automaton[state * 256 + character];
+					if (terminal_keys[target] == -1) { result.table[state * 256 + character] = { (uint8_t)target, action_t::NONE }; }
+					else { result.table[state * 256 + character] = { (uint8_t)(trie_state_count + terminal_keys[target] * 2), action_t::KEY }; }
+				}
+			}
+
+			// After the value (or when there's no value), matching simply restarts as if from the root.
+			for (size_t key = 0; key < key_count; key++) {
+				const size_t blank_state = trie_state_count + key * 2;
+				const size_t value_state = blank_state + 1;
+				result.state_keys[blank_state] = key;
+				result.state_keys[value_state] = key;
+				for (size_t character = 0; character < 256; character++) {
+					result.table[blank_state * 256 + character] = result.table[character];
+					result.table[value_state * 256 + character] = result.table[character];
+				}
+				result.table[blank_state * 256 + ' '] = { (uint8_t)blank_state, action_t::NONE };
+				result.table[blank_state * 256 + '\t'] = { (uint8_t)blank_state, action_t::NONE };
+				for (size_t character = '0'; character <= '9'; character++) {
+					result.table[blank_state * 256 + character] = { (uint8_t)value_state, action_t::DIGIT };
+					result.table[value_state * 256 + character] = { (uint8_t)value_state, action_t::DIGIT };
+				}
+			}
+
+			return result;
+		}
+
+		struct value_t {
+			bool matched;
+			bool has_value;
+			size_t value;
+		};
+
+		// Feed it the file in whatever pieces you like, the results are in values[] (same order as the keys given to build()).
+		// NOTE: If a key shows up more than once, only the first occurrence counts. That's what keeps the trailing newline
+		// of a file like "1048576\n" from wiping out the value that a "\n" key just read.
+		template <const auto& dfa>
+		class scanner {
+			uint8_t state = 0;
+			// NOTE: nullptr while we're in the value of a repeated key, those digits get thrown away.
+			value_t* current_value = nullptr;
+
+		public:
+			value_t values[dfa.key_count] { };
+
+			scanner() noexcept {
+				const char newline = '\n';
+				feed(&newline, sizeof(newline));
+			}
+
+			void feed(const char* data, size_t size) noexcept {
+				for (size_t i = 0; i < size; i++) {
+					const transition_t transition = dfa.table[state * 256 + (unsigned char)data[i]];
+					state = transition.next_state;
+					switch (transition.action) {
+					case action_t::NONE: break;
+					case action_t::KEY:
+						current_value = &values[dfa.state_keys[state]];
+						if (current_value->matched) { current_value = nullptr; }
+						else { current_value->matched = true; }
+						break;
+					case action_t::DIGIT:
+						if (current_value == nullptr) { break; }
+						current_value->has_value = true;
+						current_value->value = current_value->value * 10 + ((unsigned char)data[i] - '0');
+						break;
+					}
+				}
+			}
+		};
+
+	}
+
+}
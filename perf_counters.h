@@ -0,0 +1,108 @@
+#pragma once
+
+// Per-thread hardware/software performance counters through perf_event_open (Linux only).
+// NOTE: perf_event_open counters with pid = 0 and cpu = -1 follow the calling thread around, so the counters for a thread
+// have to be opened from that thread. That's why the stream threads open theirs through the hooks in async_streamed_io.h.
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace perf {
+
+	enum class counter_t : uint8_t {
+		CYCLES,
+		INSTRUCTIONS,
+		LLC_MISSES,
+		DTLB_MISSES,
+		CONTEXT_SWITCHES,
+		PAGE_FAULTS
+	};
+
+	inline constexpr size_t counter_count = 6;
+
+	inline const char* const counter_names[counter_count] = { "cycles", "instructions", "llc_misses", "dtlb_misses", "context_switches", "page_faults" };
+
+	struct counter_config_t {
+		uint32_t type;
+		uint64_t config;
+	};
+
+	inline constexpr counter_config_t counter_configs[counter_count] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS }
+	};
+
+	inline int open_counter(const counter_config_t& counter_config, bool exclude_kernel) noexcept {
+		struct perf_event_attr attributes;
+		std::memset(&attributes, 0, sizeof(attributes));
+		attributes.size = sizeof(attributes);
+		attributes.type = counter_config.type;
+		attributes.config = counter_config.config;
+		attributes.exclude_kernel = exclude_kernel;
+		attributes.exclude_hv = 1;
+		// NOTE: If there are more counters than the PMU has registers, the kernel multiplexes them.
+		// The times tell us how long the counter was actually counting, so that we can scale the value up accordingly.
+		attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return syscall(SYS_perf_event_open, &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+	}
+
+	class thread_counters {
+		int fds[counter_count];
+
+		bool open_all_counters() noexcept {
+			for (size_t i = 0; i < counter_count; i++) {
+				fds[i] = open_counter(counter_configs[i], user_space_only);
+				if (fds[i] == -1 && !user_space_only && (errno == EACCES || errno == EPERM)) {
+					for (size_t j = 0; j < i; j++) {
+						if (fds[j] != -1) { close(fds[j]); }
+					}
+					return false;
+				}
+			}
+			return true;
+		}
+
+	public:
+		// NOTE: -1 means the counter couldn't be opened (no PMU in VMs, perf_event_paranoid, etc...).
+		int64_t values[counter_count];
+		// NOTE: With perf_event_paranoid >= 2, unprivileged users can only count user-space events.
+		// A lot of our time is spent in the kernel (vmsplice, write, read), so we only fall back to user-space only counting if we have to.
+		bool user_space_only = false;
+		bool started = false;
+
+		// Starts counting for the calling thread.
+		void start() noexcept {
+			if (!open_all_counters()) {
+				user_space_only = true;
+				open_all_counters();
+			}
+			started = true;
+		}
+
+		// Stops counting and fills in values.
+		// NOTE: Call this from the thread that's being counted, the counters of a thread that has already exited aren't worth much.
+		void stop() noexcept {
+			if (!started) { return; }
+			for (size_t i = 0; i < counter_count; i++) {
+				values[i] = -1;
+				if (fds[i] == -1) { continue; }
+
+				uint64_t result[3];		// value, time enabled, time running
+				if (read(fds[i], result, sizeof(result)) == sizeof(result) && result[2] != 0) {
+					values[i] = result[2] == result[1] ? result[0] : (int64_t)((double)result[0] * result[1] / result[2]);
+				}
+				close(fds[i]);
+			}
+		}
+	};
+
+}
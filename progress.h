@@ -0,0 +1,172 @@
+#pragma once
+
+// Live progress reporting (--progress and SIGUSR1).
+// The counters are only bumped once per buffer (per read, write, vmsplice or block of mmapped input), never per byte, so the hot loops don't notice them.
+// Every thread also publishes what it's currently doing, which is what lets a snapshot tell a stalled consumer apart from a slow disk.
+// NOTE: Snapshots are written from inside a signal handler, which can interrupt any thread at any point.
+// That's why everything in here is lock-free and why write_snapshot() formats by hand and only uses write().
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+
+#include "crossplatform_io.h"
+
+namespace progress {
+
+	enum class thread_t : uint8_t {
+		FORMATTER,
+		READER,
+		FLUSHER
+	};
+
+	inline constexpr size_t thread_count = 3;
+
+	enum class state_t : uint8_t {
+		NOT_RUNNING,
+		WORKING,
+		READING,
+		WRITING,
+		WAITING_FOR_INPUT,
+		WAITING_FOR_OUTPUT
+	};
+
+	inline const char* const thread_names[thread_count] = { "formatter", "reader", "flusher" };
+	inline const char* const state_names[] = { "not running", "working", "in read", "in write", "waiting for input", "waiting for output" };
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<state_t>::is_always_lock_free, "progress counters have to be lock-free, they're read from a signal handler");
+
+	inline std::atomic<uint64_t> input_bytes = 0;
+	inline std::atomic<uint64_t> output_bytes = 0;
+	// NOTE: 0 means unknown (stdin isn't a regular file), there's no percentage or ETA in that case.
+	inline std::atomic<uint64_t> total_input_bytes = 0;
+
+	inline std::atomic<state_t> thread_states[thread_count] = { };
+
+	// NOTE: Every thread only ever writes its own state, so a plain load and store is enough, no need for an exchange.
+	inline void set_state(thread_t thread, state_t state) noexcept { thread_states[(size_t)thread].store(state, std::memory_order_relaxed); }
+
+	class state_scope {
+		thread_t thread;
+		state_t previous_state;
+
+	public:
+		state_scope(thread_t thread, state_t state) noexcept : thread(thread), previous_state(thread_states[(size_t)thread].load(std::memory_order_relaxed)) { set_state(thread, state); }
+		~state_scope() { set_state(thread, previous_state); }
+	};
+
+	inline void add_input_bytes(uint64_t amount) noexcept { input_bytes.fetch_add(amount, std::memory_order_relaxed); }
+	inline void add_output_bytes(uint64_t amount) noexcept { output_bytes.fetch_add(amount, std::memory_order_relaxed); }
+	// For the mmap engines, which know their absolute position in the input anyway.
+	inline void set_input_bytes(uint64_t amount) noexcept { input_bytes.store(amount, std::memory_order_relaxed); }
+
+	// NOTE: The formatter is the one that's being held up, the stream threads only tell us by whom.
+	inline const char* find_blocked_stage() noexcept {
+		const state_t formatter_state = thread_states[(size_t)thread_t::FORMATTER].load(std::memory_order_relaxed);
+		switch (formatter_state) {
+		case state_t::WRITING: return "stdout (consumer is slow)";
+		case state_t::WAITING_FOR_OUTPUT:
+			return thread_states[(size_t)thread_t::FLUSHER].load(std::memory_order_relaxed) == state_t::WRITING ? "stdout (consumer is slow)" : "flusher";
+		case state_t::READING:
+		case state_t::WAITING_FOR_INPUT:
+			return thread_states[(size_t)thread_t::READER].load(std::memory_order_relaxed) == state_t::READING || formatter_state == state_t::READING ? "stdin (producer is slow)" : "reader";
+		case state_t::WORKING: return "nothing (formatting)";
+		default: return "nothing";
+		}
+	}
+
+	inline uint64_t get_time_ns() noexcept {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	inline std::atomic<uint64_t> last_snapshot_ns = 0;
+	inline std::atomic<uint64_t> last_snapshot_input_bytes = 0;
+
+	// Only call this once, before any of the counting starts.
+	inline void start() noexcept {
+		last_snapshot_ns.store(get_time_ns(), std::memory_order_relaxed);
+	}
+
+	// Tiny async-signal-safe formatter, snprintf isn't allowed in signal handlers.
+	class line_builder {
+		char buffer[512];
+		size_t size = 0;
+
+	public:
+		void append(const char* string) noexcept {
+			for (; *string != '\0' && size < sizeof(buffer); string++) { buffer[size++] = *string; }
+		}
+
+		void append(uint64_t value) noexcept {
+			char digits[20];
+			size_t digit_count = 0;
+			do {
+				digits[digit_count++] = '0' + value % 10;
+				value /= 10;
+			} while (value != 0);
+			while (digit_count != 0 && size < sizeof(buffer)) { buffer[size++] = digits[--digit_count]; }
+		}
+
+		// NOTE: One decimal place is all we ever need.
+		void append_decimal(double value) noexcept {
+			const uint64_t tenths = (uint64_t)(value * 10 + 0.5);
+			append(tenths / 10);
+			append(".");
+			append(tenths % 10);
+		}
+
+		void append_mebibytes(uint64_t bytes) noexcept {
+			append_decimal(bytes / (1024.0 * 1024.0));
+			append(" MiB");
+		}
+
+		bool write(int fd) const noexcept { return crossplatform_write(fd, buffer, size) == (sioret_t)size; }
+	};
+
+	// Writes one line to the given fd, something like:
+	// srcembed: 512.0 MiB of 2048.0 MiB (25.0%) in, 1843.2 MiB out, 340.5 MiB/s, ETA 5s, blocked on: stdout (consumer is slow) [formatter: in write, reader: not running, flusher: not running]
+	// NOTE: The throughput is measured since the previous snapshot (since the start for the first one), that's what makes it "current".
+	inline void write_snapshot(int fd) noexcept {
+		const uint64_t now_ns = get_time_ns();
+		const uint64_t current_input_bytes = input_bytes.load(std::memory_order_relaxed);
+		const uint64_t current_total_input_bytes = total_input_bytes.load(std::memory_order_relaxed);
+
+		const uint64_t previous_ns = last_snapshot_ns.exchange(now_ns, std::memory_order_relaxed);
+		const uint64_t previous_input_bytes = last_snapshot_input_bytes.exchange(current_input_bytes, std::memory_order_relaxed);
+		const double interval_seconds = (now_ns - previous_ns) / 1000000000.0;
+		const double bytes_per_second = interval_seconds > 0 && current_input_bytes >= previous_input_bytes ? (current_input_bytes - previous_input_bytes) / interval_seconds : 0;
+
+		line_builder line;
+		line.append("srcembed: ");
+		line.append_mebibytes(current_input_bytes);
+		if (current_total_input_bytes != 0) {
+			line.append(" of ");
+			line.append_mebibytes(current_total_input_bytes);
+			line.append(" (");
+			line.append_decimal(current_input_bytes * 100.0 / current_total_input_bytes);
+			line.append("%)");
+		}
+		line.append(" in, ");
+		line.append_mebibytes(output_bytes.load(std::memory_order_relaxed));
+		line.append(" out, ");
+		line.append_mebibytes((uint64_t)bytes_per_second);
+		line.append("/s");
+		if (current_total_input_bytes != 0 && bytes_per_second > 0 && current_input_bytes < current_total_input_bytes) {
+			line.append(", ETA ");
+			line.append((uint64_t)((current_total_input_bytes - current_input_bytes) / bytes_per_second + 0.5));
+			line.append("s");
+		}
+		line.append(", blocked on: ");
+		line.append(find_blocked_stage());
+		line.append(" [");
+		for (size_t i = 0; i < thread_count; i++) {
+			if (i != 0) { line.append(", "); }
+			line.append(thread_names[i]);
+			line.append(": ");
+			line.append(state_names[(size_t)thread_states[i].load(std::memory_order_relaxed)]);
+		}
+		line.append("]\n");
+		line.write(fd);
+	}
+
+}
@@ -0,0 +1,1722 @@
+#pragma once
+
+// srcembed as a library. The CLI is a thin wrapper around embed(), and programs that embed lots of files (build systems mostly)
+// can call it directly instead of forking a process for every one of them.
+// embed() turns an input (an fd or a span of memory) into source text and hands it to a sink (an fd, a memory buffer, a callback or a reserve/commit pair).
+// For fd inputs, it picks the fastest engine that works with the input and the sink (see run_auto_engine()), or runs the one it's told to run:
+//	- small_input: one read into a scratch buffer, everything formatted in one go, one write (needs options_t::scratch).
+//	- mmap_vmsplice, read_vmsplice: the output is formatted into buffers of exactly the pipe's size and vmspliced into it (fd sinks that are pipes).
+//	- mmap_write, read_write: the output goes through the sink, for fd sinks through an output stream with its own flusher thread.
+// The read engines read through an input stream with its own reader thread (or one epoll thread for both streams, see options_t::io_thread).
+// Sparse mode and split mode (see embed_sparse() and embed_split()) don't use the engines, they have their own loops.
+// Formatter kernels: the only code that gets instantiated per chunk size is the formatting loop (format_elements()), one kernel_t per chunk size.
+// Everything around it (I/O, buffer management, vmsplice, the engines) is compiled once and calls a kernel through the table,
+// a block of input at a time. One indirect call per block is nothing next to formatting the block, and every new output mode
+// only adds a kernel instead of another copy of every engine.
+// NOTE: No exits and no state of its own: everything an embed() call needs lives on its stack or comes out of options_t::allocator,
+// and every failure comes back as an error code. The only globals it touches are the system probes (capabilities.h, topology::numa_node_count()),
+// which are atomic, so concurrent embed() calls are fine as long as they don't share a sink, an input or an fd.
+// NOTE: The engines do report to the process-wide instrumentation (the asyncio thread hooks, the progress counters and --trace, see async_streamed_io.h
+// and progress.h), which is what the CLI's flags hook into. None of it costs anything unless somebody turns it on, but there's only one of it:
+// with concurrent embed() calls, the progress counters and thread states are a mix of all of them. Only turn it on with one call at a time.
+// Placement (options_t::alignment, options_t::section): for consumers that hand the array to SIMD code, madvise() it or find it through its section.
+// Only the prologue and epilogue change (see write_prologue() and write_epilogue()), the elements are the same as always.
+
+#include "crossplatform_io.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <cerrno>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <new>
+
+#ifndef PLATFORM_WINDOWS
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#else
+#include <malloc.h>
+#endif
+
+#include "usdt.h"
+#include "trace.h"
+#include "progress.h"
+#include "meta_printf.h"
+#include "async_streamed_io.h"
+
+#ifndef PLATFORM_WINDOWS
+#include "capabilities.h"
+#include "topology.h"
+#endif
+
+namespace srcembed {
+
+	// SIDE-NOTE: No reinterpret_cast's allowed in constant expressions, seems restrictive, and it is, but it's got a pretty reasonable explanation:
+	// 		--> reinterpretation relies on how the types are represented, which is implementation defined in a lot of cases AFAIK.
+	//		--> you could standardize the way they look when running consteval functions, but that would mean that they would look one way
+	//			in the rest of your code and another in the consteval functions, which is probably why they didn't do that.
+	//		--> not to mention it would complicate the writing of constexpr functions, since the behaviour could change between runtime and compile-time.
+	template <const auto& single_printf_pattern, unsigned char... chunk_indices>
+	consteval auto generate_chunked_printf_pattern() {
+		meta::meta_string<sizeof...(chunk_indices) * (sizeof(single_printf_pattern) - 1) + 1> result;
+		for (size_t i = 0; i < sizeof(result) - 1; i += sizeof(single_printf_pattern) - 1) {
+			for (size_t j = 0; j < sizeof(single_printf_pattern) - 1; j++) {
+				result[i + j] = single_printf_pattern[j];
+			}
+		}
+		result[sizeof(result) - 1] = '\0';
+		return result;
+	}
+
+	// NOTE: NOT_A_REGULAR_FILE, NOT_A_PIPE and INPUT_TOO_LARGE are requirements that the input or the sink doesn't meet,
+	// either those of a forced engine or those of a mode that needs the input size up front (split, sparse, pad_to_alignment).
+	// OUT_OF_MEMORY means options_t::allocator came back empty (the CLI's memory budget).
+	enum class error_code_t : uint8_t {
+		NONE,
+		INVALID_OPTIONS,
+		NO_DATA,
+		READ_FAILED,
+		WRITE_FAILED,
+		SINK_FULL,
+		NOT_A_REGULAR_FILE,
+		NOT_A_PIPE,
+		INPUT_TOO_LARGE,
+		INPUT_TOO_SMALL,
+		MMAP_FAILED,
+		OUT_OF_MEMORY,
+		NAME_TOO_LONG,
+		PART_FAILED,
+		THREAD_FAILED
+	};
+
+	inline const char* const error_messages[] = { "no error", "invalid options", "no data received, language requires data",
+						      "failed to read input", "failed to write to sink", "sink ran out of space",
+						      "input is not a regular file", "sink is not a pipe", "input too large for the engine",
+						      "input too small, split mode needs at least 64 bytes per part (except for the last one)",
+						      "failed to mmap input", "out of memory", "variable or section name too long",
+						      "failed to write split part", "failed to start stream threads" };
+
+	enum class language_t : uint8_t {
+		C,
+		CPP
+	};
+
+	// NOTE: Takes the names the CLI takes ("c", "c++").
+	inline bool parse_language(const char* name, language_t& result) noexcept {
+		if (std::strcmp(name, "c++") == 0) { result = language_t::CPP; return true; }
+		if (std::strcmp(name, "c") == 0) { result = language_t::C; return true; }
+		return false;
+	}
+
+	// NOTE: The order is part of the USDT probes (engine_selected and engine_fallback pass the index), don't shuffle it.
+	enum class engine_t : uint8_t {
+		AUTO,
+		MMAP_VMSPLICE,
+		MMAP_WRITE,
+		READ_VMSPLICE,
+		READ_WRITE,
+		SMALL_INPUT
+	};
+
+	inline const char* const engine_names[] = { "auto", "mmap_vmsplice", "mmap_write", "read_vmsplice", "read_write", "small_input" };
+
+	// NOTE: Takes the names the CLI's "--engine" flag takes (engine_names).
+	inline bool parse_engine(const char* name, engine_t& result) noexcept {
+		for (size_t i = 0; i < sizeof(engine_names) / sizeof(const char*); i++) {
+			if (std::strcmp(name, engine_names[i]) == 0) { result = (engine_t)i; return true; }
+		}
+		return false;
+	}
+
+	// Where the engine buffers come from (stream buffers, pipe buffers, spill buffers, the split and sparse buffers, the streams themselves).
+	// Everything is given back before embed() returns, in the reverse order of allocation, so a stack allocator works too (the CLI's arena is one).
+	// NOTE: alignment is a power of two, at most the page size. Returning nullptr is OUT_OF_MEMORY, or a fallback if there's an engine left that needs less.
+	// NOTE: The vmsplice engines gift their pages to the pipe, which can still be holding on to the last ones when embed() returns.
+	// Memory that was given back mustn't be written to again until whatever reads the pipe has caught up. Unmapping it is fine,
+	// which is why the default allocator maps every buffer on its own.
+	struct allocator_t {
+		void* (*allocate)(void* context, size_t size, size_t alignment) noexcept;
+		void (*deallocate)(void* context, void* memory, size_t size) noexcept;
+		void* context;
+	};
+
+#ifndef PLATFORM_WINDOWS
+	inline void* map_buffer(void*, size_t size, size_t) noexcept {
+		void* memory = mmap_probed(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return memory != MAP_FAILED ? memory : nullptr;
+	}
+
+	inline void unmap_buffer(void*, void* memory, size_t size) noexcept { munmap_probed(memory, size); }
+#else
+	inline void* map_buffer(void*, size_t size, size_t alignment) noexcept { return _aligned_malloc(size, alignment); }
+
+	inline void unmap_buffer(void*, void* memory, size_t) noexcept { _aligned_free(memory); }
+#endif
+
+	inline constexpr allocator_t default_allocator = { map_buffer, unmap_buffer, nullptr };
+
+	// NOTE: The stream buffers have to hold a couple of kernel blocks and the input stream's look-behind, anything below this is INVALID_OPTIONS.
+	inline constexpr size_t min_stream_buffer_size = 4096;
+
+	struct options_t {
+		language_t language = language_t::CPP;
+		const char* varname = "data";
+		// NOTE: Bytes per printf pattern, one of tuning::chunk_size_candidates (8, 16, 32). Only changes the speed, never the output.
+		size_t chunk_size = 32;
+		// NOTE: 0 means no alignment, anything else has to be a power of two.
+		size_t alignment = 0;
+		// NOTE: nullptr means no section. The section attribute is GNU-only (GCC and Clang), it's left out for other compilers.
+		const char* section = nullptr;
+		// NOTE: Rounds the array size up to a multiple of alignment (the compiler fills in the zeros), so that nothing else ends up
+		// in the array's last aligned block. Needs the input size up front, so fd inputs have to be regular files (NOT_A_REGULAR_FILE otherwise).
+		bool pad_to_alignment = false;
+
+		// NOTE: Only means something for fd inputs. Anything but AUTO is forced: an engine that can't run is an error, never a fallback.
+		engine_t engine = engine_t::AUTO;
+		// NOTE: Explicit array size, trailing zeros left out, long zero runs skipped with designators (C only), see embed_sparse(). Regular files only.
+		bool sparse = false;
+		// NOTE: Split mode, see embed_split(). Either exactly split_count parts, or parts of split_size input bytes (rounded up to split_part_alignment).
+		// Regular files only, and no placement (the parts have their own).
+		size_t split_count = 0;
+		size_t split_size = 0;
+		// NOTE: Split mode workers, 0 means one per core.
+		size_t split_thread_count = 0;
+		// NOTE: Per buffer, every stream has two.
+		size_t stream_buffer_size = 65536;
+		// NOTE: One epoll thread does the reading and the writing, instead of a spinning reader and flusher thread (Linux only).
+		bool io_thread = false;
+		// NOTE: The vmsplice engines resize the sink's pipe to this (capped by /proc/sys/fs/pipe-max-size) before they size their buffers to it.
+		// 0 leaves the pipe alone.
+		size_t pipe_size = 0;
+		// NOTE: On NUMA machines, the mmap engines bind the input to the node of the calling thread. This also pins the calling thread to that node,
+		// so that the scheduler doesn't move it away from its input. Off by default, a caller's affinity isn't ours to change (the CLI turns it on without --pin).
+		bool pin_to_input_node = false;
+		allocator_t allocator = default_allocator;
+		// NOTE: small_input_scratch_size bytes for the small_input engine, which reads the whole input into it and formats it in there.
+		// Without it (nullptr), AUTO skips small_input and forcing it is INVALID_OPTIONS. One call at a time per scratch buffer.
+		void* scratch = nullptr;
+	};
+
+	// NOTE: Placement also adds a size symbol ("<varname>_size") after the array, since sizeof() doesn't tell the input size anymore once it's padded.
+	inline bool has_placement(const options_t& options) noexcept { return options.alignment != 0 || options.section != nullptr; }
+
+	inline bool is_split(const options_t& options) noexcept { return options.split_count != 0 || options.split_size != 0; }
+
+	// NOTE: The section name ends up in a string literal, so anything that would need escaping is rejected instead.
+	inline bool valid_options(const options_t& options) noexcept {
+		if (options.varname == nullptr) { return false; }
+		if ((options.alignment & (options.alignment - 1)) != 0) { return false; }
+		if (options.pad_to_alignment && options.alignment == 0) { return false; }
+		if (options.section != nullptr) {
+			if (*options.section == '\0') { return false; }
+			for (const char* character = options.section; *character != '\0'; character++) {
+				if (*character == '"' || *character == '\\' || (unsigned char)*character < ' ') { return false; }
+			}
+		}
+		if (options.stream_buffer_size < min_stream_buffer_size) { return false; }
+		if (options.allocator.allocate == nullptr || options.allocator.deallocate == nullptr) { return false; }
+		if (options.split_count != 0 && options.split_size != 0) { return false; }
+		// NOTE: Split mode has its own alignment and section (see write_split_part()). Neither split nor sparse mode uses the engines.
+		if (is_split(options) && (has_placement(options) || options.sparse)) { return false; }
+		if ((is_split(options) || options.sparse) && options.engine != engine_t::AUTO) { return false; }
+#ifdef PLATFORM_WINDOWS
+		if (is_split(options) || options.sparse || options.pad_to_alignment || options.io_thread) { return false; }
+		if (options.engine != engine_t::AUTO && options.engine != engine_t::READ_WRITE) { return false; }
+#endif
+		return true;
+	}
+
+	// NOTE: 0 means "[]" (the compiler counts the elements).
+	inline size_t padded_array_size(size_t input_size, const options_t& options) noexcept {
+		if (!options.pad_to_alignment) { return 0; }
+		return (input_size + options.alignment - 1) / options.alignment * options.alignment;
+	}
+
+	// What an embed() call did, for the CLI's --stats. Optional, embed() doesn't need one.
+	// NOTE: The stream counters are only there for the engines that used streams. The wait times and the vmsplice time
+	// are only measured with asyncio::measure_wait_times on (they cost clock reads).
+	struct report_t {
+		struct fallback_t {
+			engine_t engine;
+			const char* reason;
+		};
+
+		engine_t engine = engine_t::AUTO;
+		bool engine_forced = false;
+		fallback_t fallbacks[5];
+		unsigned char fallback_count = 0;
+
+		size_t input_bytes = 0;
+		size_t output_bytes = 0;
+
+		size_t read_syscall_count = 0;
+		size_t write_syscall_count = 0;
+		size_t vmsplice_syscall_count = 0;
+		double vmsplice_seconds = 0;
+		size_t temp_buffer_spill_bytes = 0;
+
+		double producer_wait_seconds = 0;
+		double consumer_wait_seconds = 0;
+		double reader_wait_seconds = 0;
+		double flusher_wait_seconds = 0;
+		// NOTE: Averages, see asyncio::handoff_t.
+		double reader_handoff_seconds = 0;
+		double consumer_handoff_seconds = 0;
+		double flusher_handoff_seconds = 0;
+		double producer_handoff_seconds = 0;
+
+		void record_engine(engine_t selected_engine) noexcept {
+			engine = selected_engine;
+			USDT_PROBE1(srcembed, engine_selected, (uint8_t)selected_engine);
+		}
+
+		void record_fallback(engine_t skipped_engine, const char* reason) noexcept {
+			if (fallback_count == sizeof(fallbacks) / sizeof(fallback_t)) { return; }
+			fallbacks[fallback_count++] = { skipped_engine, reason };
+			USDT_PROBE1(srcembed, engine_fallback, (uint8_t)skipped_engine);
+		}
+	};
+
+	class input_t {
+	public:
+		// NOTE: -1 for span inputs.
+		int fd = -1;
+		const unsigned char* data = nullptr;
+		size_t size = 0;
+
+		// NOTE: The mmap engines map regular files whole (from offset 0, no matter where the fd's offset is).
+		// Everything else is read from the current offset until EOF.
+		input_t(int fd) noexcept : fd(fd) { }
+		input_t(const void* data, size_t size) noexcept : data((const unsigned char*)data), size(size) { }
+	};
+
+	// NOTE: Returning false aborts embed() with WRITE_FAILED.
+	using sink_callback_t = bool (*)(void* context, const char* data, size_t size) noexcept;
+
+	// NOTE: For sinks that hand out their own memory (like an output stream). reserve returns room for at least max_size bytes,
+	// commit appends the first size bytes of it. Returning nullptr from reserve aborts with SINK_FULL, returning false from commit aborts with WRITE_FAILED.
+	using sink_reserve_t = char* (*)(void* context, size_t max_size) noexcept;
+	using sink_commit_t = bool (*)(void* context, size_t size) noexcept;
+
+	class sink_t {
+	public:
+		enum class kind_t : uint8_t {
+			FD,
+			BUFFER,
+			FUNCTION,
+			RESERVE
+		};
+
+		kind_t kind;
+		int fd = -1;
+		char* buffer = nullptr;
+		size_t capacity = 0;
+		sink_callback_t callback = nullptr;
+		sink_reserve_t reserve = nullptr;
+		sink_commit_t commit = nullptr;
+		void* context = nullptr;
+		// NOTE: Bytes handed to the sink so far. For a buffer sink, that's the length of the output (nothing is NUL-terminated),
+		// or how far it got if it ran out of space (SINK_FULL). For an fd sink, that includes whatever the engine wrote to the fd without going through write().
+		size_t size = 0;
+
+		// NOTE: The engines go through the fd directly (vmsplice, an output stream), write() is for the bits in between.
+		sink_t(int fd) noexcept : kind(kind_t::FD), fd(fd) { }
+		// NOTE: max_output_size() is enough space for any input of the given size.
+		sink_t(char* buffer, size_t capacity) noexcept : kind(kind_t::BUFFER), buffer(buffer), capacity(capacity) { }
+		sink_t(sink_callback_t callback, void* context) noexcept : kind(kind_t::FUNCTION), callback(callback), context(context) { }
+		// NOTE: capacity is the largest reservation the sink can hand out, anything below max_element_length is INVALID_OPTIONS (see valid_sink()).
+		// Elements get formatted straight into the reservations (see format_and_output()). A reserve that returns nullptr (no room left) is SINK_FULL.
+		sink_t(sink_reserve_t reserve, sink_commit_t commit, void* context, size_t capacity) noexcept
+			: kind(kind_t::RESERVE), capacity(capacity), reserve(reserve), commit(commit), context(context) { }
+
+		error_code_t write(const char* data, size_t length) noexcept {
+			switch (kind) {
+			case kind_t::FD: if (!write_entire_buffer(fd, data, length)) { return error_code_t::WRITE_FAILED; } break;
+			case kind_t::BUFFER:
+				if (length > capacity - size) { return error_code_t::SINK_FULL; }
+				std::memcpy(buffer + size, data, length);
+				break;
+			case kind_t::FUNCTION: if (!callback(context, data, length)) { return error_code_t::WRITE_FAILED; } break;
+			case kind_t::RESERVE:
+				if (capacity == 0) { return error_code_t::INVALID_OPTIONS; }
+				for (size_t position = 0; position < length; position += capacity) {
+					const size_t piece_size = std::min(capacity, length - position);
+					char* reservation = reserve(context, piece_size);
+					if (reservation == nullptr) { return error_code_t::SINK_FULL; }
+					std::memcpy(reservation, data + position, piece_size);
+					if (!commit(context, piece_size)) { return error_code_t::WRITE_FAILED; }
+					size += piece_size;
+				}
+				return error_code_t::NONE;
+			}
+			size += length;
+			return error_code_t::NONE;
+		}
+	};
+
+	// NOTE: Returning false aborts with READ_FAILED. A span of size 0 means EOF.
+	// Acquiring again without releasing in between has to hand out the same data (the engines peek at the first span like that).
+	using source_acquire_t = bool (*)(void* context, const unsigned char*& data, size_t& size) noexcept;
+	// NOTE: Always releases the whole span that acquire handed out last.
+	using source_release_t = void (*)(void* context, size_t size) noexcept;
+
+	class source_t {
+	public:
+		source_acquire_t acquire;
+		source_release_t release;
+		void* context;
+
+		source_t(source_acquire_t acquire, source_release_t release, void* context) noexcept : acquire(acquire), release(release), context(context) { }
+	};
+
+	// NOTE: At most 5 bytes (", 255") per input byte.
+	inline constexpr size_t max_element_length = 5;
+
+	// NOTE: Input bytes per kernel call. Big enough that the indirect call disappears next to the formatting, small enough that
+	// the formatted block (about 2.5 KiB) fits on the stack of any thread (embed() gets called from worker threads with small stacks),
+	// and that the room it needs is never a problem for the CLI's output buffers.
+	inline constexpr size_t kernel_block_size = 512;
+	inline constexpr size_t max_kernel_block_output = kernel_block_size * max_element_length;
+
+	// NOTE: A reserve sink has to be able to take at least one formatted element per reservation, or there's no way to make progress.
+	inline bool valid_sink(const sink_t& sink) noexcept { return sink.kind != sink_t::kind_t::RESERVE || sink.capacity >= max_element_length; }
+
+	// NOTE: Includes, attributes, the size symbol and the digits in them. The names are counted separately.
+	inline constexpr size_t max_placement_text_length = 256;
+
+	inline size_t max_output_size(size_t input_size, const options_t& options) noexcept {
+		size_t result = sizeof("const char [] = { ") - 1 + std::strlen(options.varname) + input_size * max_element_length + sizeof(" };\n") - 1;
+		if (has_placement(options)) { result += max_placement_text_length + std::strlen(options.varname) * 2 + (options.section != nullptr ? std::strlen(options.section) : 0); }
+		return result;
+	}
+
+	inline constexpr auto initial_printf_pattern = meta::construct_meta_array("%u");
+	inline constexpr auto single_printf_pattern = meta::construct_meta_array(", %u");
+
+	// Formats input as array elements into output, which has to be able to hold max_element_length bytes per input byte.
+	// The first element of the whole array (first == true) doesn't get a separator. Returns the amount of bytes written.
+	// NOTE: The memory outputter can't fail, so unlike the streamed engines, there's nothing to check here.
+	template <const auto& printf_pattern, unsigned char... chunk_indices>
+	size_t format_elements(char* output, const unsigned char* input, size_t input_size, bool first) noexcept {
+		constexpr unsigned char bytes_per_chunk = sizeof...(chunk_indices);
+
+		size_t output_size = 0;
+		size_t i = 0;
+		if (first) { output_size = meta_sprintf_no_terminator(output, initial_printf_pattern.data, input[0]); i = 1; }
+		for (; i + bytes_per_chunk <= input_size; i += bytes_per_chunk) {
+			output_size += meta_sprintf_no_terminator(output + output_size, printf_pattern.data, input[i + chunk_indices]...);
+		}
+		for (; i < input_size; i++) {
+			output_size += meta_sprintf_no_terminator(output + output_size, single_printf_pattern.data, input[i]);
+		}
+		return output_size;
+	}
+
+	template <unsigned char... chunk_indices>
+	inline constexpr auto chunked_printf_pattern = generate_chunked_printf_pattern<single_printf_pattern, chunk_indices...>();
+
+	struct kernel_t {
+		size_t chunk_size;
+		size_t (*format)(char* output, const unsigned char* input, size_t input_size, bool first) noexcept;
+	};
+
+	// NOTE: The chunk size is baked into the printf pattern, so every one of them is its own instantiation.
+	// NOTE: The index lists are only needed for this table, the macros are gone again right after it (this header gets included by other people's code).
+#define SRCEMBED_COUNT_TO_7_FROM_0 0, 1, 2, 3, 4, 5, 6, 7
+#define SRCEMBED_COUNT_TO_15_FROM_0 SRCEMBED_COUNT_TO_7_FROM_0, 8, 9, 10, 11, 12, 13, 14, 15
+#define SRCEMBED_COUNT_TO_31_FROM_0 SRCEMBED_COUNT_TO_15_FROM_0, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31
+	inline constexpr kernel_t kernels[] = {
+		{ 8, format_elements<chunked_printf_pattern<SRCEMBED_COUNT_TO_7_FROM_0>, SRCEMBED_COUNT_TO_7_FROM_0> },
+		{ 16, format_elements<chunked_printf_pattern<SRCEMBED_COUNT_TO_15_FROM_0>, SRCEMBED_COUNT_TO_15_FROM_0> },
+		{ 32, format_elements<chunked_printf_pattern<SRCEMBED_COUNT_TO_31_FROM_0>, SRCEMBED_COUNT_TO_31_FROM_0> }
+	};
+#undef SRCEMBED_COUNT_TO_31_FROM_0
+#undef SRCEMBED_COUNT_TO_15_FROM_0
+#undef SRCEMBED_COUNT_TO_7_FROM_0
+
+	// NOTE: nullptr for unsupported chunk sizes.
+	inline const kernel_t* select_kernel(size_t chunk_size) noexcept {
+		for (const kernel_t& kernel : kernels) {
+			if (kernel.chunk_size == chunk_size) { return &kernel; }
+		}
+		return nullptr;
+	}
+
+	inline error_code_t format_and_output(const kernel_t& kernel, const unsigned char* input, size_t input_size, bool first, sink_t& sink) noexcept {
+		// NOTE: Reserve sinks get formatted into directly, as much input at a time as fits into one reservation.
+		if (sink.kind == sink_t::kind_t::RESERVE) {
+			if (!valid_sink(sink)) { return error_code_t::INVALID_OPTIONS; }
+			const size_t reserve_block_size = sink.capacity / max_element_length;
+			for (size_t position = 0; position < input_size; position += reserve_block_size) {
+				const size_t current_block_size = std::min(reserve_block_size, input_size - position);
+				char* reservation = sink.reserve(sink.context, current_block_size * max_element_length);
+				if (reservation == nullptr) { return error_code_t::SINK_FULL; }
+				const size_t output_size = kernel.format(reservation, input + position, current_block_size, first && position == 0);
+				if (!sink.commit(sink.context, output_size)) { return error_code_t::WRITE_FAILED; }
+				sink.size += output_size;
+			}
+			return error_code_t::NONE;
+		}
+
+		char output[max_kernel_block_output];
+		for (size_t position = 0; position < input_size; position += kernel_block_size) {
+			const size_t current_block_size = std::min(kernel_block_size, input_size - position);
+			// NOTE: Buffer sinks with enough room left get formatted into directly, saving the copy.
+			if (sink.kind == sink_t::kind_t::BUFFER && sink.capacity - sink.size >= current_block_size * max_element_length) {
+				sink.size += kernel.format(sink.buffer + sink.size, input + position, current_block_size, first && position == 0);
+				continue;
+			}
+			const size_t output_size = kernel.format(output, input + position, current_block_size, first && position == 0);
+			const error_code_t error = sink.write(output, output_size);
+			if (error != error_code_t::NONE) { return error; }
+		}
+		return error_code_t::NONE;
+	}
+
+	// Formats everything the source hands out, until EOF. Returns NO_DATA if the source is empty from the start.
+	// NOTE: The kernels take any amount of input, so the spans don't have to line up with the chunks.
+	inline error_code_t format_source(const kernel_t& kernel, source_t& source, sink_t& sink) noexcept {
+		for (bool first = true; ; first = false) {
+			const unsigned char* data;
+			size_t size;
+			if (!source.acquire(source.context, data, size)) { return error_code_t::READ_FAILED; }
+			if (size == 0) { return first ? error_code_t::NO_DATA : error_code_t::NONE; }
+			const error_code_t error = format_and_output(kernel, data, size, first, sink);
+			if (error != error_code_t::NONE) { return error; }
+			source.release(source.context, size);
+		}
+	}
+
+	inline error_code_t write_string(sink_t& sink, const char* string) noexcept { return sink.write(string, std::strlen(string)); }
+
+	// Everything up to the first element. With placement, that's:
+	//	#include <cstddef>
+	//
+	//	#if defined(__GNUC__)
+	//	__attribute__((section("<section>"), used))
+	//	#endif
+	//	alignas(<alignment>) const char <varname>[<array_size>] {
+	// NOTE: "used" keeps the compiler from dropping the array when nothing in the translation unit refers to it,
+	// which is the normal case for an array that's only ever found through its section.
+	// NOTE: C gets _Alignas instead of alignas (C11). Both are standard, unlike the GNU aligned attribute.
+	// NOTE: array_size 0 means "[]", see padded_array_size().
+	inline error_code_t write_prologue(sink_t& sink, const options_t& options, size_t array_size) noexcept {
+		const bool is_cpp = options.language == language_t::CPP;
+		char text[64];
+		error_code_t error = error_code_t::NONE;
+		if (has_placement(options)) { error = write_string(sink, is_cpp ? "#include <cstddef>\n\n" : "#include <stddef.h>\n\n"); }
+		if (error == error_code_t::NONE && options.section != nullptr) {
+			error = write_string(sink, "#if defined(__GNUC__)\n__attribute__((section(\"");
+			if (error == error_code_t::NONE) { error = write_string(sink, options.section); }
+			if (error == error_code_t::NONE) { error = write_string(sink, "\"), used))\n#endif\n"); }
+		}
+		if (error == error_code_t::NONE && options.alignment != 0) {
+			std::snprintf(text, sizeof(text), "%s(%zu) ", is_cpp ? "alignas" : "_Alignas", options.alignment);
+			error = write_string(sink, text);
+		}
+		if (error == error_code_t::NONE) { error = write_string(sink, "const char "); }
+		if (error == error_code_t::NONE) { error = write_string(sink, options.varname); }
+		if (error != error_code_t::NONE) { return error; }
+		if (array_size != 0) { std::snprintf(text, sizeof(text), "[%zu]%s", array_size, is_cpp ? " { " : " = { "); }
+		else { std::strcpy(text, is_cpp ? "[] { " : "[] = { "); }
+		return write_string(sink, text);
+	}
+
+	// Everything after the last element. With placement, the size symbol comes after the array:
+	//	constexpr std::size_t <varname>_size = sizeof(<varname>);		(C++)
+	//	const size_t <varname>_size = sizeof(<varname>);			(C)
+	// NOTE: With pad_to_alignment, sizeof() is the padded size, so it's input_size spelled out instead.
+	// NOTE: C has no constexpr before C23. The C one has external linkage like the array itself, an unused static const would be a warning.
+	inline error_code_t write_epilogue(sink_t& sink, const options_t& options, size_t input_size) noexcept {
+		error_code_t error = write_string(sink, " };\n");
+		if (error != error_code_t::NONE || !has_placement(options)) { return error; }
+		error = write_string(sink, options.language == language_t::CPP ? "constexpr std::size_t " : "const size_t ");
+		if (error == error_code_t::NONE) { error = write_string(sink, options.varname); }
+		if (error != error_code_t::NONE) { return error; }
+		if (options.pad_to_alignment) {
+			char text[64];
+			std::snprintf(text, sizeof(text), "_size = %zu;\n", input_size);
+			return write_string(sink, text);
+		}
+		error = write_string(sink, "_size = sizeof(");
+		if (error == error_code_t::NONE) { error = write_string(sink, options.varname); }
+		if (error == error_code_t::NONE) { error = write_string(sink, ");\n"); }
+		return error;
+	}
+
+#ifndef PLATFORM_WINDOWS
+
+	// Maps size bytes of a regular file from offset 0, for reading it front to back. Returns nullptr on failure.
+	// NOTE: Can't see huge pages being beneficial here, so we're leaving them out.
+	inline const unsigned char* map_input(int fd, size_t size) noexcept {
+		void* mapping = mmap_probed(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_NORESERVE | MAP_POPULATE, fd, 0);
+		if (mapping == MAP_FAILED) { return nullptr; }
+		// NOTE: I'm pretty sure these don't overwrite each other, but just in case, I put the more important one second.
+		posix_madvise(mapping, size, POSIX_MADV_WILLNEED);
+		posix_madvise(mapping, size, POSIX_MADV_SEQUENTIAL);
+		return (const unsigned char*)mapping;
+	}
+
+	inline bool unmap_input(const unsigned char* data, size_t size) noexcept { return munmap_probed((void*)data, size) == 0; }
+
+#endif
+
+	inline error_code_t embed_span(const unsigned char* input, size_t input_size, sink_t& sink, const options_t& options, const kernel_t& kernel) noexcept {
+		error_code_t error = write_prologue(sink, options, padded_array_size(input_size, options));
+		if (error == error_code_t::NONE) { error = format_and_output(kernel, input, input_size, true, sink); }
+		if (error != error_code_t::NONE) { return error; }
+		return write_epilogue(sink, options, input_size);
+	}
+
+	inline constexpr size_t cache_line_size = 64;
+
+	inline void* allocate(const options_t& options, size_t size, size_t alignment = cache_line_size) noexcept {
+		return options.allocator.allocate(options.allocator.context, size, alignment);
+	}
+
+	inline void deallocate(const options_t& options, void* memory, size_t size) noexcept { options.allocator.deallocate(options.allocator.context, memory, size); }
+
+	class streams_t;
+
+	// Everything an engine needs to know about the embed() call it's running for.
+	struct run_t {
+		const options_t& options;
+		const kernel_t& kernel;
+		// NOTE: The caller's sink. The engines that format into a sink use output_sink() instead, which is the output stream for fd sinks.
+		sink_t& sink;
+		report_t& report;
+		int input_fd;
+		// NOTE: input_size is only known for regular files, and only if it fits into a size_t (input_too_large otherwise).
+		bool input_is_regular_file = false;
+		bool input_too_large = false;
+		size_t input_size = 0;
+		// NOTE: See padded_array_size(), 0 without pad_to_alignment.
+		size_t array_size = 0;
+		streams_t* streams = nullptr;
+	};
+
+	// NOTE: The reader thread is done with a span once acquire() hands it out, the data is only volatile because of the buffer handover.
+	// The fence keeps the compiler from pulling the reads in front of acquire().
+	inline const unsigned char* acquired_span_data(const asyncio::input_stream::span_t& span) noexcept {
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+		return (const unsigned char*)span.data;
+	}
+
+	// The streams of one embed() call, plugged into the loops above as a source and a sink (format_source(), format_and_output()).
+	// The sink formats straight into the output stream's buffer through reserve()/commit(), so that the output bytes are only written once.
+	// NOTE: The streams are a couple of KiB each (look-behind, carry and spill buffers), so they come out of the allocator along with their buffers.
+	class streams_t {
+		static char* reserve(void* context, size_t max_size) noexcept { return ((streams_t*)context)->output.reserve(max_size); }
+		static bool commit(void* context, size_t size) noexcept { return ((streams_t*)context)->output.commit(size); }
+
+		static bool acquire(void* context, const unsigned char*& data, size_t& size) noexcept {
+			const asyncio::input_stream::span_t span = ((streams_t*)context)->input.acquire();
+			if (!span.data) { return false; }
+			data = acquired_span_data(span);
+			size = span.size;
+			return true;
+		}
+
+		static void release(void* context, size_t size) noexcept { ((streams_t*)context)->input.release(size); }
+
+	public:
+		asyncio::input_stream input;
+		asyncio::output_stream output;
+#ifndef PLATFORM_WINDOWS
+		asyncio::io_thread io;
+#endif
+		sink_t output_sink;
+		source_t input_source;
+
+		char* input_buffer = nullptr;
+		char* output_buffer = nullptr;
+		bool input_started = false;
+		bool output_started = false;
+		bool io_started = false;
+
+		streams_t(int input_fd, int output_fd, size_t buffer_size) noexcept
+			: input(input_fd, buffer_size), output(output_fd, buffer_size),
+			  output_sink(reserve, commit, this, asyncio::output_stream::max_reserve_size), input_source(acquire, release, this) { }
+	};
+
+	// Starts the streams an engine needs, once it's sure it's going to run. Only the read engines read through an input stream
+	// and only fd sinks get an output stream, so the streams an engine doesn't use don't cost anything (allocator included).
+	// NOTE: Every buffer is allocated before the first read, so running out of memory never leaves the input half read.
+	// NOTE: Always pair it with stop_streams() (finish_streams()), which also cleans up after a start that failed halfway.
+	inline error_code_t start_streams(run_t& run, bool with_input, bool with_output) noexcept {
+		const options_t& options = run.options;
+		void* memory = allocate(options, sizeof(streams_t), alignof(streams_t));
+		if (memory == nullptr) { return error_code_t::OUT_OF_MEMORY; }
+		streams_t& streams = *new (memory) streams_t(run.input_fd, run.sink.fd, options.stream_buffer_size);
+		run.streams = &streams;
+
+		if (with_input) {
+			streams.input_buffer = (char*)allocate(options, options.stream_buffer_size * 2);
+			if (streams.input_buffer == nullptr) { return error_code_t::OUT_OF_MEMORY; }
+		}
+		if (with_output) {
+			streams.output_buffer = (char*)allocate(options, options.stream_buffer_size * 2);
+			if (streams.output_buffer == nullptr) { return error_code_t::OUT_OF_MEMORY; }
+		}
+
+		if (with_input) {
+			streams.input.set_buffer(streams.input_buffer);
+			if (!streams.input.initialize(!options.io_thread)) { return error_code_t::READ_FAILED; }
+			streams.input_started = true;
+		}
+		if (with_output) {
+			streams.output.set_buffer(streams.output_buffer);
+			if (!streams.output.initialize(!options.io_thread)) { return error_code_t::THREAD_FAILED; }
+			streams.output_started = true;
+		}
+#ifndef PLATFORM_WINDOWS
+		if (options.io_thread) {
+			if (!streams.io.start(with_input ? &streams.input : nullptr, with_output ? &streams.output : nullptr)) { return error_code_t::THREAD_FAILED; }
+			streams.io_started = true;
+		}
+#endif
+		return error_code_t::NONE;
+	}
+
+	// Flushes what's left of the output, stops the stream threads, reports their counters and gives everything back to the allocator.
+	inline error_code_t stop_streams(run_t& run) noexcept {
+		streams_t* streams = run.streams;
+		if (streams == nullptr) { return error_code_t::NONE; }
+		run.streams = nullptr;
+
+		error_code_t error = error_code_t::NONE;
+		if (streams->input_started) { streams->input.dispose(); }
+		// NOTE: Without a running I/O thread, nothing would ever drain the output stream, flushing it would wait forever.
+		if (streams->output_started && (!run.options.io_thread || streams->io_started) && !streams->output.dispose()) { error = error_code_t::WRITE_FAILED; }
+#ifndef PLATFORM_WINDOWS
+		if (!streams->io.dispose() && error == error_code_t::NONE) { error = error_code_t::THREAD_FAILED; }
+#endif
+
+		report_t& report = run.report;
+		if (streams->input_started) {
+			report.input_bytes = streams->input.total_bytes_read;
+			report.read_syscall_count += streams->input.read_syscall_count;
+			report.consumer_wait_seconds += streams->input.consumer_wait_seconds;
+			report.reader_wait_seconds += streams->input.reader_wait_seconds;
+			report.reader_handoff_seconds = streams->input.reader_handoff.average_seconds();
+			report.consumer_handoff_seconds = streams->input.consumer_handoff.average_seconds();
+		}
+		if (streams->output_started) {
+			run.sink.size += streams->output.total_bytes_written;
+			report.write_syscall_count += streams->output.write_syscall_count;
+			report.producer_wait_seconds += streams->output.producer_wait_seconds;
+			report.flusher_wait_seconds += streams->output.flusher_wait_seconds;
+			report.flusher_handoff_seconds = streams->output.flusher_handoff.average_seconds();
+			report.producer_handoff_seconds = streams->output.producer_handoff.average_seconds();
+		}
+
+		char* const input_buffer = streams->input_buffer;
+		char* const output_buffer = streams->output_buffer;
+		const size_t buffer_size = run.options.stream_buffer_size * 2;
+		streams->~streams_t();
+		if (output_buffer != nullptr) { deallocate(run.options, output_buffer, buffer_size); }
+		if (input_buffer != nullptr) { deallocate(run.options, input_buffer, buffer_size); }
+		deallocate(run.options, streams, sizeof(streams_t));
+		return error;
+	}
+
+	// NOTE: The first error wins, the streams get stopped either way.
+	inline error_code_t finish_streams(run_t& run, error_code_t error) noexcept {
+		const error_code_t stop_error = stop_streams(run);
+		return error != error_code_t::NONE ? error : stop_error;
+	}
+
+	inline sink_t& output_sink(run_t& run) noexcept { return run.streams != nullptr && run.streams->output_started ? run.streams->output_sink : run.sink; }
+
+	// Formats everything the source hands out, with the prologue in front of it and the epilogue after it.
+	// NOTE: The first span is acquired before the prologue is written, so that an empty input doesn't leave a prologue behind (NO_DATA).
+	inline error_code_t embed_source(run_t& run, source_t& source, sink_t& sink) noexcept {
+		const unsigned char* data;
+		size_t size;
+		if (!source.acquire(source.context, data, size)) { return error_code_t::READ_FAILED; }
+		if (size == 0) { return error_code_t::NO_DATA; }
+
+		error_code_t error = write_prologue(sink, run.options, run.array_size);
+		if (error == error_code_t::NONE) { error = format_source(run.kernel, source, sink); }
+		if (error != error_code_t::NONE) { return error; }
+		return write_epilogue(sink, run.options, run.input_size);
+	}
+
+	inline error_code_t run_read_write(run_t& run) noexcept {
+		run.report.record_engine(engine_t::READ_WRITE);
+
+		error_code_t error = start_streams(run, true, run.sink.kind == sink_t::kind_t::FD);
+#ifndef PLATFORM_WINDOWS
+		if (error == error_code_t::NONE && posix_fadvise(run.input_fd, 0, 0, POSIX_FADV_NOREUSE) == 0) {
+			if (posix_fadvise(run.input_fd, 0, 0, POSIX_FADV_WILLNEED) == 0) {
+				posix_fadvise(run.input_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+			}
+		}
+#endif
+
+		// NOTE: We go through whole stream buffers here and only come back to the stream at the seams.
+		if (error == error_code_t::NONE) { error = embed_source(run, run.streams->input_source, output_sink(run)); }
+		return finish_streams(run, error);
+	}
+
+#ifndef PLATFORM_WINDOWS
+
+	/*
+	EPIPHANY:
+		- the second best way to transmit data is to have super big buffers and read, then write with those buffers (unless you've got splice and such)
+		- this'll save on syscalls, which is great.
+		- there'll be big gaps in between sends where you refill your buffer, but that doesn't matter because with smaller buffers, there might be smaller gaps, but there'll be more of them, so it equals out
+		- if the program after you is the bottleneck, your sends will take forever, but it doesn't matter because the speed of the write doesn't change anything about the gap equality law thing above.
+		- same thing with reads
+
+		- the absolute best way to make use of reads and writes is to double your buffer and read and write simultaeniously
+		- you'll always be reading and writing at the same time, double the speed
+
+		- if the goal is to make the buffers as big as possible within the constraints of your usage and system and such, that begs the question:
+			- what the hell is BUFSIZ for?
+				- Maybe that's just the recommended buffer size because they didn't want programs using too much RAM?
+				- I can't see any other reason since it offers no performance benefits apparently.
+				- TODO: Research this, maybe I've made a crucial mistake in my thought process.
+	*/
+
+	// On a machine with more than one NUMA node, the input pages sit on whatever node read them in (or whoever MAP_POPULATE ran on),
+	// which is the wrong one about half of the time. This keeps the formatter (the calling thread) and its input on one node:
+	// the mapping gets bound (and moved) to the node the formatter is running on, see options_t::pin_to_input_node for keeping the formatter there.
+	// NOTE: Doesn't do anything on single node machines.
+	inline void keep_input_on_current_node(const options_t& options, const unsigned char* input, size_t input_size) noexcept {
+		if (topology::numa_node_count() < 2) { return; }
+		const int node = topology::node_of_cpu(sched_getcpu());
+		if (node == -1) { return; }
+		if (options.pin_to_input_node) { topology::pin_current_thread_to_node(node); }
+		topology::bind_to_node(input, input_size, node);
+	}
+
+	// NOTE: Failing to resize the pipe isn't an error (it's capped by /proc/sys/fs/pipe-max-size for unprivileged users), we just work with whatever size it has.
+	// -1 means fd isn't a pipe.
+	inline int get_pipe_size(int fd, size_t requested_size) noexcept {
+		if (requested_size != 0) {
+			const size_t pipe_max_size = capabilities::pipe_max_size();
+			fcntl(fd, F_SETPIPE_SZ, (int)(pipe_max_size != 0 ? std::min(requested_size, pipe_max_size) : requested_size));
+		}
+		return fcntl(fd, F_GETPIPE_SZ);
+	}
+
+	// NOTE: vmsplice is allowed to splice only part of the span (it does that whenever the pipe fills up while it's working), so we have to loop.
+	// Ignoring this silently drops the rest of the span on the floor.
+	// NOTE: vmsplice blocks whenever the pipe is full, so the time spent in here is pretty much exactly the time we spend on backpressure.
+	inline bool vmsplice_entire_span(run_t& run, struct iovec span, unsigned int splice_flags) noexcept {
+		trace::scope splice_scope("vmsplice");
+		progress::state_scope splice_state(progress::thread_t::FORMATTER, progress::state_t::WRITING);
+
+		const uint64_t splice_start_ns = asyncio::measure_wait_times ? trace::get_time_ns() : 0;
+
+		while (span.iov_len != 0) {
+			USDT_PROBE1(srcembed, vmsplice_entry, span.iov_len);
+			const ssize_t bytes_spliced = vmsplice(run.sink.fd, &span, 1, splice_flags);
+			USDT_PROBE1(srcembed, vmsplice_return, bytes_spliced);
+			run.report.vmsplice_syscall_count++;
+			if (bytes_spliced == -1) {
+				if (errno == EINTR) { continue; }
+				return false;
+			}
+			run.sink.size += bytes_spliced;
+			progress::add_output_bytes(bytes_spliced);
+			span.iov_base = (char*)span.iov_base + bytes_spliced;
+			span.iov_len -= bytes_spliced;
+		}
+
+		if (asyncio::measure_wait_times) { run.report.vmsplice_seconds += (trace::get_time_ns() - splice_start_ns) / 1000000000.0; }
+		return true;
+	}
+
+	inline constexpr size_t mmap_progress_block_size = 65536;
+
+	// The output side of both vmsplice engines: two buffers of exactly the pipe's size, filled by the kernel and vmspliced whenever one
+	// is completely full, so that every vmsplice fills the pipe in one go.
+	// A block that doesn't fit into what's left of the current buffer gets formatted into the spill buffer instead, which then tops the current
+	// buffer up and carries the rest over into the other one.
+	// NOTE: Only one buffer fits into the pipe at a time, so by the time the second buffer has been spliced, the first one has been read out
+	// and is safe to fill again.
+	// NOTE: The prologue, the epilogue and the partial page at the end are written to the sink's fd directly, there's no output stream here,
+	// it would only ever get those.
+	class pipe_buffer_output {
+		// NOTE: We separate buffers to avoid cache contention.
+		/*
+		   It works like this as far as I understand at the moment:
+		   	- if we just did "char stdoutBuffers[stdoutPipeBufferSize * 2]", that wouldn't be as efficient since
+				the stack-frame itself isn't guaranteed to be aligned to a cacheline (it's alignment is standardized most of the time I think, but it depends on the architecture and defo isn't 64 bytes).
+				Even if it were, the previous variable declarations would mess it up anyway for us. Basically, what I'm saying is "stdoutBuffers" wouldn't be aligned to a cacheline most of the time.
+					- That would cause more cache lines to be used than necessary, but it would also cause one cacheline to straddle the junction between the two buffers, which is bad.
+					--> we give one buffer at a time to the kernel, which gets played with from a different thread I believe, so it wouldn't be uncommon that the straddling cacheline
+						is pulled into two different caches at the same time ---> CACHE CONTENTION!
+						--> Not good because now both threads have to do complex locking stuff just to avoid stepping on eachother's toes when writing to the cache line. At least that would be logical.
+
+			- obviously this would not be a concern if char was 64 bytes big (size of cache line, at least thats what I'm assuming for this example), since then the alignment would be forced, but it isn't.
+			- to avoid all this, we put two pointers on the stack and have mmap allocate our buffers for us. They will probably be right after one another in memory in the case of this program, but that doesn't matter.
+				--> the point is that they will be aligned to at least the cache boundaries (since they will both start at page starts, which are definitely sufficiently aligned)
+					--> this means efficient cache usage but ALSO THAT NO CACHELINES WILL STRADDLE THE BUFFERS, so we can rest easy.
+
+			// NOTE: I admit, we could have just had one pointer in this case and allocate everything with one mmap call, since that would probably still have aligned to cachlines properly.
+			// But I think this system is better anyway since if the user was ever stupid enough to make the buffers weird non-powers-of-two sizes, this would mitigate the damage by still preventing cache contention,
+			// whereas the one pointer method would not.
+			// I don't even know if the one pointer method would work since vmsplice might require page-aligned memory input or something.
+		*/
+		// NOTE: The buffers come out of options_t::allocator now, page-aligned, so all of the above still holds.
+		run_t& run;
+		char* pipe_buffers[2] = { nullptr, nullptr };
+		bool pipe_buffer_toggle = false;
+		char* current_pipe_buffer = nullptr;
+		size_t amount_of_buffer_filled = 0;
+		size_t pipe_buffer_size = 0;
+
+		char* spill_buffer = nullptr;
+
+		uint64_t batch_start_time = 0;
+
+	public:
+		pipe_buffer_output(run_t& run) noexcept : run(run) { }
+
+		// NOTE: Nothing has been output if this fails (NOT_A_PIPE, OUT_OF_MEMORY), so the engine can still fall back.
+		error_code_t initialize() noexcept {
+			const int pipe_size = get_pipe_size(run.sink.fd, run.options.pipe_size);
+			if (pipe_size == -1) { return error_code_t::NOT_A_PIPE; }
+			pipe_buffer_size = pipe_size;
+
+			const size_t page_size = capabilities::page_size();
+			pipe_buffers[0] = (char*)allocate(run.options, pipe_buffer_size, page_size);
+			if (pipe_buffers[0] != nullptr) { pipe_buffers[1] = (char*)allocate(run.options, pipe_buffer_size, page_size); }
+			if (pipe_buffers[1] != nullptr) { spill_buffer = (char*)allocate(run.options, max_kernel_block_output); }
+			if (spill_buffer == nullptr) {
+				release();
+				return error_code_t::OUT_OF_MEMORY;
+			}
+			current_pipe_buffer = pipe_buffers[0];
+
+			batch_start_time = trace::begin();
+			return error_code_t::NONE;
+		}
+
+		// Gives the buffers back, in the reverse order of allocation.
+		void release() noexcept {
+			if (spill_buffer != nullptr) { deallocate(run.options, spill_buffer, max_kernel_block_output); }
+			if (pipe_buffers[1] != nullptr) { deallocate(run.options, pipe_buffers[1], pipe_buffer_size); }
+			if (pipe_buffers[0] != nullptr) { deallocate(run.options, pipe_buffers[0], pipe_buffer_size); }
+			spill_buffer = pipe_buffers[1] = pipe_buffers[0] = nullptr;
+		}
+
+		error_code_t append(const unsigned char* input, size_t input_size, bool first) noexcept {
+			for (size_t position = 0; position < input_size; position += kernel_block_size) {
+				const size_t block_size = std::min(kernel_block_size, input_size - position);
+				const bool first_block = first && position == 0;
+
+				if (pipe_buffer_size - amount_of_buffer_filled >= max_kernel_block_output) {
+					amount_of_buffer_filled += run.kernel.format(current_pipe_buffer + amount_of_buffer_filled, input + position, block_size, first_block);
+					continue;
+				}
+
+				const size_t spill_size = run.kernel.format(spill_buffer, input + position, block_size, first_block);
+				run.report.temp_buffer_spill_bytes += spill_size;
+				const size_t room = pipe_buffer_size - amount_of_buffer_filled;
+				if (spill_size < room) {
+					std::memcpy(current_pipe_buffer + amount_of_buffer_filled, spill_buffer, spill_size);
+					amount_of_buffer_filled += spill_size;
+					continue;
+				}
+				std::memcpy(current_pipe_buffer + amount_of_buffer_filled, spill_buffer, room);
+
+				// TODO: Future improvement possibility:
+				// You could have a separate thread and have it run vmsplice when signalled by this thread.
+				// By doing the vmsplice call asynchronously, this code doesn't have to wait for vmsplice to
+				// finish translating vm to physical mem. That would make everything a little bit faster presumably (at least in situations where the entity
+				// reading our stdout is less of a bottleneck than we are).
+				// You would just have to replace each vmsplice call with a call to a custom function, not that hard.
+				trace::end("format pipe buffer", batch_start_time);
+				if (!vmsplice_entire_span(run, { current_pipe_buffer, pipe_buffer_size }, SPLICE_F_MORE)) { return error_code_t::WRITE_FAILED; }
+				batch_start_time = trace::begin();
+
+				current_pipe_buffer = pipe_buffers[pipe_buffer_toggle = !pipe_buffer_toggle];
+
+				amount_of_buffer_filled = spill_size - room;
+				std::memcpy(current_pipe_buffer, spill_buffer + room, amount_of_buffer_filled);
+			}
+			return error_code_t::NONE;
+		}
+
+		// NOTE: vmsplice only gets the whole pages, the partial page at the end is written to the fd.
+		error_code_t finish() noexcept {
+			const size_t tail_size = amount_of_buffer_filled % capabilities::page_size();
+			trace::end("format pipe buffer", batch_start_time);
+			if (!vmsplice_entire_span(run, { current_pipe_buffer, amount_of_buffer_filled - tail_size }, SPLICE_F_GIFT)) { return error_code_t::WRITE_FAILED; }
+
+			trace::scope write_scope("write");
+			const error_code_t error = run.sink.write(current_pipe_buffer + amount_of_buffer_filled - tail_size, tail_size);
+			if (error == error_code_t::NONE) { progress::add_output_bytes(tail_size); }
+			return error;
+		}
+	};
+
+	// TODO: I can't find this anywhere online, are function parameters aligned to their natural alignment when they are passed (assuming they are passed on the stack)?
+	inline error_code_t run_mmap_vmsplice(run_t& run) noexcept {
+		run.report.record_engine(engine_t::MMAP_VMSPLICE);
+		run.report.input_bytes = run.input_size;
+		progress::total_input_bytes.store(run.input_size, std::memory_order_relaxed);
+
+		pipe_buffer_output output(run);
+		error_code_t error = output.initialize();
+		if (error != error_code_t::NONE) { return error; }
+
+		const unsigned char* input = map_input(run.input_fd, run.input_size);
+		if (input == nullptr) {
+			output.release();
+			return error_code_t::MMAP_FAILED;
+		}
+		keep_input_on_current_node(run.options, input, run.input_size);
+
+		error = write_prologue(run.sink, run.options, run.array_size);
+		for (size_t position = 0; error == error_code_t::NONE && position < run.input_size; position += mmap_progress_block_size) {
+			const size_t block_size = std::min(mmap_progress_block_size, run.input_size - position);
+			error = output.append(input + position, block_size, position == 0);
+			progress::set_input_bytes(position + block_size);
+		}
+		if (error == error_code_t::NONE) { error = output.finish(); }
+		if (error == error_code_t::NONE) { error = write_epilogue(run.sink, run.options, run.input_size); }
+
+		unmap_input(input, run.input_size);
+		output.release();
+		return error;
+	}
+
+	inline error_code_t run_mmap_write(run_t& run) noexcept {
+		run.report.record_engine(engine_t::MMAP_WRITE);
+		run.report.input_bytes = run.input_size;
+		progress::total_input_bytes.store(run.input_size, std::memory_order_relaxed);
+
+		const unsigned char* input = map_input(run.input_fd, run.input_size);
+		if (input == nullptr) { return error_code_t::MMAP_FAILED; }
+		keep_input_on_current_node(run.options, input, run.input_size);
+
+		error_code_t error = run.sink.kind == sink_t::kind_t::FD ? start_streams(run, false, true) : error_code_t::NONE;
+		sink_t& sink = output_sink(run);
+		if (error == error_code_t::NONE) { error = write_prologue(sink, run.options, run.array_size); }
+		// NOTE: The input is handed over in blocks so that --progress gets an update once per block instead of once per kernel call.
+		for (size_t position = 0; error == error_code_t::NONE && position < run.input_size; position += mmap_progress_block_size) {
+			const size_t block_size = std::min(mmap_progress_block_size, run.input_size - position);
+			error = format_and_output(run.kernel, input + position, block_size, position == 0, sink);
+			progress::set_input_bytes(position + block_size);
+		}
+		if (error == error_code_t::NONE) { error = write_epilogue(sink, run.options, run.input_size); }
+		error = finish_streams(run, error);
+
+		unmap_input(input, run.input_size);
+		return error;
+	}
+
+	inline error_code_t run_read_vmsplice(run_t& run) noexcept {
+		run.report.record_engine(engine_t::READ_VMSPLICE);
+
+		pipe_buffer_output output(run);
+		error_code_t error = output.initialize();
+		if (error != error_code_t::NONE) { return error; }
+
+		error = start_streams(run, true, false);
+		asyncio::input_stream* input = run.streams != nullptr ? &run.streams->input : nullptr;
+		for (bool first = true; error == error_code_t::NONE; first = false) {
+			const asyncio::input_stream::span_t span = input->acquire();
+			if (!span.data) { error = error_code_t::READ_FAILED; break; }
+			if (span.size == 0) {
+				if (first) { error = error_code_t::NO_DATA; }
+				break;
+			}
+			if (first) {
+				error = write_prologue(run.sink, run.options, run.array_size);
+				if (error != error_code_t::NONE) { break; }
+			}
+			error = output.append(acquired_span_data(span), span.size, first);
+			input->release(span.size);
+		}
+		if (error == error_code_t::NONE) { error = output.finish(); }
+		if (error == error_code_t::NONE) { error = write_epilogue(run.sink, run.options, run.input_size); }
+		error = finish_streams(run, error);
+
+		output.release();
+		return error;
+	}
+
+	inline constexpr size_t small_input_max_size = 65536;
+	// NOTE: Room for the prologue and epilogue, which is mostly the variable name.
+	inline constexpr size_t small_input_text_reserve = 4096;
+	inline constexpr size_t small_input_output_size = small_input_max_size * max_element_length + small_input_text_reserve;
+	// NOTE: The input first, the output right after it, see options_t::scratch.
+	inline constexpr size_t small_input_scratch_size = small_input_max_size + small_input_output_size;
+
+	// Most embedded files are tiny. For those, the stream threads, the prologue writes and the pipe buffer juggling cost more than the formatting does,
+	// so we skip all of it: one read into the scratch buffer, everything formatted into it, one write. Exec is the only thing left on the profile.
+	// NOTE: We don't vmsplice here, the output is at most a couple hundred KiB and the pipe would have to hold on to the scratch pages.
+	// NOTE: Only gets called once the input is known to fit (see run_auto_engine()).
+	inline error_code_t run_small_input(run_t& run) noexcept {
+		run.report.record_engine(engine_t::SMALL_INPUT);
+		run.report.input_bytes = run.input_size;
+		progress::total_input_bytes.store(run.input_size, std::memory_order_relaxed);
+
+		unsigned char* input = (unsigned char*)run.options.scratch;
+		{
+			trace::scope read_scope("read");
+			progress::state_scope read_state(progress::thread_t::FORMATTER, progress::state_t::READING);
+			if (read_entire_buffer(run.input_fd, input, run.input_size) != (ssize_t)run.input_size) { return error_code_t::READ_FAILED; }
+		}
+		progress::set_input_bytes(run.input_size);
+
+		char* output = (char*)run.options.scratch + small_input_max_size;
+		sink_t output_sink(output, small_input_output_size);
+		{
+			trace::scope format_scope("format small input");
+			const error_code_t error = embed_span(input, run.input_size, output_sink, run.options, run.kernel);
+			if (error != error_code_t::NONE) { return error; }
+		}
+
+		trace::scope write_scope("write");
+		progress::state_scope write_state(progress::thread_t::FORMATTER, progress::state_t::WRITING);
+		const error_code_t error = run.sink.write(output, output_sink.size);
+		if (error == error_code_t::NONE) { progress::add_output_bytes(output_sink.size); }
+		return error;
+	}
+
+	// NOTE: INPUT_TOO_LARGE and NAME_TOO_LONG both mean the output might not fit into the scratch buffer.
+	inline error_code_t small_input_requirements(const run_t& run) noexcept {
+		if (!run.input_is_regular_file) { return error_code_t::NOT_A_REGULAR_FILE; }
+		if (run.input_too_large || run.input_size > small_input_max_size) { return error_code_t::INPUT_TOO_LARGE; }
+		if (max_output_size(run.input_size, run.options) > small_input_output_size) { return error_code_t::NAME_TOO_LONG; }
+		return error_code_t::NONE;
+	}
+
+	inline bool is_pipe(int fd) noexcept {
+		struct stat status;
+		return fstat(fd, &status) == 0 && S_ISFIFO(status.st_mode);
+	}
+
+#endif
+
+	// Picks the fastest engine that works with the input and the sink. An engine that finds out it can't run after all
+	// (the pipe can't be sized, the input can't be mapped, the buffers don't fit into the allocator) returns before it has output anything,
+	// and the next one gets a go. Every engine that got skipped ends up in report_t::fallbacks.
+	inline error_code_t run_auto_engine(run_t& run) noexcept {
+#ifndef PLATFORM_WINDOWS
+		report_t& report = run.report;
+		if (run.options.scratch != nullptr) {
+			switch (small_input_requirements(run)) {
+			case error_code_t::NONE: return run_small_input(run);
+			case error_code_t::NOT_A_REGULAR_FILE: report.record_fallback(engine_t::SMALL_INPUT, "input is not a regular file"); break;
+			case error_code_t::INPUT_TOO_LARGE: report.record_fallback(engine_t::SMALL_INPUT, "input file too large"); break;
+			default: report.record_fallback(engine_t::SMALL_INPUT, "variable or section name too long"); break;
+			}
+		}
+
+		const bool sink_is_pipe = run.sink.kind == sink_t::kind_t::FD && is_pipe(run.sink.fd);
+		error_code_t error;
+
+		if (run.input_is_regular_file) {
+			if (!sink_is_pipe) { report.record_fallback(engine_t::MMAP_VMSPLICE, "sink is not a pipe"); }
+			else if (run.input_too_large) { report.record_fallback(engine_t::MMAP_VMSPLICE, "input file too large to mmap"); }
+			else {
+				switch (error = run_mmap_vmsplice(run)) {
+				case error_code_t::MMAP_FAILED:
+					report.record_fallback(engine_t::MMAP_VMSPLICE, "mmap failed");
+					goto use_read_vmsplice;
+				case error_code_t::NOT_A_PIPE: report.record_fallback(engine_t::MMAP_VMSPLICE, "failed to get pipe size"); break;
+				// NOTE: mmap_write doesn't need the pipe buffers, so it's the one to try next, not read_vmsplice.
+				case error_code_t::OUT_OF_MEMORY: report.record_fallback(engine_t::MMAP_VMSPLICE, "out of memory"); break;
+				default: return error;
+				}
+			}
+
+			// NOTE: If size_t is 32-bit and linux large file extention is enabled (off_t is 64-bit),
+			// only allow mmapping if file length can fit into size_t.
+			if (run.input_too_large) { report.record_fallback(engine_t::MMAP_WRITE, "input file too large to mmap"); }
+			else {
+				error = run_mmap_write(run);
+				if (error != error_code_t::MMAP_FAILED) { return error; }
+				report.record_fallback(engine_t::MMAP_WRITE, "mmap failed");
+			}
+			return run_read_write(run);
+		}
+
+		report.record_fallback(engine_t::MMAP_VMSPLICE, "input is not a regular file");
+		report.record_fallback(engine_t::MMAP_WRITE, "input is not a regular file");
+
+		if (sink_is_pipe) {
+use_read_vmsplice:
+			switch (error = run_read_vmsplice(run)) {
+			case error_code_t::NOT_A_PIPE: report.record_fallback(engine_t::READ_VMSPLICE, "failed to get pipe size"); break;
+			case error_code_t::OUT_OF_MEMORY: report.record_fallback(engine_t::READ_VMSPLICE, "out of memory"); break;
+			default: return error;
+			}
+		} else { report.record_fallback(engine_t::READ_VMSPLICE, "sink is not a pipe"); }
+#endif
+
+		return run_read_write(run);
+	}
+
+	// NOTE: When the engine is forced, we don't fall back to anything. Not being able to run the requested engine is an error,
+	// or else benchmarks could end up silently measuring something other than what they asked for.
+	inline error_code_t run_forced_engine(run_t& run) noexcept {
+		run.report.engine_forced = true;
+
+#ifndef PLATFORM_WINDOWS
+		switch (run.options.engine) {
+		case engine_t::SMALL_INPUT:
+			{
+				if (run.options.scratch == nullptr) { return error_code_t::INVALID_OPTIONS; }
+				const error_code_t error = small_input_requirements(run);
+				if (error != error_code_t::NONE) { return error; }
+				return run_small_input(run);
+			}
+		case engine_t::MMAP_VMSPLICE:
+		case engine_t::MMAP_WRITE:
+			if (!run.input_is_regular_file) { return error_code_t::NOT_A_REGULAR_FILE; }
+			if (run.input_too_large) { return error_code_t::INPUT_TOO_LARGE; }
+			if (run.options.engine == engine_t::MMAP_WRITE) { return run_mmap_write(run); }
+			if (run.sink.kind != sink_t::kind_t::FD) { return error_code_t::NOT_A_PIPE; }
+			return run_mmap_vmsplice(run);
+		case engine_t::READ_VMSPLICE:
+			if (run.sink.kind != sink_t::kind_t::FD) { return error_code_t::NOT_A_PIPE; }
+			return run_read_vmsplice(run);
+		default: break;
+		}
+#endif
+
+		return run_read_write(run);
+	}
+
+#ifndef PLATFORM_WINDOWS
+
+	// Sparse mode:
+	// Zero bytes are never formatted one by one. They pile up as a pending run, and what happens to the run depends on what comes after it:
+	//	- nothing (end of input): the run is dropped, the array has an explicit size and the compiler fills in the rest with zeros.
+	//	- more data: in C, runs of at least sparse_min_designated_run bytes become a designator ("[<index>] = ") in front of the next element,
+	//		shorter runs (and every run in C++, which doesn't have array designators) are written out as ", 0".
+	// NOTE: So C++ only gets the trailing zeros left out, interior zero runs stay full size. Chunk-offset encoding (the non-zero chunks as
+	// separate arrays plus an offset table) would get around that, but then the output isn't a plain "const char <varname>[]" anymore,
+	// and putting the array back together in a constexpr initializer runs into the compilers' constexpr step limits on exactly the big images
+	// sparse mode is for. Not done, C++ users with mostly-zero images are better off with the C output.
+	// NOTE: Zero runs are found a sparse_block_size block at a time, see is_zero_block().
+	inline constexpr size_t sparse_block_size = 64;
+	inline constexpr size_t sparse_read_size = 65536;
+	inline constexpr size_t sparse_output_buffer_size = 65536;
+	// NOTE: A designator is ", [<up to 20 digits>] = ", a written out zero is ", 0". Below 16 zeros, the designator doesn't reliably win.
+	inline constexpr size_t sparse_min_designated_run = 16;
+	inline constexpr size_t sparse_designator_reserve = 32;
+	static_assert(sparse_output_buffer_size >= max_kernel_block_output + sparse_designator_reserve, "sparse output buffer can't hold a formatted kernel block");
+
+	// NOTE: One OR over the whole block and one compare at the end, no early exit. That's the shape GCC and Clang turn into a handful of
+	// vector ORs and a single test (an early exit per word would keep it scalar).
+	inline bool is_zero_block(const unsigned char* data) noexcept {
+		uint64_t accumulator = 0;
+		for (size_t i = 0; i < sparse_block_size; i += sizeof(uint64_t)) {
+			uint64_t word;
+			std::memcpy(&word, data + i, sizeof(word));
+			accumulator |= word;
+		}
+		return accumulator == 0;
+	}
+
+	class sparse_output {
+		sink_t& sink;
+		char* buffer;
+		size_t amount_of_buffer_filled = 0;
+		// NOTE: Index of the next array element, including the ones that designators skipped over.
+		size_t position = 0;
+		size_t pending_zero_count = 0;
+		bool anything_written = false;
+		bool use_designators;
+
+		error_code_t make_room(size_t amount) noexcept {
+			if (sparse_output_buffer_size - amount_of_buffer_filled >= amount) { return error_code_t::NONE; }
+			const error_code_t error = sink.write(buffer, amount_of_buffer_filled);
+			if (error != error_code_t::NONE) { return error; }
+			progress::add_output_bytes(amount_of_buffer_filled);
+			amount_of_buffer_filled = 0;
+			return error_code_t::NONE;
+		}
+
+		// NOTE: first is set to whether the next element has to be formatted without the leading ", ".
+		error_code_t write_pending_zeros(bool& first) noexcept {
+			first = !anything_written;
+			if (pending_zero_count == 0) { return error_code_t::NONE; }
+
+			error_code_t error;
+			if (use_designators && pending_zero_count >= sparse_min_designated_run) {
+				if ((error = make_room(sparse_designator_reserve)) != error_code_t::NONE) { return error; }
+				position += pending_zero_count;
+				amount_of_buffer_filled += std::snprintf(buffer + amount_of_buffer_filled, sparse_designator_reserve, "%s[%zu] = ", anything_written ? ", " : "", position);
+				pending_zero_count = 0;
+				first = true;
+				return error_code_t::NONE;
+			}
+
+			position += pending_zero_count;
+			if (!anything_written) {
+				if ((error = make_room(1)) != error_code_t::NONE) { return error; }
+				buffer[amount_of_buffer_filled++] = '0';
+				pending_zero_count--;
+				anything_written = true;
+			}
+			for (; pending_zero_count != 0; pending_zero_count--) {
+				if ((error = make_room(3)) != error_code_t::NONE) { return error; }
+				std::memcpy(buffer + amount_of_buffer_filled, ", 0", 3);
+				amount_of_buffer_filled += 3;
+			}
+			first = false;
+			return error_code_t::NONE;
+		}
+
+	public:
+		// NOTE: buffer has to be sparse_output_buffer_size bytes big.
+		sparse_output(sink_t& sink, char* buffer, bool use_designators) noexcept : sink(sink), buffer(buffer), use_designators(use_designators) { }
+
+		void skip_zeros(size_t count) noexcept { pending_zero_count += count; }
+
+		// NOTE: Zeros at the edges of data would work, but they belong in skip_zeros() so they can be left out.
+		error_code_t write(const kernel_t& kernel, const unsigned char* data, size_t size) noexcept {
+			bool first;
+			error_code_t error = write_pending_zeros(first);
+			if (error != error_code_t::NONE) { return error; }
+			for (size_t offset = 0; offset < size; offset += kernel_block_size) {
+				if ((error = make_room(max_kernel_block_output)) != error_code_t::NONE) { return error; }
+				amount_of_buffer_filled += kernel.format(buffer + amount_of_buffer_filled, data + offset, std::min(kernel_block_size, size - offset), first && offset == 0);
+			}
+			position += size;
+			anything_written = true;
+			return error_code_t::NONE;
+		}
+
+		// NOTE: Whatever zeros are still pending at this point are the trailing ones, those are left to the explicit array size.
+		// An all-zero input still needs one element though, an empty initializer list isn't valid C before C23.
+		error_code_t finish() noexcept {
+			if (!anything_written) {
+				const error_code_t error = make_room(1);
+				if (error != error_code_t::NONE) { return error; }
+				buffer[amount_of_buffer_filled++] = '0';
+			}
+			const error_code_t error = sink.write(buffer, amount_of_buffer_filled);
+			if (error == error_code_t::NONE) { progress::add_output_bytes(amount_of_buffer_filled); }
+			amount_of_buffer_filled = 0;
+			return error;
+		}
+	};
+
+	// Splits data into zero runs and the stretches of data in between, and hands them to output.
+	// NOTE: A stretch of data ends in front of the next all-zero block, so zero runs shorter than a block stay inside of it
+	// (apart from the ones at its edges) and get written out as zeros. Those are too short for a designator to pay off anyway.
+	inline error_code_t sparse_output_data(sparse_output& output, const kernel_t& kernel, const unsigned char* data, size_t size) noexcept {
+		size_t position = 0;
+		while (position < size) {
+			size_t data_begin = position;
+			while (size - data_begin >= sparse_block_size && is_zero_block(data + data_begin)) { data_begin += sparse_block_size; }
+			while (data_begin < size && data[data_begin] == 0) { data_begin++; }
+			output.skip_zeros(data_begin - position);
+			if (data_begin == size) { return error_code_t::NONE; }
+
+			size_t data_end = std::min(data_begin + sparse_block_size, size);
+			while (size - data_end >= sparse_block_size && !is_zero_block(data + data_end)) { data_end += sparse_block_size; }
+			if (size - data_end < sparse_block_size) { data_end = size; }
+			while (data[data_end - 1] == 0) { data_end--; }
+
+			const error_code_t error = output.write(kernel, data + data_begin, data_end - data_begin);
+			if (error != error_code_t::NONE) { return error; }
+			position = data_end;
+		}
+		return error_code_t::NONE;
+	}
+
+	// The input is walked extent by extent with SEEK_DATA/SEEK_HOLE. Holes go straight into the pending zero run without being read,
+	// the data extents are pread() in sparse_read_size blocks and searched for zero runs (a lot of "data" in disk images is zeros too).
+	// NOTE: File systems without hole tracking report the whole file as one data extent, kernels that don't know SEEK_DATA at all
+	// return EINVAL, which we treat the same way.
+	// NOTE: We use pread() so that the lseek() calls are the only thing that touches the file offset.
+	inline error_code_t format_sparse_input(run_t& run, unsigned char* input, sparse_output& output) noexcept {
+		const off_t input_size = run.input_size;
+		trace::scope format_scope("format sparse input");
+		for (off_t offset = 0; offset < input_size;) {
+			off_t data_begin = lseek(run.input_fd, offset, SEEK_DATA);
+			off_t data_end;
+			if (data_begin == -1 && errno == ENXIO) { data_begin = data_end = input_size; }
+			else if (data_begin == -1 && errno == EINVAL) {
+				data_begin = offset;
+				data_end = input_size;
+			} else {
+				if (data_begin == -1) { return error_code_t::READ_FAILED; }
+				data_end = lseek(run.input_fd, data_begin, SEEK_HOLE);
+				if (data_end == -1) { return error_code_t::READ_FAILED; }
+			}
+			// NOTE: Anything that got appended since the fstat() isn't part of the array.
+			data_begin = std::min(data_begin, input_size);
+			data_end = std::min(data_end, input_size);
+
+			output.skip_zeros(data_begin - offset);
+			for (offset = data_begin; offset < data_end;) {
+				ssize_t bytes_read;
+				{
+					progress::state_scope read_state(progress::thread_t::FORMATTER, progress::state_t::READING);
+					bytes_read = pread(run.input_fd, input, std::min((off_t)sparse_read_size, data_end - offset), offset);
+				}
+				if (bytes_read == -1 && errno == EINTR) { continue; }
+				// NOTE: 0 means the file shrank since the fstat().
+				if (bytes_read <= 0) { return error_code_t::READ_FAILED; }
+				const error_code_t error = sparse_output_data(output, run.kernel, input, bytes_read);
+				if (error != error_code_t::NONE) { return error; }
+				offset += bytes_read;
+				progress::set_input_bytes(offset);
+			}
+			offset = data_end;
+			progress::set_input_bytes(offset);
+		}
+		return output.finish();
+	}
+
+	inline error_code_t embed_sparse(run_t& run) noexcept {
+		if (!run.input_is_regular_file) { return error_code_t::NOT_A_REGULAR_FILE; }
+		if (run.input_too_large) { return error_code_t::INPUT_TOO_LARGE; }
+		run.report.input_bytes = run.input_size;
+		progress::total_input_bytes.store(run.input_size, std::memory_order_relaxed);
+
+		unsigned char* input = (unsigned char*)allocate(run.options, sparse_read_size, capabilities::page_size());
+		if (input == nullptr) { return error_code_t::OUT_OF_MEMORY; }
+		char* output_buffer = (char*)allocate(run.options, sparse_output_buffer_size);
+		if (output_buffer == nullptr) {
+			deallocate(run.options, input, sparse_read_size);
+			return error_code_t::OUT_OF_MEMORY;
+		}
+		sparse_output output(run.sink, output_buffer, run.options.language == language_t::C);
+
+		// NOTE: The array size is always explicit here, that's what makes leaving out the trailing zeros work.
+		error_code_t error = write_prologue(run.sink, run.options, run.options.pad_to_alignment ? run.array_size : run.input_size);
+		if (error == error_code_t::NONE) { error = format_sparse_input(run, input, output); }
+		if (error == error_code_t::NONE) { error = write_epilogue(run.sink, run.options, run.input_size); }
+
+		deallocate(run.options, output_buffer, sparse_output_buffer_size);
+		deallocate(run.options, input, sparse_read_size);
+		return error;
+	}
+
+	// Split mode:
+	// The parts are written (in parallel) to "<varname>_part_<index>.<c/cpp>" in the working directory, the sink gets a header that declares them.
+	// NOTE: Every part (except the last one) is made to be a multiple of this, so that the aligned part arrays sit right next to each other
+	// in the output section without any padding in between.
+	inline constexpr size_t split_part_alignment = 64;
+
+	inline constexpr size_t split_part_buffer_size = 65536;
+	// NOTE: The part's file name and prologue are formatted into its buffer, in front of the elements. Mostly the variable name.
+	inline constexpr size_t max_split_part_text_length = 4096;
+	static_assert(split_part_buffer_size >= max_split_part_text_length + max_kernel_block_output, "split part buffer can't hold the prologue and a formatted kernel block");
+
+	inline constexpr size_t split_header_buffer_size = 65536;
+
+	inline constexpr size_t max_split_thread_count = 256;
+
+	// Where the parts start. The input is cut into split_part_alignment byte blocks (the last one can be short) and every part gets whole blocks:
+	//	- split_size: the same amount for every part (but the last, which gets what's left).
+	//	- split_count: the blocks are spread as evenly as possible, so that there are exactly as many parts as asked for.
+	//		The first extra_block_count parts get one block more than the others.
+	struct split_layout_t {
+		size_t input_size;
+		size_t part_count;
+		size_t blocks_per_part;
+		size_t extra_block_count = 0;
+
+		size_t part_offset(size_t part_index) const noexcept {
+			return std::min((part_index * blocks_per_part + std::min(part_index, extra_block_count)) * split_part_alignment, input_size);
+		}
+
+		size_t part_size(size_t part_index) const noexcept { return part_offset(part_index + 1) - part_offset(part_index); }
+	};
+
+	// Formatted text through a buffer, for the split header (which is a couple of short lines per part).
+	class text_output {
+		sink_t& sink;
+		char* buffer;
+		size_t capacity;
+		size_t size = 0;
+
+	public:
+		text_output(sink_t& sink, char* buffer, size_t capacity) noexcept : sink(sink), buffer(buffer), capacity(capacity) { }
+
+		// NOTE: Text that doesn't fit into the whole buffer is NAME_TOO_LONG, the variable name is the only thing in there that can get long.
+		error_code_t print(const char* format, ...) noexcept {
+			for (bool flushed = false; ; flushed = true) {
+				va_list arguments;
+				va_start(arguments, format);
+				const int length = std::vsnprintf(buffer + size, capacity - size, format, arguments);
+				va_end(arguments);
+				if (length < 0) { return error_code_t::NAME_TOO_LONG; }
+				if ((size_t)length < capacity - size) {
+					size += length;
+					return error_code_t::NONE;
+				}
+				if (flushed) { return error_code_t::NAME_TOO_LONG; }
+				const error_code_t error = flush();
+				if (error != error_code_t::NONE) { return error; }
+			}
+		}
+
+		error_code_t flush() noexcept {
+			const error_code_t error = sink.write(buffer, size);
+			size = 0;
+			return error;
+		}
+	};
+
+	inline error_code_t write_split_header(run_t& run, const split_layout_t& layout) noexcept {
+		char* buffer = (char*)allocate(run.options, split_header_buffer_size);
+		if (buffer == nullptr) { return error_code_t::OUT_OF_MEMORY; }
+		text_output header(run.sink, buffer, split_header_buffer_size);
+
+		const bool is_cpp = run.options.language == language_t::CPP;
+		const char* const varname = run.options.varname;
+		error_code_t error = header.print("#pragma once\n\n#include %s\n\n", is_cpp ? "<cstddef>" : "<stddef.h>");
+		for (size_t i = 0; error == error_code_t::NONE && i < layout.part_count; i++) {
+			error = header.print("extern const char %s_part_%zu[%zu];\n", varname, i, layout.part_size(i));
+		}
+		// NOTE: The parts are separate arrays, so the tables are the only well-defined way through all of the data.
+		// The contiguous pointer reads past the end of part 0, which the compiler is allowed to assume never happens (LTO does act on that).
+		const char* const storage = is_cpp ? "" : "static ";
+		const char* const size_type = is_cpp ? "std::size_t" : "size_t";
+		if (error == error_code_t::NONE) { error = header.print("\n%sconst char* const %s_parts[] = { ", storage, varname); }
+		for (size_t i = 0; error == error_code_t::NONE && i < layout.part_count; i++) {
+			error = header.print("%s%s_part_%zu", i == 0 ? "" : ", ", varname, i);
+		}
+		if (error == error_code_t::NONE) { error = header.print(" };\n%sconst %s %s_part_sizes[] = { ", storage, size_type, varname); }
+		for (size_t i = 0; error == error_code_t::NONE && i < layout.part_count; i++) {
+			error = header.print("%s%zu", i == 0 ? "" : ", ", layout.part_size(i));
+		}
+		if (error == error_code_t::NONE) {
+			error = header.print(" };\n%sconst %s %s_part_count = %zu;\n\n" \
+					     "// NOTE: Reading past %s_part_0 through %s only works without LTO and with the part objects linked in order, use %s_parts otherwise.\n" \
+					     "%sconst char* const %s = %s_part_0;\n%sconst %s %s_size = %zu;\n",
+					     storage, size_type, varname, layout.part_count,
+					     varname, varname, varname,
+					     storage, varname, varname, storage, size_type, varname, layout.input_size);
+		}
+		if (error == error_code_t::NONE) { error = header.flush(); }
+
+		deallocate(run.options, buffer, split_header_buffer_size);
+		return error;
+	}
+
+	// NOTE: Unlike the engines, this doesn't touch the sink at all, it writes one part of the input into its own file.
+	// That's what allows multiple threads to run it at the same time without stepping on each other's toes.
+	// NOTE: buffer has to be split_part_buffer_size bytes big. Every worker brings its own.
+	inline error_code_t write_split_part(const run_t& run, char* buffer, const unsigned char* part_data, size_t part_size, size_t part_index, size_t part_count) noexcept {
+		const bool is_cpp = run.options.language == language_t::CPP;
+
+		int text_length = std::snprintf(buffer, max_split_part_text_length, "%s_part_%zu.%s", run.options.varname, part_index, is_cpp ? "cpp" : "c");
+		if (text_length < 0 || (size_t)text_length >= max_split_part_text_length) { return error_code_t::NAME_TOO_LONG; }
+
+		const int fd = open(buffer, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd == -1) { return error_code_t::PART_FAILED; }
+
+		// NOTE: The array sizes are explicit so that the header can declare them with their sizes as well.
+		// NOTE: The parts are only referred to through the header's tables, which get dropped wherever nothing reads them.
+		// "used" keeps the compiler from dropping them, "retain" (GCC 11+, Clang 13+) keeps the linker from dropping them with --gc-sections.
+		// Toolchains without retain need a KEEP(*(.srcembed)) in the linker script if they collect garbage sections.
+		text_length = std::snprintf(buffer, max_split_part_text_length, "// part %zu of %zu, generated by srcembed\n" \
+									       "#if defined(__GNUC__)\n" \
+									       "#if defined(__has_attribute)\n" \
+									       "#if __has_attribute(retain)\n" \
+									       "__attribute__((retain))\n" \
+									       "#endif\n" \
+									       "#endif\n" \
+									       "__attribute__((section(\".srcembed\"), aligned(%zu), used))\n" \
+									       "#endif\n" \
+									       "%sconst char %s_part_%zu[%zu]%s{ ",
+					    part_index, part_count, split_part_alignment, is_cpp ? "extern " : "", run.options.varname, part_index, part_size, is_cpp ? " " : " = ");
+		if (text_length < 0 || (size_t)text_length >= max_split_part_text_length) {
+			close(fd);
+			return error_code_t::NAME_TOO_LONG;
+		}
+
+		bool written = true;
+		size_t amount_of_buffer_filled = text_length;
+		for (size_t position = 0; written && position < part_size; position += kernel_block_size) {
+			if (amount_of_buffer_filled > split_part_buffer_size - max_kernel_block_output) {
+				written = write_entire_buffer(fd, buffer, amount_of_buffer_filled);
+				amount_of_buffer_filled = 0;
+			}
+			amount_of_buffer_filled += run.kernel.format(buffer + amount_of_buffer_filled, part_data + position, std::min(kernel_block_size, part_size - position), position == 0);
+		}
+		written = written && write_entire_buffer(fd, buffer, amount_of_buffer_filled) && write_entire_buffer(fd, " };\n", sizeof(" };\n") - 1);
+
+		if (close(fd) == -1 || !written) { return error_code_t::PART_FAILED; }
+		return error_code_t::NONE;
+	}
+
+	struct alignas(cache_line_size) split_slice_t {
+		// NOTE: Parts are handed out one by one instead of in fixed ranges, so that a slow disk or an unlucky scheduling
+		// decision for one worker doesn't hold up the whole thing.
+		std::atomic<size_t> next_part_index;
+		size_t end_part_index;
+	};
+
+	// NOTE: A couple of KiB, so it comes out of the allocator instead of off the caller's stack.
+	struct split_workers_t {
+		split_slice_t slices[topology::max_numa_nodes];
+		std::thread threads[max_split_thread_count];
+		// NOTE: The first part that fails stops the others, its error is the one that gets returned.
+		std::atomic<error_code_t> error { error_code_t::NONE };
+	};
+
+	// NUMA: with more than one node, the parts are cut into one contiguous slice per node. Every slice of the input gets bound (and moved)
+	// to its node, and the workers are spread over the nodes round-robin and pinned to their node's cpus, so every worker formats
+	// from local input pages into a local buffer. Once a worker's own slice is done, it helps out with the other slices,
+	// a few remote reads at the end are better than an idle node.
+	// NOTE: On a single node machine there's one slice that covers everything, no binding and no pinning, and the calling thread is one of the workers.
+	// On NUMA machines, it only waits, its affinity isn't ours to change.
+	inline error_code_t write_split_parts(run_t& run, const split_layout_t& layout, const unsigned char* input) noexcept {
+		const options_t& options = run.options;
+		const size_t part_count = layout.part_count;
+		const size_t thread_count = std::min(std::min(part_count, options.split_thread_count != 0 ? options.split_thread_count : capabilities::core_count()), max_split_thread_count);
+		const size_t node_count = std::min(std::min((size_t)topology::numa_node_count(), part_count), thread_count);
+
+		void* memory = allocate(options, sizeof(split_workers_t), alignof(split_workers_t));
+		if (memory == nullptr) { return error_code_t::OUT_OF_MEMORY; }
+		// NOTE: All of the part buffers are allocated here, so that the allocator only ever gets called from the calling thread.
+		// Page-aligned on NUMA machines, so that no two workers on different nodes share a buffer page.
+		const size_t buffers_size = thread_count * split_part_buffer_size;
+		char* buffers = (char*)allocate(options, buffers_size, node_count > 1 ? capabilities::page_size() : cache_line_size);
+		if (buffers == nullptr) {
+			deallocate(options, memory, sizeof(split_workers_t));
+			return error_code_t::OUT_OF_MEMORY;
+		}
+		split_workers_t& workers = *new (memory) split_workers_t();
+
+		for (size_t node = 0; node < node_count; node++) {
+			const size_t begin_part_index = part_count * node / node_count;
+			workers.slices[node].next_part_index = begin_part_index;
+			workers.slices[node].end_part_index = part_count * (node + 1) / node_count;
+			if (node_count > 1) {
+				const size_t slice_begin = layout.part_offset(begin_part_index);
+				topology::bind_to_node(input + slice_begin, layout.part_offset(workers.slices[node].end_part_index) - slice_begin, node);
+			}
+		}
+
+		auto worker_code = [&](size_t worker_index) noexcept {
+			const size_t node = worker_index % node_count;
+			char* buffer = buffers + worker_index * split_part_buffer_size;
+			if (node_count > 1) {
+				topology::pin_current_thread_to_node(node);
+				topology::bind_to_node(buffer, split_part_buffer_size, node);
+			}
+			for (size_t slice_offset = 0; slice_offset < node_count; slice_offset++) {
+				split_slice_t& slice = workers.slices[(node + slice_offset) % node_count];
+				for (size_t i = slice.next_part_index++; i < slice.end_part_index; i = slice.next_part_index++) {
+					if (workers.error.load(std::memory_order_relaxed) != error_code_t::NONE) { return; }
+					const error_code_t error = write_split_part(run, buffer, input + layout.part_offset(i), layout.part_size(i), i, part_count);
+					if (error != error_code_t::NONE) {
+						error_code_t expected = error_code_t::NONE;
+						workers.error.compare_exchange_strong(expected, error);
+						return;
+					}
+				}
+			}
+		};
+
+		const size_t first_spawned_worker = node_count > 1 ? 0 : 1;
+		for (size_t i = first_spawned_worker; i < thread_count; i++) { workers.threads[i] = std::thread(worker_code, i); }
+		if (first_spawned_worker != 0) { worker_code(0); }
+		for (size_t i = first_spawned_worker; i < thread_count; i++) { workers.threads[i].join(); }
+
+		const error_code_t error = workers.error.load(std::memory_order_relaxed);
+		workers.~split_workers_t();
+		deallocate(options, buffers, buffers_size);
+		deallocate(options, memory, sizeof(split_workers_t));
+		return error;
+	}
+
+	inline error_code_t embed_split(run_t& run) noexcept {
+		if (!run.input_is_regular_file) { return error_code_t::NOT_A_REGULAR_FILE; }
+		if (run.input_too_large) { return error_code_t::INPUT_TOO_LARGE; }
+		const size_t input_size = run.input_size;
+		run.report.input_bytes = input_size;
+
+		const size_t block_count = input_size / split_part_alignment + (input_size % split_part_alignment != 0);
+		split_layout_t layout;
+		layout.input_size = input_size;
+		if (run.options.split_size != 0) {
+			layout.blocks_per_part = std::min(run.options.split_size / split_part_alignment + (run.options.split_size % split_part_alignment != 0), block_count);
+			layout.part_count = block_count / layout.blocks_per_part + (block_count % layout.blocks_per_part != 0);
+		} else {
+			// NOTE: Every part needs at least one block, and empty parts would be zero-length arrays, which C and C++ don't allow.
+			if (run.options.split_count > block_count) { return error_code_t::INPUT_TOO_SMALL; }
+			layout.part_count = run.options.split_count;
+			layout.blocks_per_part = block_count / layout.part_count;
+			layout.extra_block_count = block_count % layout.part_count;
+		}
+
+		const unsigned char* input = map_input(run.input_fd, input_size);
+		if (input == nullptr) { return error_code_t::MMAP_FAILED; }
+
+		error_code_t error = write_split_header(run, layout);
+		if (error == error_code_t::NONE) { error = write_split_parts(run, layout, input); }
+
+		unmap_input(input, input_size);
+		return error;
+	}
+
+#endif
+
+	// NOTE: Nothing reaches the sink if the input turns out to be empty (NO_DATA), the options are invalid or the input or sink doesn't meet
+	// the requirements of the engine or mode (NOT_A_REGULAR_FILE, NOT_A_PIPE, INPUT_TOO_LARGE, INPUT_TOO_SMALL, and OUT_OF_MEMORY for the engines).
+	// Any other error can leave partial output behind in the sink.
+	// NOTE: report is optional, see report_t.
+	inline error_code_t embed(input_t input, sink_t& sink, const options_t& options = { }, report_t* report = nullptr) noexcept {
+		const kernel_t* kernel = select_kernel(options.chunk_size);
+		if (kernel == nullptr || !valid_options(options) || !valid_sink(sink)) { return error_code_t::INVALID_OPTIONS; }
+		report_t unused_report;
+		if (report == nullptr) { report = &unused_report; }
+		const size_t initial_sink_size = sink.size;
+
+		if (input.fd == -1) {
+			if (is_split(options) || options.sparse || options.engine != engine_t::AUTO) { return error_code_t::INVALID_OPTIONS; }
+			if (input.size == 0) { return error_code_t::NO_DATA; }
+			report->input_bytes = input.size;
+			const error_code_t error = embed_span(input.data, input.size, sink, options, *kernel);
+			report->output_bytes = sink.size - initial_sink_size;
+			return error;
+		}
+
+		run_t run { options, *kernel, sink, *report, input.fd };
+#ifndef PLATFORM_WINDOWS
+		struct stat status;
+		if (fstat(input.fd, &status) == -1) { return error_code_t::READ_FAILED; }
+		if (S_ISREG(status.st_mode)) {
+			if (status.st_size == 0) { return error_code_t::NO_DATA; }
+			run.input_is_regular_file = true;
+			if (sizeof(size_t) < sizeof(off_t) && (unsigned long long)status.st_size > (size_t)-1) { run.input_too_large = true; }
+			else { run.input_size = status.st_size; }
+		}
+#endif
+		// NOTE: With pad_to_alignment, the array size is part of the prologue, so the input size has to be known before anything is read.
+		if (options.pad_to_alignment) {
+			if (!run.input_is_regular_file) { return error_code_t::NOT_A_REGULAR_FILE; }
+			if (run.input_too_large) { return error_code_t::INPUT_TOO_LARGE; }
+			run.array_size = padded_array_size(run.input_size, options);
+		}
+
+		error_code_t error;
+#ifndef PLATFORM_WINDOWS
+		if (is_split(options)) { error = embed_split(run); }
+		else if (options.sparse) { error = embed_sparse(run); }
+		else
+#endif
+		error = options.engine == engine_t::AUTO ? run_auto_engine(run) : run_forced_engine(run);
+		report->output_bytes = sink.size - initial_sink_size;
+		return error;
+	}
+
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+// CPU topology (from /sys/devices/system/cpu) and thread placement for --pin.
+// The formatter hands a buffer to the reader or the flusher every 64 KiB or so, and every one of those handovers is a cache line
+// (the flag) and then a whole buffer moving between cores. Between two cores that share an L2 or L3 that's cheap,
+// between sockets (or L3 domains on chiplet CPUs) it isn't, and the scheduler doesn't know that these three threads belong together.
+// NOTE: Buffers end up on the NUMA node of the thread that touches them first (see arena.h), so once the threads are pinned close together,
+// their buffers are local to them as well.
+// NUMA nodes (from /sys/devices/system/node) are down here too. Memory policies are set with the raw mbind syscall,
+// libnuma would be a whole runtime dependency for the one call we need.
+
+#include "crossplatform_io.h"
+
+#ifdef PLATFORM_WINDOWS
+#error "topology.h" header file cannot be included when compiling for Windows
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+#include "capabilities.h"
+
+namespace topology {
+
+	inline constexpr size_t max_placement_threads = 3;
+
+	struct placement_t {
+		int cpus[max_placement_threads];
+		size_t count = 0;
+		// NOTE: The smallest cache level that all of the chosen cpus share.
+		uint8_t shared_cache_level = 0;
+	};
+
+	// Parses the kernel's cpu list format ("0-3,8,10-11\n").
+	inline bool parse_cpu_list(const char* text, cpu_set_t& result) noexcept {
+		CPU_ZERO(&result);
+		while (*text != '\0' && *text != '\n') {
+			char* end;
+			const unsigned long first = std::strtoul(text, &end, 10);
+			if (end == text) { return false; }
+			unsigned long last = first;
+			text = end;
+			if (*text == '-') {
+				last = std::strtoul(text + 1, &end, 10);
+				if (end == text + 1 || last < first) { return false; }
+				text = end;
+			}
+			if (last >= CPU_SETSIZE) { return false; }
+			for (unsigned long cpu = first; cpu <= last; cpu++) { CPU_SET(cpu, &result); }
+			if (*text == ',') { text++; }
+		}
+		return true;
+	}
+
+	inline bool read_small_file(const char* path, char* buffer, size_t buffer_size) noexcept {
+		const int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd == -1) { return false; }
+		const ssize_t bytes_read = read_entire_buffer(fd, buffer, buffer_size - 1);
+		close(fd);
+		if (bytes_read <= 0) { return false; }
+		buffer[bytes_read] = '\0';
+		return true;
+	}
+
+	inline bool read_cpu_list_file(const char* path, cpu_set_t& result) noexcept {
+		char buffer[4096];
+		return read_small_file(path, buffer, sizeof(buffer)) && parse_cpu_list(buffer, result);
+	}
+
+	// The cpus that share the data (or unified) cache of the given level with cpu.
+	inline bool cache_domain(int cpu, uint8_t level, cpu_set_t& result) noexcept {
+		for (unsigned int index = 0; ; index++) {
+			char path[128];
+			std::snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%u/level", cpu, index);
+			size_t cache_level;
+			if (!capabilities::read_number_file(path, cache_level)) { return false; }
+			if (cache_level != level) { continue; }
+
+			char type[32];
+			std::snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%u/type", cpu, index);
+			if (!read_small_file(path, type, sizeof(type)) || std::strncmp(type, "Instruction", 11) == 0) { continue; }
+
+			std::snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%u/shared_cpu_list", cpu, index);
+			return read_cpu_list_file(path, result);
+		}
+	}
+
+	inline bool thread_siblings(int cpu, cpu_set_t& result) noexcept {
+		char path[128];
+		std::snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+		return read_cpu_list_file(path, result);
+	}
+
+	// NOTE: 0 if there's no such level (or we couldn't find out).
+	inline uint8_t shared_cache_level(const placement_t& placement) noexcept {
+		for (uint8_t level = 2; level <= 3; level++) {
+			cpu_set_t domain;
+			if (!cache_domain(placement.cpus[0], level, domain)) { continue; }
+			bool shared = true;
+			for (size_t i = 1; i < placement.count; i++) { shared &= CPU_ISSET(placement.cpus[i], &domain) != 0; }
+			if (shared) { return level; }
+		}
+		return 0;
+	}
+
+	// Picks thread_count cpus for the formatter and its stream threads, the formatter's first:
+	//	- the formatter stays on the cpu it's running on right now.
+	//	- the others go into the smallest cache domain (L2, then L3) around it that has enough allowed cpus, falling back to any allowed cpus.
+	//	- inside of that domain, other cores come before the formatter's own SMT siblings, since a spinning thread on the same core
+	//		takes execution resources away from the formatter.
+	// NOTE: Returns false if there aren't enough allowed cpus to give every thread its own, pinning would only make things worse then.
+	inline bool auto_placement(size_t thread_count, placement_t& result) noexcept {
+		cpu_set_t allowed;
+		if (thread_count > max_placement_threads || sched_getaffinity(0, sizeof(allowed), &allowed) == -1) { return false; }
+		if ((size_t)CPU_COUNT(&allowed) < thread_count) { return false; }
+
+		int anchor = sched_getcpu();
+		if (anchor == -1 || !CPU_ISSET(anchor, &allowed)) {
+			for (anchor = 0; !CPU_ISSET(anchor, &allowed); anchor++) { }
+		}
+
+		cpu_set_t candidates = allowed;
+		for (uint8_t level = 2; level <= 3; level++) {
+			cpu_set_t domain;
+			if (!cache_domain(anchor, level, domain)) { continue; }
+			CPU_AND(&domain, &domain, &allowed);
+			if ((size_t)CPU_COUNT(&domain) < thread_count) { continue; }
+			candidates = domain;
+			break;
+		}
+
+		cpu_set_t siblings;
+		if (!thread_siblings(anchor, siblings)) { CPU_ZERO(&siblings); }
+
+		result.cpus[0] = anchor;
+		result.count = 1;
+		for (int pass = 0; pass < 2 && result.count < thread_count; pass++) {
+			for (int cpu = 0; cpu < CPU_SETSIZE && result.count < thread_count; cpu++) {
+				if (cpu == anchor || !CPU_ISSET(cpu, &candidates)) { continue; }
+				// NOTE: First pass skips the siblings, second pass only takes the siblings.
+				if ((bool)CPU_ISSET(cpu, &siblings) != (pass == 1)) { continue; }
+				result.cpus[result.count++] = cpu;
+			}
+		}
+		if (result.count != thread_count) { return false; }
+		result.shared_cache_level = shared_cache_level(result);
+		return true;
+	}
+
+	inline bool pin_current_thread(int cpu) noexcept {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return sched_setaffinity(0, sizeof(set), &set) == 0;
+	}
+
+	// NOTE: Node numbers are small and contiguous in practice, anything past this is treated like a single node machine.
+	inline constexpr int max_numa_nodes = 64;
+
+	inline capabilities::lazy_t<int> cached_numa_node_count;
+
+	// NOTE: 1 if the kernel has no NUMA support or we can't tell, which is exactly the case where NUMA doesn't matter.
+	inline int numa_node_count() noexcept {
+		if (cached_numa_node_count.is_known()) { return cached_numa_node_count.get(); }
+		cpu_set_t nodes;
+		// NOTE: The node list has the same format as a cpu list.
+		if (!read_cpu_list_file("/sys/devices/system/node/online", nodes) || CPU_COUNT(&nodes) < 1) { return cached_numa_node_count.set(1); }
+		int count = 0;
+		while (count < max_numa_nodes && CPU_ISSET(count, &nodes)) { count++; }
+		// NOTE: Holes in the node numbering (offline or memoryless nodes) aren't worth handling, we just don't do NUMA then.
+		return cached_numa_node_count.set(count == CPU_COUNT(&nodes) ? count : 1);
+	}
+
+	inline bool node_cpus(int node, cpu_set_t& result) noexcept {
+		char path[128];
+		std::snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		return read_cpu_list_file(path, result);
+	}
+
+	// NOTE: -1 if we can't find out.
+	inline int node_of_cpu(int cpu) noexcept {
+		if (cpu < 0) { return -1; }
+		for (int node = 0; node < numa_node_count(); node++) {
+			cpu_set_t cpus;
+			if (node_cpus(node, cpus) && CPU_ISSET(cpu, &cpus)) { return node; }
+		}
+		return -1;
+	}
+
+	// Restricts the current thread to the (allowed) cpus of the given node.
+	// NOTE: Doesn't do anything if none of the node's cpus are allowed, a thread with an empty affinity mask can't run at all.
+	inline bool pin_current_thread_to_node(int node) noexcept {
+		cpu_set_t cpus;
+		cpu_set_t allowed;
+		if (!node_cpus(node, cpus) || sched_getaffinity(0, sizeof(allowed), &allowed) == -1) { return false; }
+		CPU_AND(&cpus, &cpus, &allowed);
+		if (CPU_COUNT(&cpus) == 0) { return false; }
+		return sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+	}
+
+	// Binds [address, address + length) to the given node and moves the pages that are already somewhere else over to it.
+	// NOTE: address gets rounded down to the page it's in (mbind only takes page-aligned ranges), so the binding covers a bit more
+	// than asked for at the start. Neighbouring ranges that get bound to different nodes fight over the shared page, that's fine.
+	// NOTE: This is best effort. Pages that are mapped by other processes as well (shared page cache pages) don't get moved
+	// without CAP_SYS_NICE (MPOL_MF_MOVE only moves pages that are exclusively ours), they stay where they are and get read remotely.
+	inline bool bind_to_node(const void* address, size_t length, int node) noexcept {
+		if (node < 0 || node >= max_numa_nodes || length == 0) { return false; }
+		constexpr int mpol_bind = 2;
+		constexpr unsigned int mpol_mf_move = 1 << 1;
+		const uintptr_t page_size = capabilities::page_size();
+		const uintptr_t begin = (uintptr_t)address / page_size * page_size;
+		const unsigned long node_mask = 1UL << node;
+		// NOTE: maxnode is the number of bits in the mask (the kernel ignores the last bit for historical reasons, so we give it one more).
+		return syscall(SYS_mbind, begin, (uintptr_t)address + length - begin, mpol_bind, &node_mask, sizeof(node_mask) * 8 + 1, mpol_mf_move) == 0;
+	}
+
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+// Timeline tracing, written out in the Chrome trace event format (which Perfetto and chrome://tracing can both open).
+// Every thread that wants to be traced registers itself and gets its own event buffer, which only it ever writes to.
+// That means recording an event is just a couple of stores, no locks and no atomics.
+// The buffers are only read once all the traced threads are done.
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+namespace trace {
+
+	struct event_t {
+		const char* name;
+		uint64_t start_ns;
+		uint64_t duration_ns;
+	};
+
+	struct thread_buffer_t {
+		const char* thread_name;
+		event_t* events;
+		size_t event_count;
+		size_t dropped_event_count;
+	};
+
+	inline constexpr size_t max_thread_count = 8;
+	// NOTE: 24 bytes per event, so this is 6MiB per thread. Events past that are dropped (and counted), the trace doesn't grow without bound.
+	inline constexpr size_t max_events_per_thread = 1 << 18;
+
+	// NOTE: Only ever set before any of the traced threads start, so it doesn't need to be atomic.
+	inline bool enabled = false;
+
+	inline thread_buffer_t thread_buffers[max_thread_count];
+	inline std::atomic<size_t> registered_thread_count = 0;
+	inline thread_local thread_buffer_t* current_thread_buffer = nullptr;
+
+	inline uint64_t get_time_ns() noexcept {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// NOTE: Has to be called on the thread that's being registered. If we're out of slots or memory, the thread simply isn't traced.
+	inline void register_thread(const char* thread_name) noexcept {
+		const size_t index = registered_thread_count.fetch_add(1, std::memory_order_relaxed);
+		if (index >= max_thread_count) { return; }
+
+		thread_buffer_t& buffer = thread_buffers[index];
+		buffer.thread_name = thread_name;
+		buffer.events = (event_t*)std::malloc(max_events_per_thread * sizeof(event_t));
+		if (buffer.events == nullptr) { return; }
+		current_thread_buffer = &buffer;
+	}
+
+	inline void record(const char* name, uint64_t start_ns, uint64_t duration_ns) noexcept {
+		thread_buffer_t* buffer = current_thread_buffer;
+		if (buffer == nullptr) { return; }
+		if (buffer->event_count == max_events_per_thread) {
+			buffer->dropped_event_count++;
+			return;
+		}
+		buffer->events[buffer->event_count++] = { name, start_ns, duration_ns };
+	}
+
+	// For spans that don't map nicely onto a C++ scope.
+	inline uint64_t begin() noexcept { return enabled ? get_time_ns() : 0; }
+
+	inline void end(const char* name, uint64_t start_ns) noexcept {
+		if (!enabled) { return; }
+		record(name, start_ns, get_time_ns() - start_ns);
+	}
+
+	class scope {
+		const char* name;
+		uint64_t start_ns;
+
+	public:
+		scope(const char* name) noexcept : name(name), start_ns(begin()) { }
+		~scope() { end(name, start_ns); }
+	};
+
+	// NOTE: Only call this once every registered thread is done (joined), that's what makes reading their buffers safe.
+	inline bool write_chrome_trace(const char* path) noexcept {
+		FILE* file = std::fopen(path, "w");
+		if (file == nullptr) { return false; }
+
+		const size_t thread_count = std::min(registered_thread_count.load(std::memory_order_relaxed), max_thread_count);
+
+		// NOTE: Timestamps are made relative to the earliest event, the steady clock's epoch is meaningless anyway.
+		// NOTE: Events are recorded when they end, so the first event of a thread isn't necessarily the one that started first.
+		uint64_t base_ns = (uint64_t)-1;
+		for (size_t i = 0; i < thread_count; i++) {
+			for (size_t j = 0; j < thread_buffers[i].event_count; j++) { base_ns = std::min(base_ns, thread_buffers[i].events[j].start_ns); }
+		}
+
+		std::fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", file);
+		bool first_event = true;
+		for (size_t i = 0; i < thread_count; i++) {
+			const thread_buffer_t& buffer = thread_buffers[i];
+			std::fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\",\"dropped_events\":%zu}}",
+				     first_event ? "" : ",\n", i + 1, buffer.thread_name, buffer.dropped_event_count);
+			first_event = false;
+			for (size_t j = 0; j < buffer.event_count; j++) {
+				const event_t& event = buffer.events[j];
+				std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}",
+					     event.name, i + 1, (event.start_ns - base_ns) / 1000.0, event.duration_ns / 1000.0);
+			}
+		}
+		std::fputs("\n]}\n", file);
+
+		return std::fclose(file) == 0;
+	}
+
+}
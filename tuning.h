@@ -0,0 +1,271 @@
+#pragma once
+
+// Per-host engine parameters (--tune).
+// --tune measures a handful of candidate values on the current host and stores the best ones in a small cache file,
+// which every normal run loads at startup. Without a cache file (or on Windows), the defaults below are used, which are the values
+// that used to be hardcoded.
+// NOTE: The cache file is keyed by CPU model and kernel release. A file from a different host (shared home directories)
+// or from before a kernel upgrade is simply ignored, it doesn't get used with the wrong parameters.
+// NOTE: The cache also holds the host-wide capabilities (see capabilities.h), so that normal runs don't have to go digging through /proc and /sys for them.
+// NOTE: Loading costs a uname(), a cpuid (or a peek at the start of /proc/cpuinfo) and reading one tiny file, nothing measurable next to the actual work.
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <algorithm>
+
+#include "crossplatform_io.h"
+
+#ifndef PLATFORM_WINDOWS
+
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <fcntl.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+#include "capabilities.h"
+
+#endif
+
+namespace tuning {
+
+	struct parameters_t {
+		size_t stream_buffer_size;
+		size_t chunk_size;
+		size_t pipe_size;		// 0 means the pipe size is left alone
+		bool huge_pages;
+		size_t split_thread_count;	// 0 means one per hardware thread
+	};
+
+	inline constexpr parameters_t default_parameters = { 65536, 32, 0, true, 0 };
+
+	// NOTE: Every chunk size is one formatter kernel in srcembed::kernels (the engines are compiled once), so this list has to match that table.
+	// The cost of a candidate is now one more kernel in the binary and one more round of tuning runs, not another copy of every engine.
+	inline constexpr size_t chunk_size_candidates[] = { 8, 16, 32 };
+	inline constexpr size_t stream_buffer_size_candidates[] = { 16384, 65536, 262144, 1048576 };
+	inline constexpr size_t pipe_size_candidates[] = { 0, 262144, 1048576 };
+
+	inline parameters_t parameters = default_parameters;
+	inline bool loaded_from_cache = false;
+
+	template <size_t candidate_count>
+	bool is_candidate(const size_t (&candidates)[candidate_count], size_t value) noexcept {
+		for (size_t candidate : candidates) {
+			if (candidate == value) { return true; }
+		}
+		return false;
+	}
+
+#ifndef PLATFORM_WINDOWS
+
+	// Something like "Intel(R) Core(TM) i7-8550U CPU @ 1.80GHz|6.8.0-45-generic".
+	inline bool get_host_key(char* key, size_t key_size) noexcept {
+		char cpu_model[64] = "unknown cpu";
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		unsigned int brand[12];
+		if (__get_cpuid_max(0x80000000, nullptr) >= 0x80000004) {
+			__get_cpuid(0x80000002, brand + 0, brand + 1, brand + 2, brand + 3);
+			__get_cpuid(0x80000003, brand + 4, brand + 5, brand + 6, brand + 7);
+			__get_cpuid(0x80000004, brand + 8, brand + 9, brand + 10, brand + 11);
+			std::memcpy(cpu_model, brand, sizeof(brand));
+			cpu_model[sizeof(brand)] = '\0';
+		}
+#else
+		// NOTE: /proc/cpuinfo has one block per CPU, so it can get big on big machines. The first block is all we need.
+		const int fd = open("/proc/cpuinfo", O_RDONLY | O_CLOEXEC);
+		if (fd != -1) {
+			char cpuinfo[4096];
+			const ssize_t size = read_entire_buffer(fd, cpuinfo, sizeof(cpuinfo) - 1);
+			close(fd);
+			if (size > 0) {
+				cpuinfo[size] = '\0';
+				for (const char* field_name : { "model name", "Model", "CPU part" }) {
+					const char* field = std::strstr(cpuinfo, field_name);
+					if (field == nullptr) { continue; }
+					const char* value = std::strchr(field, ':');
+					if (value == nullptr) { continue; }
+					value += 1 + (value[1] == ' ');
+					const size_t value_length = std::min(std::strcspn(value, "\n"), sizeof(cpu_model) - 1);
+					std::memcpy(cpu_model, value, value_length);
+					cpu_model[value_length] = '\0';
+					break;
+				}
+			}
+		}
+#endif
+
+		// NOTE: The brand string is padded with spaces on some CPUs.
+		const char* trimmed_cpu_model = cpu_model;
+		while (*trimmed_cpu_model == ' ') { trimmed_cpu_model++; }
+
+		struct utsname system_name;
+		if (uname(&system_name) == -1) { return false; }
+
+		const int key_length = std::snprintf(key, key_size, "%s|%s", trimmed_cpu_model, system_name.release);
+		return key_length >= 0 && (size_t)key_length < key_size;
+	}
+
+	// NOTE: The key is hashed into the file name so that hosts sharing a home directory each get their own file.
+	inline bool get_cache_path(char* path, size_t path_size, const char* host_key) noexcept {
+		uint64_t hash = 0xcbf29ce484222325;		// FNV-1a
+		for (const char* character = host_key; *character != '\0'; character++) {
+			hash ^= (unsigned char)*character;
+			hash *= 0x100000001b3;
+		}
+
+		int path_length;
+		const char* cache_home = std::getenv("XDG_CACHE_HOME");
+		if (cache_home != nullptr && cache_home[0] != '\0') {
+			path_length = std::snprintf(path, path_size, "%s/srcembed/tuning-%016llx", cache_home, (unsigned long long)hash);
+		} else {
+			const char* home = std::getenv("HOME");
+			if (home == nullptr || home[0] == '\0') { return false; }
+			path_length = std::snprintf(path, path_size, "%s/.cache/srcembed/tuning-%016llx", home, (unsigned long long)hash);
+		}
+		return path_length >= 0 && (size_t)path_length < path_size;
+	}
+
+	inline bool parse_size(const char* value, size_t& result) noexcept {
+		if (*value < '0' || *value > '9') { return false; }
+		char* end;
+		const unsigned long long parsed_value = std::strtoull(value, &end, 10);
+		if (*end != '\0') { return false; }
+		result = parsed_value;
+		return true;
+	}
+
+	// NOTE: The capabilities are optional, a cache from before they were added simply doesn't seed anything.
+	struct cached_capabilities_t {
+		bool has_huge_page_size = false;
+		size_t huge_page_size;
+		bool has_thp_mode = false;
+		size_t thp_mode;
+		bool has_pipe_max_size = false;
+		size_t pipe_max_size;
+		bool has_io_uring = false;
+		size_t io_uring;
+	};
+
+	// NOTE: All or nothing, a file with a single bad line (or a different host key) leaves the defaults in place.
+	inline bool parse_cache(char* text, const char* host_key, parameters_t& result, cached_capabilities_t& cached_capabilities) noexcept {
+		bool host_key_matches = false;
+		size_t huge_pages = 1;
+		result = default_parameters;
+
+		for (char* line = std::strtok(text, "\n"); line != nullptr; line = std::strtok(nullptr, "\n")) {
+			if (line[0] == '#') { continue; }
+			char* value = std::strchr(line, '=');
+			if (value == nullptr) { return false; }
+			*value++ = '\0';
+
+			if (std::strcmp(line, "host") == 0) { host_key_matches = std::strcmp(value, host_key) == 0; continue; }
+			if (std::strcmp(line, "stream_buffer_size") == 0) { if (!parse_size(value, result.stream_buffer_size)) { return false; } continue; }
+			if (std::strcmp(line, "chunk_size") == 0) { if (!parse_size(value, result.chunk_size)) { return false; } continue; }
+			if (std::strcmp(line, "pipe_size") == 0) { if (!parse_size(value, result.pipe_size)) { return false; } continue; }
+			if (std::strcmp(line, "huge_pages") == 0) { if (!parse_size(value, huge_pages) || huge_pages > 1) { return false; } continue; }
+			if (std::strcmp(line, "split_thread_count") == 0) { if (!parse_size(value, result.split_thread_count)) { return false; } continue; }
+			if (std::strcmp(line, "huge_page_size") == 0) {
+				if (!parse_size(value, cached_capabilities.huge_page_size)) { return false; }
+				cached_capabilities.has_huge_page_size = true;
+				continue;
+			}
+			if (std::strcmp(line, "thp_mode") == 0) {
+				if (!parse_size(value, cached_capabilities.thp_mode) || cached_capabilities.thp_mode > (size_t)capabilities::thp_mode_t::NEVER) { return false; }
+				cached_capabilities.has_thp_mode = true;
+				continue;
+			}
+			if (std::strcmp(line, "pipe_max_size") == 0) {
+				if (!parse_size(value, cached_capabilities.pipe_max_size)) { return false; }
+				cached_capabilities.has_pipe_max_size = true;
+				continue;
+			}
+			if (std::strcmp(line, "io_uring") == 0) {
+				if (!parse_size(value, cached_capabilities.io_uring) || cached_capabilities.io_uring > 1) { return false; }
+				cached_capabilities.has_io_uring = true;
+				continue;
+			}
+			return false;
+		}
+		result.huge_pages = huge_pages;
+
+		return host_key_matches && is_candidate(chunk_size_candidates, result.chunk_size) &&
+		       is_candidate(stream_buffer_size_candidates, result.stream_buffer_size) && is_candidate(pipe_size_candidates, result.pipe_size);
+	}
+
+	// Loads the cached parameters for this host into parameters, if there are any.
+	inline bool load() noexcept {
+		char host_key[512];
+		if (!get_host_key(host_key, sizeof(host_key))) { return false; }
+		char path[4096];
+		if (!get_cache_path(path, sizeof(path), host_key)) { return false; }
+
+		const int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd == -1) { return false; }
+		char text[1024];
+		const ssize_t size = read_entire_buffer(fd, text, sizeof(text) - 1);
+		close(fd);
+		if (size <= 0) { return false; }
+		text[size] = '\0';
+
+		parameters_t cached_parameters;
+		cached_capabilities_t cached_capabilities;
+		if (!parse_cache(text, host_key, cached_parameters, cached_capabilities)) { return false; }
+		parameters = cached_parameters;
+		loaded_from_cache = true;
+
+		if (cached_capabilities.has_huge_page_size) { capabilities::seed(capabilities::cached_huge_page_size, cached_capabilities.huge_page_size); }
+		if (cached_capabilities.has_thp_mode) { capabilities::seed(capabilities::cached_thp_mode, (capabilities::thp_mode_t)cached_capabilities.thp_mode); }
+		if (cached_capabilities.has_pipe_max_size) { capabilities::seed(capabilities::cached_pipe_max_size, cached_capabilities.pipe_max_size); }
+		if (cached_capabilities.has_io_uring) { capabilities::seed(capabilities::cached_io_uring_available, (bool)cached_capabilities.io_uring); }
+		return true;
+	}
+
+	inline bool make_directories(char* path) noexcept {
+		for (char* separator = std::strchr(path + 1, '/'); separator != nullptr; separator = std::strchr(separator + 1, '/')) {
+			*separator = '\0';
+			const bool failed = mkdir(path, 0755) == -1 && errno != EEXIST;
+			*separator = '/';
+			if (failed) { return false; }
+		}
+		return true;
+	}
+
+	// NOTE: Written to a temporary file first and renamed into place, so a run that starts in the middle of this never sees half a file.
+	inline bool save(const parameters_t& new_parameters, char* path, size_t path_size) noexcept {
+		char host_key[512];
+		if (!get_host_key(host_key, sizeof(host_key))) { return false; }
+		if (!get_cache_path(path, path_size, host_key)) { return false; }
+		if (!make_directories(path)) { return false; }
+
+		char temporary_path[4096 + 8];
+		std::snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path);
+		FILE* file = std::fopen(temporary_path, "w");
+		if (file == nullptr) { return false; }
+		const bool written = std::fprintf(file, "# srcembed tuning cache, regenerate with \"srcembed --tune\"\n" \
+				   "host=%s\n" \
+				   "stream_buffer_size=%zu\n" \
+				   "chunk_size=%zu\n" \
+				   "pipe_size=%zu\n" \
+				   "huge_pages=%u\n" \
+				   "split_thread_count=%zu\n" \
+				   "huge_page_size=%zu\n" \
+				   "thp_mode=%u\n" \
+				   "pipe_max_size=%zu\n" \
+				   "io_uring=%u\n",
+			     host_key, new_parameters.stream_buffer_size, new_parameters.chunk_size, new_parameters.pipe_size,
+			     (unsigned int)new_parameters.huge_pages, new_parameters.split_thread_count,
+			     capabilities::huge_page_size(), (unsigned int)capabilities::thp_mode(), capabilities::pipe_max_size(), (unsigned int)capabilities::io_uring_available()) >= 0;
+		if (std::fclose(file) != 0 || !written) { return false; }
+		return std::rename(temporary_path, path) == 0;
+	}
+
+#endif
+
+}
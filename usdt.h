@@ -0,0 +1,75 @@
+#pragma once
+
+// USDT (user-level statically defined tracing) probes, in the same format that SystemTap's <sys/sdt.h> emits,
+// so that bpftrace, perf and SystemTap can all attach to them without a special build. For example:
+//	bpftrace -e 'usdt:./bin/srcembed:srcembed:vmsplice_entry { @start[tid] = nsecs; }
+//	             usdt:./bin/srcembed:srcembed:vmsplice_return /@start[tid]/ { @ns = hist(nsecs - @start[tid]); delete(@start[tid]); }'
+// NOTE: We don't include <sys/sdt.h> because it isn't installed on most systems (systemtap-sdt-dev) and we only need a tiny bit of it.
+// A probe is a single nop in the code, plus a note in the .note.stapsdt section that says where the nop is and where the probe's arguments live.
+// When nothing is attached, the nop is the only thing that runs. Attaching a tracer swaps the nop for a breakpoint.
+// NOTE: All arguments are passed as 64-bit unsigned integers, that keeps the argument descriptions trivial ("8@<operand>").
+// The "ro" constraint keeps immediates out of the descriptions, since those are spelled differently on every architecture.
+
+#include <cstdint>
+
+#if defined(__linux__) && defined(__GNUC__) && (defined(__x86_64__) || defined(__aarch64__))
+
+#define USDT_ASM(provider, name, argument_descriptions) \
+	"990: nop\n" \
+	".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+	".balign 4\n" \
+	".4byte 992f-991f, 994f-993f, 3\n" \
+	"991: .asciz \"stapsdt\"\n" \
+	"992: .balign 4\n" \
+	"993: .8byte 990b\n" \
+	".8byte _.stapsdt.base\n" \
+	".8byte 0\n" \
+	".asciz " #provider "\n" \
+	".asciz " #name "\n" \
+	".asciz \"" argument_descriptions "\"\n" \
+	"994: .balign 4\n" \
+	".popsection\n" \
+	".ifndef _.stapsdt.base\n" \
+	".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+	".weak _.stapsdt.base\n" \
+	".hidden _.stapsdt.base\n" \
+	"_.stapsdt.base: .space 1\n" \
+	".size _.stapsdt.base, 1\n" \
+	".popsection\n" \
+	".endif\n"
+
+#define USDT_PROBE0(provider, name) __asm__ __volatile__ (USDT_ASM(#provider, #name, ""))
+#define USDT_PROBE1(provider, name, a1) __asm__ __volatile__ (USDT_ASM(#provider, #name, "8@%[usdt_a1]") :: [usdt_a1] "ro" ((uint64_t)(a1)))
+#define USDT_PROBE2(provider, name, a1, a2) __asm__ __volatile__ (USDT_ASM(#provider, #name, "8@%[usdt_a1] 8@%[usdt_a2]") :: [usdt_a1] "ro" ((uint64_t)(a1)), [usdt_a2] "ro" ((uint64_t)(a2)))
+#define USDT_PROBE3(provider, name, a1, a2, a3) __asm__ __volatile__ (USDT_ASM(#provider, #name, "8@%[usdt_a1] 8@%[usdt_a2] 8@%[usdt_a3]") :: [usdt_a1] "ro" ((uint64_t)(a1)), [usdt_a2] "ro" ((uint64_t)(a2)), [usdt_a3] "ro" ((uint64_t)(a3)))
+
+#else
+
+// NOTE: No USDT support on this platform, the probes disappear (arguments aren't even evaluated).
+#define USDT_PROBE0(provider, name)
+#define USDT_PROBE1(provider, name, a1)
+#define USDT_PROBE2(provider, name, a1, a2)
+#define USDT_PROBE3(provider, name, a1, a2, a3)
+
+#endif
+
+#ifndef PLATFORM_WINDOWS
+
+#include <sys/mman.h>
+
+// NOTE: Every mapping we make or drop goes through these two, so that the USDT probes can see all of them (and pair them up through the address).
+inline void* mmap_probed(void* address, size_t length, int protection, int mmap_flags, int fd, off_t offset) noexcept {
+	USDT_PROBE2(srcembed, mmap_entry, length, mmap_flags);
+	void* result = mmap(address, length, protection, mmap_flags, fd, offset);
+	USDT_PROBE2(srcembed, mmap_return, result, length);
+	return result;
+}
+
+inline int munmap_probed(void* address, size_t length) noexcept {
+	USDT_PROBE2(srcembed, munmap_entry, address, length);
+	const int result = munmap(address, length);
+	USDT_PROBE1(srcembed, munmap_return, result);
+	return result;
+}
+
+#endif